@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <sel4/sel4.h>
 #include <sos.h>
+#include <aos/sos_abi.h>
 
 // Block a thread forever
 // we do this by making an unimplemented system call.
@@ -31,8 +32,8 @@ static void thread_block(void)
     /* construct some info about the IPC message console_test will send
      * to sos -- it's 1 word long */
     seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
-    /* Set the first word in the message to 1 */
-    seL4_SetMR(0, 1);
+    /* Set the first word in the message to the reserved syscall */
+    seL4_SetMR(0, SOS_SYSCALL_RESERVED);
     /* Now send the ipc -- call will send the ipc, then block until a reply
      * message is received */
     seL4_Call(SOS_IPC_EP_CAP, tag);
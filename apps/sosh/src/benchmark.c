@@ -16,13 +16,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
 #include <utils/util.h>
+#include <utils/time.h>
 
 #include <sos.h>
+#include <aos/sos_abi.h>
 
 /* number of times to run the benchmark before recording results
  * this primes the caches etc so we don't use cold cache results */
@@ -53,7 +56,7 @@ _Static_assert(BIT(MAX_BUF_SIZE) <= TOTAL_FILE_SIZE, "total file size must be a
 _Static_assert(MIN_BUF_SIZE > 0, "min buf size bigger than 0");
 _Static_assert(MAX_BUF_SIZE >= MIN_BUF_SIZE, "min buf size smaller than or eq to max buf size");
 
-/* name of the benchmark file to write/read to */
+/* name of the benchmark file to write/read to, in the directory given to sos_benchmark() */
 #define BENCHMARK_FILE "benchmark.dat"
 /* name of file to write results to */
 #define BENCHMARK_RESULTS_FILE "results.tsv"
@@ -84,6 +87,29 @@ _Static_assert(MAX_BUF_SIZE >= MIN_BUF_SIZE, "min buf size smaller than or eq to
 
 #define WRITE_PMCR(var) PMU_WRITE(PMCR, var)
 
+/* number of syscalls to time for each sample of the syscall benchmark */
+#define SYSCALL_LOOPS 1000
+
+/* shared memory benchmark: a ring of pages shared between two processes,
+ * at an address nothing else in sosh is mapped at */
+#define SHARE_ADDR          0x70000000ul
+#define SHARE_RING_PAGES    64u
+#define SHARE_CHUNK         PAGE_SIZE_4K
+/* give up if the other process makes no progress for this long */
+#define SHARE_TIMEOUT_US    (10 * US_IN_S)
+
+/* the first shared page holds the ring indices, the rest the ring data */
+typedef struct {
+    /* bytes published by the producer */
+    uint64_t head;
+    /* bytes drained by the consumer */
+    uint64_t tail;
+    /* set by a producer once it has reset head and tail */
+    uint64_t producer_ready;
+    /* set by a consumer once it has seen producer_ready */
+    uint64_t consumer_ready;
+} share_ring_t;
+
 /* amount of loops to do for each benchmark */
 #define LOOPS (TOTAL_FILE_SIZE/BIT(MAX_BUF_SIZE))
 
@@ -131,7 +157,7 @@ static int open_helper(char *name, fmode_t mode)
     return fd;
 }
 
-static int run_benchmark(char *name, benchmark_fn_t fn, uint32_t overhead,
+static int run_benchmark(char *name, char *file, benchmark_fn_t fn, uint32_t overhead,
                          int results_fd, int debug_mode)
 {
     uint32_t results[N_RESULTS];
@@ -139,7 +165,7 @@ static int run_benchmark(char *name, benchmark_fn_t fn, uint32_t overhead,
     READ_PMCR(pmcr);
 
     /* open the file */
-    int fd = open_helper(BENCHMARK_FILE, O_RDWR);
+    int fd = open_helper(file, O_RDWR);
     if (fd == -1) {
         return -1;
     }
@@ -235,8 +261,144 @@ static uint32_t find_overhead(void)
     return overhead;
 }
 
-int sos_benchmark(int debug_mode)
+/* a null syscall sent through the IPC buffer, as before the fast path ABI */
+static int null_syscall_ipc_buffer(void)
+{
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
+    seL4_SetMR(0, SOS_SYSCALL_NULL);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
+}
+
+static void run_syscall_benchmark(char *name, int (*fn)(void), uint32_t overhead)
+{
+    uint32_t results[N_RESULTS];
+    uint32_t pmcr;
+    READ_PMCR(pmcr);
+
+    for (int i = 0; i < N_RESULTS; i++) {
+        uint32_t start, end;
+        reset_ccnt(pmcr);
+        READ_CCNT(start);
+        for (int j = 0; j < SYSCALL_LOOPS; j++) {
+            fn();
+        }
+        READ_CCNT(end);
+        results[i] = end - start - overhead;
+    }
+
+    uint32_t min = UINT32_MAX;
+    uint64_t total = 0;
+    for (int i = WARMUPS; i < N_RESULTS; i++) {
+        min = MIN(min, results[i]);
+        total += results[i];
+    }
+    printf("%s: %u cycles/call (min), %" PRIu64 " cycles/call (mean)\n", name,
+           min / SYSCALL_LOOPS, total / ITERATIONS / SYSCALL_LOOPS);
+}
+
+int sos_benchmark_syscall(void)
+{
+    init_ccnt();
+    uint32_t overhead = find_overhead();
+
+    run_syscall_benchmark("null syscall (IPC buffer)", null_syscall_ipc_buffer, overhead);
+    run_syscall_benchmark("null syscall (fast path)", sos_null_syscall, overhead);
+    return 0;
+}
+
+/* wait for the other process to move *word to at least value, or time out */
+static int share_wait(const uint64_t *word, uint64_t value)
 {
+    int64_t start = sos_time_stamp();
+    while (__atomic_load_n(word, __ATOMIC_ACQUIRE) < value) {
+        if (sos_time_stamp() - start > (int64_t) SHARE_TIMEOUT_US) {
+            return -1;
+        }
+        seL4_Yield();
+    }
+    return 0;
+}
+
+int sos_benchmark_share(int producer)
+{
+    size_t ring_size = SHARE_RING_PAGES * PAGE_SIZE_4K;
+    /* sharing the region again from the same process only sets its rights,
+     * so the benchmark can be run more than once */
+    if (sos_share_vm((void *) SHARE_ADDR, PAGE_SIZE_4K + ring_size, 1) != 0) {
+        printf("Failed to share benchmark region\n");
+        return -1;
+    }
+    share_ring_t *ring = (share_ring_t *) SHARE_ADDR;
+    char *data = (char *) SHARE_ADDR + PAGE_SIZE_4K;
+
+    if (producer) {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->consumer_ready = 0;
+        __atomic_store_n(&ring->producer_ready, 1, __ATOMIC_RELEASE);
+        printf("Waiting for a consumer (\"benchmark -c\" in another process)\n");
+        if (share_wait(&ring->consumer_ready, 1) != 0) {
+            printf("No consumer started\n");
+            __atomic_store_n(&ring->producer_ready, 0, __ATOMIC_RELEASE);
+            return -1;
+        }
+    } else {
+        printf("Waiting for a producer (\"benchmark -w\" in another process)\n");
+        if (share_wait(&ring->producer_ready, 1) != 0) {
+            printf("No producer started\n");
+            return -1;
+        }
+        __atomic_store_n(&ring->consumer_ready, 1, __ATOMIC_RELEASE);
+    }
+
+    int64_t start = sos_time_stamp();
+    uint64_t done;
+    for (done = 0; done < TOTAL_FILE_SIZE; done += SHARE_CHUNK) {
+        char *slot = &data[done % ring_size];
+        if (producer) {
+            /* wait for a free slot, fill it and publish it */
+            if (done >= ring_size && share_wait(&ring->tail, done + SHARE_CHUNK - ring_size) != 0) {
+                break;
+            }
+            memcpy(slot, &buf[done], SHARE_CHUNK);
+            __atomic_store_n(&ring->head, done + SHARE_CHUNK, __ATOMIC_RELEASE);
+        } else {
+            /* wait for a full slot, drain it and hand it back */
+            if (share_wait(&ring->head, done + SHARE_CHUNK) != 0) {
+                break;
+            }
+            memcpy(&buf[done], slot, SHARE_CHUNK);
+            __atomic_store_n(&ring->tail, done + SHARE_CHUNK, __ATOMIC_RELEASE);
+        }
+    }
+    /* the transfer is over once the consumer has drained the ring */
+    if (producer && done == TOTAL_FILE_SIZE && share_wait(&ring->tail, TOTAL_FILE_SIZE) != 0) {
+        done = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+    int64_t elapsed = sos_time_stamp() - start;
+    if (producer) {
+        __atomic_store_n(&ring->producer_ready, 0, __ATOMIC_RELEASE);
+    }
+
+    if (done != TOTAL_FILE_SIZE) {
+        printf("The other process stopped after %" PRIu64 " bytes\n", done);
+        return -1;
+    }
+    printf("%s %u bytes through shared memory in %" PRId64 "us (%" PRId64 " KiB/s)\n",
+           producer ? "sent" : "received", TOTAL_FILE_SIZE, elapsed,
+           elapsed > 0 ? (int64_t) (TOTAL_FILE_SIZE * US_IN_S / KB / elapsed) : 0);
+    return 0;
+}
+
+int sos_benchmark(int debug_mode, const char *dir)
+{
+    char file[PATH_MAX];
+    if (snprintf(file, sizeof(file), "%s%s", dir, BENCHMARK_FILE) >= (int) sizeof(file)) {
+        printf("Benchmark directory %s is too long\n", dir);
+        return -1;
+    }
+
     init_ccnt();
 
     /* find overhead of measuring cycle counter */
@@ -251,7 +413,7 @@ int sos_benchmark(int debug_mode)
 
     sos_fprintf(results_fd, "[");
     /* benchmark write */
-    int res = run_benchmark("sos_write", (benchmark_fn_t) sos_write,
+    int res = run_benchmark("sos_write", file, (benchmark_fn_t) sos_write,
                             overhead, results_fd, debug_mode);
 
     if (res == -1) {
@@ -261,7 +423,7 @@ int sos_benchmark(int debug_mode)
     sos_fprintf(results_fd, ",");
 
     /* benchmark read */
-    res = run_benchmark("sos_read", sos_read, overhead, results_fd,
+    res = run_benchmark("sos_read", file, sos_read, overhead, results_fd,
                         debug_mode);
     sos_fprintf(results_fd, "]");
     sos_close(results_fd);
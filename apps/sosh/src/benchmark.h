@@ -12,5 +12,12 @@
 /* tell the compiler to only include this file once */
 #pragma once
 
-/* run the benchmark */
-int sos_benchmark(int debug_mode);
+/* run the benchmark on a file in dir, which is "" or ends in "/" */
+int sos_benchmark(int debug_mode, const char *dir);
+
+/* measure the latency of the null syscall */
+int sos_benchmark_syscall(void);
+
+/* measure shared memory throughput to another process, as the producer or
+ * the consumer */
+int sos_benchmark_share(int producer);
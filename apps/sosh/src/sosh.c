@@ -33,11 +33,16 @@
 static int in;
 static sos_stat_t sbuf;
 
+static char type_char(st_type_t type)
+{
+    return type == ST_SPECIAL ? 's' : type == ST_DIR ? 'd' : '-';
+}
+
 static void prstat(const char *name)
 {
     /* print out stat buf */
     printf("%c%c%c%c 0x%06x 0x%lx 0x%06lx %s\n",
-           sbuf.st_type == ST_SPECIAL ? 's' : '-',
+           type_char(sbuf.st_type),
            sbuf.st_fmode & FM_READ ? 'r' : '-',
            sbuf.st_fmode & FM_WRITE ? 'w' : '-',
            sbuf.st_fmode & FM_EXEC ? 'x' : '-', sbuf.st_size, sbuf.st_ctime,
@@ -179,8 +184,10 @@ static int exec(int argc, char **argv)
 
 static int dir(int argc, char **argv)
 {
-    int i = 0, r;
-    char buf[BUF_SIZ];
+    unsigned long cookie = 0;
+    int r;
+    /* Records are word aligned */
+    seL4_Word buf[BUF_SIZ / sizeof(seL4_Word)];
 
     if (argc > 2) {
         printf("Usage: %s [file]\n", argv[0]);
@@ -197,21 +204,20 @@ static int dir(int argc, char **argv)
         return 0;
     }
 
+    /* Each call returns as many entries as fit in buf */
     while (1) {
-        r = sos_getdirent(i, buf, BUF_SIZ);
+        r = sos_getdirents(".", &cookie, buf, sizeof(buf));
         if (r < 0) {
-            printf("dirent(%d) failed: %d\n", i, r);
+            printf("getdirents(%lu) failed: %d\n", cookie, r);
             break;
         } else if (!r) {
             break;
         }
-        r = sos_stat(buf, &sbuf);
-        if (r < 0) {
-            printf("stat(%s) failed: %d\n", buf, r);
-            break;
+        for (int off = 0; off < r;) {
+            sos_dirent_t *d = (sos_dirent_t *) ((char *) buf + off);
+            printf("%c 0x%06x %s\n", type_char(d->d_type), d->d_size, d->d_name);
+            off += d->d_reclen;
         }
-        prstat(buf);
-        i++;
     }
     return 0;
 }
@@ -272,14 +278,27 @@ static int kill(int argc, char *argv[])
 
 static int benchmark(int argc, char *argv[])
 {
+    /* -t runs the file benchmark on tmpfs, leaving out the cost of NFS */
+    const char *dir = "";
+    if (argc > 1 && strcmp(argv[argc - 1], "-t") == 0) {
+        dir = "/tmp/";
+        argc--;
+    }
+
     if (argc == 1 || (argc == 2 && strcmp(argv[1], "-d") == 0)) {
         printf("Running benchmark in DEBUG mode. To run in performance mode, use -p flag\n");
-        return sos_benchmark(1);
+        return sos_benchmark(1, dir);
     } else if (argc == 2 && strcmp(argv[1], "-p") == 0) {
         printf("Running benchmark in PERFORMANCE mode\n");
-        return sos_benchmark(0);
+        return sos_benchmark(0, dir);
+    } else if (argc == 2 && strcmp(argv[1], "-s") == 0) {
+        printf("Running syscall latency benchmark\n");
+        return sos_benchmark_syscall();
+    } else if (argc == 2 && (strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "-c") == 0)) {
+        printf("Running shared memory benchmark\n");
+        return sos_benchmark_share(strcmp(argv[1], "-w") == 0);
     } else {
-        printf("Usage: %s [-dp]\n", argv[0]);
+        printf("Usage: %s [-dpswc] [-t]\n", argv[0]);
         return -1;
     }
 }
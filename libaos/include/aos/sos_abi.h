@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The SOS syscall ABI, shared by SOS and libsosapi.
+ *
+ * A syscall is an seL4_Call on the SOS endpoint. The first message word is
+ * the syscall number and the following words are its arguments. The reply
+ * holds the return value in its first word, followed by any results.
+ *
+ * Small syscalls use the fast path: the number plus at most
+ * SOS_FASTPATH_MAX_ARGS arguments, and a reply of at most
+ * SOS_FASTPATH_WORDS words. These fit in the message registers the kernel
+ * passes in machine registers (seL4_FastMessageRegisters, 4 on AArch64),
+ * so with the *WithMRs system call variants neither side touches its IPC
+ * buffer.
+ */
+
+#include <stdint.h>
+#include <sel4/sel4.h>
+
+/* Message words that are passed in registers */
+#define SOS_FASTPATH_WORDS      seL4_FastMessageRegisters
+/* Arguments that fit in the fast path after the syscall number */
+#define SOS_FASTPATH_MAX_ARGS   (SOS_FASTPATH_WORDS - 1)
+
+/* Syscall numbers */
+
+/* Does nothing and returns 0 */
+#define SOS_SYSCALL_NULL        0
+/* Never implemented. console_test blocks itself forever by calling it */
+#define SOS_SYSCALL_RESERVED    1
+/* sos_share_vm(adr, size, writable) */
+#define SOS_SYSCALL_SHARE_VM    2
+
+/*
+ * sos_getdirents(path, cookie, buf, nbytes)
+ *
+ * Request: cookie, bytes of records wanted, then the path, NUL terminated.
+ * Reply:   bytes of records or -1, the cookie to continue from, and 1 if
+ *          there are no entries after these, then the records.
+ */
+#define SOS_SYSCALL_GETDIRENTS  3
+
+/*
+ * File I/O. The file calls share a layout: after the syscall number come
+ * two arguments, then the path or data, which is at most SOS_IO_MAX_BYTES.
+ * A reply holds the result in its first word, -1 on error, and any data
+ * again after SOS_IO_HEADER_WORDS.
+ *
+ * sos_open(path, mode)
+ *   Request: mode (O_RDONLY, O_WRONLY or O_RDWR, with no other flags), 0,
+ *            then the path, NUL terminated.
+ *   Reply:   the file descriptor, or a negative errno value: EINVAL for any
+ *            other mode, ENOENT for a missing file opened only for reading
+ *            (others are created), EBUSY for the console when it is
+ *            already open for reading.
+ * sos_close(file)
+ *   Request: the file descriptor.
+ *   Reply:   0.
+ * sos_read(file, buf, nbyte)
+ *   Request: the file descriptor, bytes wanted.
+ *   Reply:   bytes read, 0, 0, then the data.
+ * sos_write(file, buf, nbyte)
+ *   Request: the file descriptor, bytes to write, then the data.
+ *   Reply:   bytes written.
+ * sos_stat(path, buf)
+ *   Request: 0, 0, then the path, NUL terminated.
+ *   Reply:   0, then the st_type, the Unix permission bits, the size, and
+ *            the creation and access times in ms.
+ */
+#define SOS_SYSCALL_OPEN        4
+#define SOS_SYSCALL_CLOSE       5
+#define SOS_SYSCALL_READ        6
+#define SOS_SYSCALL_WRITE       7
+#define SOS_SYSCALL_STAT        8
+
+/* Words of a file call request or reply before the path or data */
+#define SOS_IO_HEADER_WORDS     3
+/* Most bytes of path or data that fit in one message */
+#define SOS_IO_MAX_BYTES        ((seL4_MsgMaxLength - SOS_IO_HEADER_WORDS) * sizeof(seL4_Word))
+
+/* Files a process may have open at once, including stdin, stdout and
+ * stderr, which are not opened through SOS */
+#define PROCESS_MAX_FILES       16
+
+/* stat file types */
+#define ST_FILE    1    /* plain file */
+#define ST_SPECIAL 2    /* special (console) file */
+#define ST_DIR     3    /* directory */
+
+/*
+ * A directory entry returned by sos_getdirents(). Records are packed one
+ * after another; each starts on a word boundary, d_reclen bytes after the
+ * start of the one before it.
+ */
+typedef struct {
+    uint16_t d_reclen;
+    /* ST_FILE, ST_SPECIAL or ST_DIR */
+    uint16_t d_type;
+    /* Size in bytes */
+    uint32_t d_size;
+    /* NUL terminated */
+    char d_name[];
+} sos_dirent_t;
+
+#define SOS_DIRENT_ALIGN            sizeof(seL4_Word)
+/* Length of the record for a name of name_len bytes, not counting the NUL */
+#define SOS_DIRENT_RECLEN(name_len) \
+    ((sizeof(sos_dirent_t) + (name_len) + 1 + SOS_DIRENT_ALIGN - 1) & ~(SOS_DIRENT_ALIGN - 1))
+/* Words of a getdirents request or reply before the path or records */
+#define SOS_GETDIRENTS_HEADER_WORDS 3
+/* Most bytes of records, or of path, that fit in one message */
+#define SOS_GETDIRENTS_MAX_BYTES \
+    ((seL4_MsgMaxLength - SOS_GETDIRENTS_HEADER_WORDS) * sizeof(seL4_Word))
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Layout of the time page, which SOS maps read-only into every process so
+ * that the time can be read without a syscall.
+ *
+ * The time is derived from the ARM generic counter (CNTVCT), which the
+ * kernel exports to user level:
+ *
+ *     ns = boot_offset_ns + (((CNTVCT - cnt_base) * ns_mult) >> ns_shift)
+ *
+ * SOS fills in the page once at boot, before any process can map it, and
+ * never writes it again, so readers need no synchronisation.
+ */
+
+#include <stdint.h>
+#include <utils/time.h>
+
+/* Where SOS maps the time page in each process */
+#define SOS_TIME_PAGE_VADDR  (0xA0001000ul)
+
+typedef struct {
+    uint32_t ns_shift;
+    /* Multiplier converting counter ticks to ns, scaled by 2^ns_shift */
+    uint64_t ns_mult;
+    /* Frequency of the generic counter in Hz */
+    uint64_t cnt_freq;
+    /* Generic counter value when the page was set up */
+    uint64_t cnt_base;
+    /* Nanoseconds since boot at cnt_base */
+    uint64_t boot_offset_ns;
+} sos_time_page_t;
+
+static inline uint64_t sos_time_page_ticks(void)
+{
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+}
+
+/*
+ * @return  nanoseconds since boot, as described by the time page.
+ */
+static inline uint64_t sos_time_page_ns(const sos_time_page_t *page)
+{
+    uint64_t delta = sos_time_page_ticks() - page->cnt_base;
+    return page->boot_offset_ns +
+           (uint64_t)(((unsigned __int128) delta * page->ns_mult) >> page->ns_shift);
+}
+
+/*
+ * @return  microseconds since boot, as described by the time page.
+ */
+static inline uint64_t sos_time_page_us(const sos_time_page_t *page)
+{
+    return sos_time_page_ns(page) / NS_IN_US;
+}
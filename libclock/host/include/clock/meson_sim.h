@@ -0,0 +1,103 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * A software model of the Meson timer device, for running libclock on a
+ * host machine.
+ *
+ * The model owns a page laid out like the real device page, which is
+ * passed to start_timer() in place of the mapped registers. Time only
+ * moves when meson_sim_advance() is called, at which point the model
+ * catches up with the registers the driver has written: it counts down
+ * timers A-D at the timebase selected in the mux, raising their IRQs when
+ * they reach 0, and counts up the timer E timestamp.
+ *
+ * A typical loop is:
+ *
+ *     start_timer(meson_sim_page(&sim));
+ *     register_timer(...);
+ *     meson_sim_advance(&sim, 1000);
+ *     seL4_Word irq;
+ *     while (meson_sim_next_irq(&sim, &irq)) {
+ *         timer_irq(NULL, irq, 0);
+ *     }
+ *
+ * The model is simpler than the hardware in two ways. Writing a timeout
+ * register is only noticed on the next advance, so rewriting it with the
+ * value the model last left in it does not restart the count. A one-shot
+ * timer clears its enable bit in the mux when it expires, so enabling it
+ * again always restarts it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <utils/util.h>
+#include <clock/device.h>
+
+#define MESON_SIM_TIMEOUTS  (MESON_TIMER_D + 1)
+
+typedef struct {
+    /* Value the model last left in the register, to spot driver writes */
+    uint32_t shadow;
+    /* Whether the timer was enabled at the last advance */
+    bool running;
+    /* Time into the current tick, in us */
+    uint64_t partial_us;
+} meson_sim_timeout_t;
+
+typedef struct {
+    /* The device page handed to start_timer() */
+    unsigned char page[PAGE_SIZE_4K] ALIGN(PAGE_SIZE_4K);
+    /* The virtual clock, in us */
+    uint64_t now_us;
+    /* Timer E, and the time into its current tick in us */
+    uint64_t timestamp;
+    uint64_t timestamp_partial_us;
+    meson_sim_timeout_t timeouts[MESON_SIM_TIMEOUTS];
+    /* Timeouts whose IRQ is raised and not yet taken */
+    uint32_t pending;
+    /* Number of IRQs raised since the model was initialised */
+    uint64_t irqs;
+} meson_sim_t;
+
+/*
+ * Reset the device to its power-on state, with the virtual clock at 0.
+ */
+void meson_sim_init(meson_sim_t *sim);
+
+/*
+ * @return  the address to pass to start_timer().
+ */
+unsigned char *meson_sim_page(meson_sim_t *sim);
+
+/*
+ * Move the virtual clock forward, updating the registers and raising the
+ * IRQs of timeouts that expire on the way.
+ */
+void meson_sim_advance(meson_sim_t *sim, uint64_t us);
+
+/*
+ * Advance the virtual clock to the next time a timeout fires, if that is
+ * no more than max_us away.
+ *
+ * @return  true if a timeout fired.
+ */
+bool meson_sim_run_to_irq(meson_sim_t *sim, uint64_t max_us);
+
+/*
+ * Take a raised IRQ, lowest timer first.
+ *
+ * @param irq  Set to the IRQ number, as from meson_timeout_irq().
+ * @return     false if no IRQ is raised.
+ */
+bool meson_sim_next_irq(meson_sim_t *sim, seL4_Word *irq);
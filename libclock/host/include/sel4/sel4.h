@@ -0,0 +1,22 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/* IRQs from the simulated timer need no acknowledgement */
+
+#include <sel4/types.h>
+
+static inline seL4_Error seL4_IRQHandler_Ack(seL4_IRQHandler handler)
+{
+    (void) handler;
+    return seL4_NoError;
+}
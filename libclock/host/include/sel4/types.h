@@ -0,0 +1,25 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/* The few seL4 types and calls libclock uses, for building it on a host */
+
+#include <stdint.h>
+#include <autoconf.h>
+
+typedef uintptr_t seL4_Word;
+typedef seL4_Word seL4_CPtr;
+typedef seL4_CPtr seL4_IRQHandler;
+
+typedef enum {
+    seL4_NoError = 0,
+} seL4_Error;
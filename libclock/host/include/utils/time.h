@@ -0,0 +1,21 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/* The time unit constants of libutils' <utils/time.h> */
+
+#define MS_IN_S     1000ull
+#define US_IN_MS    1000ull
+#define US_IN_S     1000000ull
+#define NS_IN_US    1000ull
+#define NS_IN_MS    1000000ull
+#define NS_IN_S     1000000000ull
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The parts of libutils' <utils/util.h> that libclock and the simulated
+ * timer use, so the host build does not need util_libs.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utils/time.h>
+
+#define PAGE_SIZE_4K    4096
+
+#define BIT(n)          (1ul << (n))
+#define MASK(n)         (BIT(n) - 1ul)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define ARRAY_SIZE(x)   (sizeof(x) / sizeof((x)[0]))
+#define CTZL(x)         __builtin_ctzl(x)
+
+#define UNUSED          __attribute__((unused))
+#define ALIGN(n)        __attribute__((aligned(n)))
+
+#define COMPILER_MEMORY_FENCE() __atomic_signal_fence(__ATOMIC_ACQ_REL)
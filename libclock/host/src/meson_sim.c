@@ -0,0 +1,212 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include <string.h>
+#include <clock/meson_sim.h>
+
+#include "device.h"
+
+typedef struct {
+    uint32_t enable;
+    uint32_t mode;
+    uint32_t input_clk;
+} sim_timeout_info_t;
+
+#define DEFINE_SIM_TIMEOUT(timeout) \
+    [MESON_##timeout] = { \
+        .enable = timeout##_EN, \
+        .mode = timeout##_MODE, \
+        .input_clk = timeout##_INPUT_CLK, \
+    }
+
+static const sim_timeout_info_t timeout_info[MESON_SIM_TIMEOUTS] = {
+    DEFINE_SIM_TIMEOUT(TIMER_A),
+    DEFINE_SIM_TIMEOUT(TIMER_B),
+    DEFINE_SIM_TIMEOUT(TIMER_C),
+    DEFINE_SIM_TIMEOUT(TIMER_D),
+};
+
+/* Length of a tick of each timebase, in us */
+static const uint64_t timeout_tick_us[] = {
+    [TIMEOUT_TIMEBASE_1_US] = 1,
+    [TIMEOUT_TIMEBASE_10_US] = 10,
+    [TIMEOUT_TIMEBASE_100_US] = 100,
+    [TIMEOUT_TIMEBASE_1_MS] = 1000,
+};
+
+/* The system timebase is modelled as 1us too */
+static const uint64_t timestamp_tick_us[] = {
+    [TIMESTAMP_TIMEBASE_SYSTEM] = 1,
+    [TIMESTAMP_TIMEBASE_1_US] = 1,
+    [TIMESTAMP_TIMEBASE_10_US] = 10,
+    [TIMESTAMP_TIMEBASE_100_US] = 100,
+    [TIMESTAMP_TIMEBASE_1_MS] = 1000,
+};
+
+static volatile meson_timer_reg_t *sim_regs(meson_sim_t *sim)
+{
+    return (volatile meson_timer_reg_t *)(sim->page + TIMER_REG_START);
+}
+
+/* Timers A-D are consecutive registers */
+static volatile uint32_t *timeout_reg(meson_sim_t *sim, timeout_id_t timer)
+{
+    return &sim_regs(sim)->timer_a + timer;
+}
+
+static uint64_t tick_us(meson_sim_t *sim, timeout_id_t timer)
+{
+    return timeout_tick_us[(sim_regs(sim)->mux >> timeout_info[timer].input_clk) & TIMEOUT_TIMEBASE_MASK];
+}
+
+/* The driver writes the starting count to the low half of a timeout
+ * register, and the device counts down in the high half */
+static uint16_t timeout_start(uint32_t reg)
+{
+    return reg & MASK(16);
+}
+
+static uint16_t timeout_count(uint32_t reg)
+{
+    return reg >> 16;
+}
+
+static void set_timeout_reg(meson_sim_t *sim, timeout_id_t timer, uint16_t start, uint16_t count)
+{
+    uint32_t reg = ((uint32_t) count << 16) | start;
+    *timeout_reg(sim, timer) = reg;
+    sim->timeouts[timer].shadow = reg;
+}
+
+/* Catch up with whatever the driver has written since the last advance */
+static void sync_timeouts(meson_sim_t *sim)
+{
+    for (timeout_id_t timer = MESON_TIMER_A; timer < MESON_SIM_TIMEOUTS; timer++) {
+        meson_sim_timeout_t *timeout = &sim->timeouts[timer];
+        bool enabled = sim_regs(sim)->mux & timeout_info[timer].enable;
+        uint32_t reg = *timeout_reg(sim, timer);
+
+        if (enabled && (!timeout->running || reg != timeout->shadow)) {
+            /* Started, or restarted with a new count. A count of 0 is
+             * treated as 1, firing on the next tick. */
+            uint16_t start = timeout_start(reg);
+            set_timeout_reg(sim, timer, start, MAX(start, 1));
+            timeout->partial_us = 0;
+        }
+        timeout->running = enabled;
+    }
+}
+
+/* Time until a running timeout fires, in us */
+static uint64_t time_to_fire(meson_sim_t *sim, timeout_id_t timer)
+{
+    uint16_t count = timeout_count(*timeout_reg(sim, timer));
+    return count * tick_us(sim, timer) - sim->timeouts[timer].partial_us;
+}
+
+static void step_timeout(meson_sim_t *sim, timeout_id_t timer, uint64_t us)
+{
+    meson_sim_timeout_t *timeout = &sim->timeouts[timer];
+    uint32_t reg = *timeout_reg(sim, timer);
+    uint16_t start = timeout_start(reg);
+    uint16_t count = timeout_count(reg);
+    uint64_t tick = tick_us(sim, timer);
+
+    timeout->partial_us += us;
+    uint64_t ticks = timeout->partial_us / tick;
+    timeout->partial_us %= tick;
+
+    if (ticks < count) {
+        set_timeout_reg(sim, timer, start, count - ticks);
+        return;
+    }
+
+    sim->pending |= BIT(timer);
+    sim->irqs++;
+
+    if (sim_regs(sim)->mux & timeout_info[timer].mode) {
+        /* Periodic: reload, carrying over the ticks past the expiry. Any
+         * further expiries in this step merge into the one raised IRQ. */
+        uint16_t reload = MAX(start, 1);
+        set_timeout_reg(sim, timer, start, reload - (ticks - count) % reload);
+    } else {
+        /* One-shot: stop */
+        sim_regs(sim)->mux &= ~timeout_info[timer].enable;
+        set_timeout_reg(sim, timer, start, 0);
+        timeout->running = false;
+        timeout->partial_us = 0;
+    }
+}
+
+static void step_timestamp(meson_sim_t *sim, uint64_t us)
+{
+    volatile meson_timer_reg_t *regs = sim_regs(sim);
+    uint32_t timebase = (regs->mux >> TIMER_E_INPUT_CLK) & TIMESTAMP_TIMEBASE_MASK;
+    uint64_t tick = timebase < ARRAY_SIZE(timestamp_tick_us) ? timestamp_tick_us[timebase] : 1;
+
+    sim->timestamp_partial_us += us;
+    sim->timestamp += sim->timestamp_partial_us / tick;
+    sim->timestamp_partial_us %= tick;
+
+    regs->timer_e = sim->timestamp & MASK(32);
+    regs->timer_e_hi = sim->timestamp >> 32;
+}
+
+void meson_sim_init(meson_sim_t *sim)
+{
+    memset(sim, 0, sizeof(*sim));
+}
+
+unsigned char *meson_sim_page(meson_sim_t *sim)
+{
+    return sim->page;
+}
+
+void meson_sim_advance(meson_sim_t *sim, uint64_t us)
+{
+    sync_timeouts(sim);
+    for (timeout_id_t timer = MESON_TIMER_A; timer < MESON_SIM_TIMEOUTS; timer++) {
+        if (sim->timeouts[timer].running) {
+            step_timeout(sim, timer, us);
+        }
+    }
+    step_timestamp(sim, us);
+    sim->now_us += us;
+}
+
+bool meson_sim_run_to_irq(meson_sim_t *sim, uint64_t max_us)
+{
+    sync_timeouts(sim);
+
+    uint64_t next = UINT64_MAX;
+    for (timeout_id_t timer = MESON_TIMER_A; timer < MESON_SIM_TIMEOUTS; timer++) {
+        if (sim->timeouts[timer].running) {
+            next = MIN(next, time_to_fire(sim, timer));
+        }
+    }
+    if (next > max_us) {
+        return false;
+    }
+
+    meson_sim_advance(sim, next);
+    return true;
+}
+
+bool meson_sim_next_irq(meson_sim_t *sim, seL4_Word *irq)
+{
+    if (sim->pending == 0) {
+        return false;
+    }
+    timeout_id_t timer = CTZL(sim->pending);
+    sim->pending &= ~BIT(timer);
+    *irq = meson_timeout_irq(timer);
+    return true;
+}
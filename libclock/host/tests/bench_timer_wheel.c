@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+/* The checks must run whatever the build type */
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <utils/time.h>
+#include <utils/util.h>
+#include <clock/timer_wheel.h>
+
+/* Timers live at once, and added and removed in total */
+#define TIMER_BENCH_LIVE    10000
+#define TIMER_BENCH_TOTAL   100000
+
+static void count_timer(UNUSED uint32_t id, void *data)
+{
+    (*(int *) data)++;
+}
+
+static uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+int main(void)
+{
+    static uint32_t ids[TIMER_BENCH_LIVE];
+    timer_wheel_t wheel;
+    uint64_t add_ns = 0, remove_ns = 0;
+    uint64_t seed = 1;
+    int fired = 0;
+
+    timer_wheel_init(&wheel, 0);
+    for (int round = 0; round < TIMER_BENCH_TOTAL / TIMER_BENCH_LIVE; round++) {
+        uint64_t start = host_time_ns();
+        for (int i = 0; i < TIMER_BENCH_LIVE; i++) {
+            /* Spread deadlines over an hour with a simple LCG */
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            uint64_t deadline = 1 + (seed >> 33) % (3600ull * US_IN_S);
+            ids[i] = timer_wheel_add(&wheel, deadline, deadline, count_timer, &fired);
+            assert(ids[i] != 0);
+        }
+        uint64_t mid = host_time_ns();
+        for (int i = 0; i < TIMER_BENCH_LIVE; i++) {
+            assert(timer_wheel_remove(&wheel, ids[i]));
+        }
+        uint64_t end = host_time_ns();
+        add_ns += mid - start;
+        remove_ns += end - mid;
+    }
+    assert(wheel.count == 0);
+    timer_wheel_advance(&wheel, 3600ull * US_IN_S);
+    assert(fired == 0);
+    timer_wheel_destroy(&wheel);
+
+    printf("Timer wheel: %d adds in %lluus, %d removes in %lluus\n", TIMER_BENCH_TOTAL,
+           (unsigned long long)(add_ns / NS_IN_US), TIMER_BENCH_TOTAL,
+           (unsigned long long)(remove_ns / NS_IN_US));
+    return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+/* The checks must run whatever the build type */
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <clock/clock.h>
+#include <clock/meson_sim.h>
+
+/* The coarsest timeout timebase, and so the most a timer can fire late */
+#define MAX_TICK_US     1000
+
+#define RANDOM_TIMERS   5000
+#define CHAIN_LENGTH    100
+#define CHAIN_PERIOD_US 1000
+/* Longer than any test waits for a timeout */
+#define RUN_LIMIT_US    (3600ull * US_IN_S)
+
+static meson_sim_t sim;
+
+typedef struct {
+    uint64_t earliest;
+    uint64_t latest;
+    uint64_t fired_at;
+    int fired;
+} expect_t;
+
+static void record(UNUSED uint32_t id, void *data)
+{
+    expect_t *expect = data;
+    expect->fired++;
+    expect->fired_at = get_time();
+}
+
+static uint32_t expect_timer(expect_t *expect, uint64_t delay, uint64_t slack)
+{
+    uint64_t now = get_time();
+    *expect = (expect_t) {
+        .earliest = now + delay,
+        .latest = now + delay + slack,
+    };
+    return register_timer(delay, slack, record, expect);
+}
+
+static void assert_in_window(expect_t *expect)
+{
+    assert(expect->fired == 1);
+    assert(expect->fired_at >= expect->earliest);
+    assert(expect->fired_at <= expect->latest + MAX_TICK_US);
+}
+
+static void reset(void)
+{
+    meson_sim_init(&sim);
+    assert(start_timer(meson_sim_page(&sim)) == CLOCK_R_OK);
+}
+
+/* Take IRQs until no timeout is left running, returning how many were taken */
+static uint64_t run_timers(void)
+{
+    uint64_t start = sim.irqs;
+    do {
+        seL4_Word irq;
+        while (meson_sim_next_irq(&sim, &irq)) {
+            assert(timer_irq(NULL, irq, 0) == CLOCK_R_OK);
+        }
+    } while (meson_sim_run_to_irq(&sim, RUN_LIMIT_US));
+    return sim.irqs - start;
+}
+
+static void test_one_shot(void)
+{
+    expect_t expect, removed;
+    reset();
+
+    /* Within the 1us timebase a timer fires exactly on time */
+    uint32_t id = expect_timer(&removed, 300, 0);
+    assert(id != 0);
+    assert(expect_timer(&expect, 500, 0) != 0);
+    assert(remove_timer(id) == CLOCK_R_OK);
+    assert(remove_timer(id) == CLOCK_R_FAIL);
+
+    /* The removed timer's timeout still fires, finds nothing due and is
+     * programmed again */
+    assert(run_timers() == 2);
+    assert(removed.fired == 0);
+    assert(expect.fired == 1 && expect.fired_at == 500);
+}
+
+static void test_long_delay(void)
+{
+    expect_t expect;
+
+    /* One timeout for the deadline itself, not one per wheel level */
+    reset();
+    assert(expect_timer(&expect, 20 * US_IN_S, 0) != 0);
+    assert(run_timers() == 1);
+    assert_in_window(&expect);
+
+    /* Past the longest timeout, 65535 of the 1ms timebase, the timeout is
+     * programmed again for the rest */
+    reset();
+    assert(expect_timer(&expect, 100 * US_IN_S, 0) != 0);
+    assert(run_timers() == 2);
+    assert_in_window(&expect);
+}
+
+static struct {
+    expect_t links[CHAIN_LENGTH];
+    int n_links;
+} chain;
+
+/* Each link registers the next from its callback, as a periodic task does */
+static void chain_link(uint32_t id, void *data)
+{
+    record(id, data);
+    if (chain.n_links < CHAIN_LENGTH) {
+        expect_t *next = &chain.links[chain.n_links++];
+        uint64_t now = get_time();
+        *next = (expect_t) {
+            .earliest = now + CHAIN_PERIOD_US,
+            .latest = now + CHAIN_PERIOD_US,
+        };
+        assert(register_timer(CHAIN_PERIOD_US, 0, chain_link, next) != 0);
+    }
+}
+
+static void test_chaining(void)
+{
+    reset();
+    chain.n_links = 1;
+    chain.links[0] = (expect_t) {
+        .earliest = CHAIN_PERIOD_US,
+        .latest = CHAIN_PERIOD_US,
+    };
+    assert(register_timer(CHAIN_PERIOD_US, 0, chain_link, &chain.links[0]) != 0);
+
+    assert(run_timers() == CHAIN_LENGTH);
+    for (int i = 0; i < CHAIN_LENGTH; i++) {
+        assert_in_window(&chain.links[i]);
+    }
+    assert(sim.now_us == CHAIN_LENGTH * CHAIN_PERIOD_US);
+}
+
+static void test_slack(void)
+{
+    expect_t first, second, third;
+    reset();
+
+    /* The first two windows overlap, so they share a timeout at the end of
+     * the first. The third opens after that and fires alone. */
+    assert(expect_timer(&first, 1000, 999) != 0);
+    assert(expect_timer(&second, 1990, 110) != 0);
+    assert(expect_timer(&third, 2050, 297950) != 0);
+
+    assert(run_timers() == 2);
+    assert_in_window(&first);
+    assert_in_window(&second);
+    assert_in_window(&third);
+    assert(first.fired_at == 1999 && second.fired_at == 1999);
+}
+
+/* A lock that checks it is never taken twice or released when not held */
+static int lock_depth;
+
+static void test_lock(void)
+{
+    assert(lock_depth == 0);
+    lock_depth++;
+}
+
+static void test_unlock(void)
+{
+    assert(lock_depth == 1);
+    lock_depth--;
+}
+
+typedef struct {
+    timer_callback_t callback;
+    uint32_t id;
+    void *data;
+} queued_t;
+
+static queued_t queued[CHAIN_LENGTH];
+static int n_queued;
+
+/* Queue a callback as a timer thread would, to run after timer_irq() */
+static void queue_callback(timer_callback_t callback, uint32_t id, void *data)
+{
+    assert(lock_depth == 0);
+    assert(n_queued < CHAIN_LENGTH);
+    queued[n_queued++] = (queued_t) { callback, id, data };
+}
+
+static void test_locking(void)
+{
+    /* Callbacks run without the lock, so they can register timers */
+    timer_set_lock(test_lock, test_unlock);
+    test_chaining();
+    assert(lock_depth == 0);
+
+    /* So does the dispatch function, and the callbacks it is handed */
+    expect_t first, second;
+    timer_set_dispatch(queue_callback);
+    reset();
+    n_queued = 0;
+    assert(expect_timer(&first, 100, 0) != 0);
+    assert(expect_timer(&second, 100, 0) != 0);
+    run_timers();
+    assert(n_queued == 2 && first.fired == 0 && second.fired == 0);
+    for (int i = 0; i < n_queued; i++) {
+        queued[i].callback(queued[i].id, queued[i].data);
+    }
+    assert(first.fired == 1 && second.fired == 1);
+    assert(lock_depth == 0);
+
+    timer_set_dispatch(NULL);
+    timer_set_lock(NULL, NULL);
+}
+
+static void test_random(void)
+{
+    static expect_t expect[RANDOM_TIMERS];
+    reset();
+    srand(1);
+
+    for (int i = 0; i < RANDOM_TIMERS; i++) {
+        uint64_t delay = rand() % 3 == 0 ? (uint64_t) rand() % 1000 : (uint64_t) rand() % (200 * US_IN_S);
+        uint64_t slack = rand() % 2 ? rand() % 1000 : 0;
+        assert(expect_timer(&expect[i], delay, slack) != 0);
+
+        /* Let time pass between some of the registrations */
+        if (rand() % 50 == 0) {
+            meson_sim_advance(&sim, rand() % 100);
+            seL4_Word irq;
+            while (meson_sim_next_irq(&sim, &irq)) {
+                assert(timer_irq(NULL, irq, 0) == CLOCK_R_OK);
+            }
+        }
+    }
+
+    run_timers();
+    for (int i = 0; i < RANDOM_TIMERS; i++) {
+        assert_in_window(&expect[i]);
+    }
+}
+
+int main(void)
+{
+    test_one_shot();
+    test_long_delay();
+    test_chaining();
+    test_slack();
+    test_locking();
+    test_random();
+    stop_timer();
+
+    printf("libclock host tests passed\n");
+    return 0;
+}
@@ -24,8 +24,16 @@
 #define CLOCK_R_CNCL (-2)       /* operation cancelled (driver stopped) */
 #define CLOCK_R_FAIL (-3)       /* operation failed for other reason */
 
+/*
+ * The timeout timer used by the driver. Its IRQ (see meson_timeout_irq())
+ * must be delivered to timer_irq().
+ */
+#define CLOCK_TIMEOUT_TIMER MESON_TIMER_A
+
 typedef uint64_t timestamp_t;
 typedef void (*timer_callback_t)(uint32_t id, void *data);
+typedef void (*timer_dispatch_t)(timer_callback_t callback, uint32_t id, void *data);
+typedef void (*timer_lock_t)(void);
 
 
 /*
@@ -39,27 +47,72 @@ int start_timer(unsigned char *timer_vaddr);
 
 /**
  * Get the current clock time in microseconds.
+ *
+ * With LibClockGenericCounter this is read from the ARM generic counter,
+ * calibrated against the Meson timestamp by start_timer(), and costs no
+ * device access. The Meson timer is then only used for timeout interrupts.
  */
 timestamp_t get_time(void);
 
+/**
+ * Get the current clock time in microseconds by reading the Meson
+ * timestamp registers, whichever source get_time() uses.
+ */
+timestamp_t get_time_mmio(void);
+
 /**
  * Register a callback to be called after a given delay
  *
+ * The callback is called at some point between delay and delay + slack
+ * microseconds from now. The timer interrupt is taken when the first
+ * window closes, and every timer whose window is open by then fires with
+ * it, so a non-zero slack saves timer interrupts.
+ *
  * @param delay     Delay time in microseconds before callback is invoked
+ * @param slack     Extra delay in microseconds the callback can tolerate
  * @param callback  Function to be called
  * @param data      Custom data to be passed to callback function
  * @return          0 on failure, otherwise an unique ID for this timeout
  */
-uint32_t register_timer(uint64_t delay, timer_callback_t callback, void *data);
+uint32_t register_timer(uint64_t delay, uint64_t slack, timer_callback_t callback, void *data);
 
 /**
- * Remove a previously registered callback by its ID
+ * Remove a previously registered callback by its ID, in constant time
  *
  * @param id  Unique ID returned by register_time
  * @return    CLOCK_R_OK iff successful.
  */
 int remove_timer(uint32_t id);
 
+/**
+ * Choose how the callbacks of expired timers are run.
+ *
+ * By default timer_irq() calls them directly. A dispatch function is
+ * instead handed each expired callback from timer_irq(), and can queue it
+ * to run elsewhere, keeping the IRQ handler short. Callbacks run on another
+ * thread that way may only call into the driver if a lock is set with
+ * timer_set_lock().
+ *
+ * @param dispatch  Function to pass expired callbacks to, NULL to call
+ *                  them directly
+ */
+void timer_set_dispatch(timer_dispatch_t dispatch);
+
+/**
+ * Set the lock that serialises threads using the driver.
+ *
+ * The lock is held while register_timer(), remove_timer(), timer_irq() and
+ * stop_timer() change the pending timers. It is released while a callback
+ * or the dispatch function runs, so either may register and remove timers,
+ * and a dispatch function may block. get_time() takes no lock.
+ *
+ * Must be called before timers are registered.
+ *
+ * @param lock    Function to take the lock, NULL for no locking
+ * @param unlock  Function to release it
+ */
+void timer_set_lock(timer_lock_t lock, timer_lock_t unlock);
+
 /*
  * Stop clock driver operation.
  *
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * A hierarchical timing wheel, holding timeouts keyed on an absolute time in
+ * microseconds.
+ *
+ * There are TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots each. A
+ * slot on level L covers TIMER_WHEEL_SLOTS^L microseconds, so level 0 is
+ * exact and each level above covers a range TIMER_WHEEL_SLOTS times
+ * longer. As time advances, the timers in a slot on a higher level are
+ * moved down ("cascaded") to the finer levels, until they reach level 0 and
+ * expire. Insertion and removal are O(1), and a bitmap per level lets
+ * advancing skip over empty slots.
+ *
+ * Each timer expires anywhere in a window [earliest, latest], and the
+ * wheel keeps two such indexes of the timers: one by the start of their
+ * windows and one by the end. Advancing expires every timer whose window
+ * has opened, while the next event is the earliest time a window closes.
+ * So all the timers whose windows are open when the first of them closes
+ * expire in the same advance.
+ *
+ * Timers are kept in a pool and are identified by an id made of their pool
+ * index and a generation count, so a stale id never removes a newer timer.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOT_BITS   6
+#define TIMER_WHEEL_SLOTS       (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS      6
+/* Timers are indexed by the start and by the end of their windows */
+#define TIMER_WHEEL_KEYS        2
+
+typedef void (*timer_wheel_callback_t)(uint32_t id, void *data);
+/* Runs the callback of an expired timer, see timer_wheel_t.dispatch */
+typedef void (*timer_wheel_dispatch_t)(timer_wheel_callback_t callback, uint32_t id, void *data);
+
+typedef struct timer_wheel_node timer_wheel_node_t;
+
+/* The timers ordered by one end of their windows */
+typedef struct {
+    /* Time up to which the index has been advanced */
+    uint64_t now;
+    /* First timer in each slot, and the slots that are non-empty */
+    uint32_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    /* Timers whose key had passed when they were added */
+    uint32_t due;
+} timer_wheel_index_t;
+
+typedef struct {
+    /* By the start of each timer's window, then by its end */
+    timer_wheel_index_t index[TIMER_WHEEL_KEYS];
+    /* Pool of timers, and the free timers in it */
+    timer_wheel_node_t *nodes;
+    uint32_t capacity;
+    uint32_t free;
+    /* Number of timers in the wheel */
+    uint32_t count;
+    /* If set, expired timers are passed to this rather than having their
+     * callback called directly */
+    timer_wheel_dispatch_t dispatch;
+} timer_wheel_t;
+
+/*
+ * Initialise an empty wheel.
+ *
+ * @param now  The current time.
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+/*
+ * Remove every timer and free the wheel's memory.
+ */
+void timer_wheel_destroy(timer_wheel_t *wheel);
+
+/*
+ * Add a timer that expires at some point in [earliest, latest]. A timer
+ * whose window has already opened expires on the next call to
+ * timer_wheel_advance().
+ *
+ * @return  an id for the timer, never 0, or 0 if out of memory.
+ */
+uint32_t timer_wheel_add(timer_wheel_t *wheel, uint64_t earliest, uint64_t latest,
+                         timer_wheel_callback_t callback, void *data);
+
+/*
+ * Remove a timer that has not expired yet.
+ *
+ * @return  true if the timer was removed, false if the id is not that of
+ *          a pending timer.
+ */
+bool timer_wheel_remove(timer_wheel_t *wheel, uint32_t id);
+
+/*
+ * Advance the wheel to a new time, calling the callback of every timer
+ * whose window opens at or before it. Callbacks may add and remove timers.
+ */
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now);
+
+/*
+ * Find the earliest end of any timer's window, which is when the wheel
+ * next needs to be advanced. Cascading happens as part of that advance, so it
+ * never needs a call of its own.
+ *
+ * This searches the first non-empty slot of each level above level 0, so
+ * it takes time in proportion to the timers in those slots.
+ *
+ * @return  false if the wheel is empty.
+ */
+bool timer_wheel_next_event(timer_wheel_t *wheel, uint64_t *time);
@@ -12,36 +12,212 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <clock/clock.h>
+#include <clock/gen_config.h>
+#include <clock/timer_wheel.h>
 
 /* The functions in src/device.h should help you interact with the timer
  * to set registers and configure timeouts. */
 #include "device.h"
 
+/* The timeout timer is programmed as a one-shot for the next event */
+#define TIMEOUT_OFF UINT64_MAX
+
+/* Generic counter ticks are converted to us as (ticks * mult) >> shift */
+#define COUNTER_US_SHIFT 32
+/* Number of attempts to sample the timestamp and counter together */
+#define CALIBRATE_SAMPLES 8
+
+/* Length of one tick of each timeout timebase, in us */
+static const uint64_t timebase_us[] = {
+    [TIMEOUT_TIMEBASE_1_US] = 1,
+    [TIMEOUT_TIMEBASE_10_US] = 10,
+    [TIMEOUT_TIMEBASE_100_US] = 100,
+    [TIMEOUT_TIMEBASE_1_MS] = 1000,
+};
+
 static struct {
     volatile meson_timer_reg_t *regs;
-    /* Add fields as you see necessary */
+    /* Pending timeouts, keyed on the 1us timestamp */
+    timer_wheel_t timers;
+    /* When the timeout timer will fire, or TIMEOUT_OFF */
+    uint64_t programmed;
+    /* Generic counter value and timestamp sampled together at start_timer() */
+    uint64_t counter_base;
+    uint64_t timestamp_base;
+    /* Multiplier converting generic counter ticks to us */
+    uint64_t counter_mult;
+    /* Where expired callbacks are sent, NULL to call them directly */
+    timer_dispatch_t dispatch;
+    /* Serialise the threads using the driver, see timer_set_lock() */
+    timer_lock_t lock;
+    timer_lock_t unlock;
 } clock;
 
+static void clock_lock(void)
+{
+    if (clock.lock != NULL) {
+        clock.lock();
+    }
+}
+
+static void clock_unlock(void)
+{
+    if (clock.unlock != NULL) {
+        clock.unlock();
+    }
+}
+
+/* Run or dispatch the callback of an expired timer. The wheel has already
+ * freed the timer and is consistent, so the lock is dropped meanwhile. */
+static void expire_timer(timer_callback_t callback, uint32_t id, void *data)
+{
+    clock_unlock();
+    if (clock.dispatch != NULL) {
+        clock.dispatch(callback, id, data);
+    } else {
+        callback(id, data);
+    }
+    clock_lock();
+}
+
+#ifdef CONFIG_LIB_CLOCK_GENERIC_COUNTER
+/*
+ * Sample the generic counter at the same instant as the Meson timestamp, so
+ * that get_time() can be served from the counter without any MMIO. Both are
+ * driven by the 24MHz crystal, so they do not drift apart once calibrated.
+ *
+ * The timestamp read is bracketed by two counter reads, and the midpoint of
+ * the tightest bracket is taken as the counter value at the read.
+ */
+static void calibrate_counter(void)
+{
+    uint64_t freq = timestamp_get_freq();
+    clock.counter_mult = ((unsigned __int128) US_IN_S << COUNTER_US_SHIFT) / freq;
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CALIBRATE_SAMPLES; i++) {
+        uint64_t before = timestamp_ticks();
+        uint64_t timestamp = read_timestamp(clock.regs);
+        uint64_t after = timestamp_ticks();
+        if (after - before < best) {
+            best = after - before;
+            clock.counter_base = before + (after - before) / 2;
+            clock.timestamp_base = timestamp;
+        }
+    }
+}
+
+static uint64_t counter_time(void)
+{
+    uint64_t ticks = timestamp_ticks() - clock.counter_base;
+    return clock.timestamp_base + (uint64_t)(((unsigned __int128) ticks * clock.counter_mult) >> COUNTER_US_SHIFT);
+}
+#endif /* CONFIG_LIB_CLOCK_GENERIC_COUNTER */
+
+/*
+ * Program the timeout timer to fire once, at the next time the timer wheel
+ * needs to be advanced. The timer only counts 16 bits, so the finest
+ * timebase that can reach the event is used, which keeps the rounding
+ * error under 1/6553 of the delay. Events further away than the coarsest
+ * timebase can reach are reached by chaining: the timer fires with
+ * nothing due and is programmed again.
+ */
+static void program_timeout(uint64_t now)
+{
+    uint64_t event;
+    if (!timer_wheel_next_event(&clock.timers, &event)) {
+        configure_timeout(clock.regs, CLOCK_TIMEOUT_TIMER, false, false, TIMEOUT_TIMEBASE_1_US, 0);
+        clock.programmed = TIMEOUT_OFF;
+        return;
+    }
+
+    uint64_t delay = event > now ? event - now : 0;
+    timeout_timebase_t timebase = TIMEOUT_TIMEBASE_1_US;
+    while (timebase < TIMEOUT_TIMEBASE_1_MS && delay > UINT16_MAX * timebase_us[timebase]) {
+        timebase++;
+    }
+
+    /* Round up, so the timer never fires before the event */
+    uint64_t ticks = DIV_ROUND_UP(delay, timebase_us[timebase]);
+    ticks = MAX(1, MIN(ticks, UINT16_MAX));
+
+    configure_timeout(clock.regs, CLOCK_TIMEOUT_TIMER, true, false, timebase, ticks);
+    clock.programmed = now + ticks * timebase_us[timebase];
+}
+
 int start_timer(unsigned char *timer_vaddr)
 {
-    int err = stop_timer();
-    if (err != 0) {
-        return err;
+    if (clock.regs != NULL) {
+        int err = stop_timer();
+        if (err != 0) {
+            return err;
+        }
     }
 
     clock.regs = (meson_timer_reg_t *)(timer_vaddr + TIMER_REG_START);
+    configure_timestamp(clock.regs, TIMESTAMP_TIMEBASE_1_US);
+#ifdef CONFIG_LIB_CLOCK_GENERIC_COUNTER
+    calibrate_counter();
+#endif
+    timer_wheel_init(&clock.timers, get_time());
+    clock.timers.dispatch = expire_timer;
+
+    /* There is nothing to time out yet, so the timer stays off */
+    clock.programmed = TIMEOUT_OFF;
 
     return CLOCK_R_OK;
 }
 
-uint32_t register_timer(uint64_t delay, timer_callback_t callback, void *data)
+timestamp_t get_time(void)
+{
+    if (clock.regs == NULL) {
+        return 0;
+    }
+#ifdef CONFIG_LIB_CLOCK_GENERIC_COUNTER
+    return counter_time();
+#else
+    return read_timestamp(clock.regs);
+#endif
+}
+
+timestamp_t get_time_mmio(void)
 {
-    return 0;
+    if (clock.regs == NULL) {
+        return 0;
+    }
+    return read_timestamp(clock.regs);
+}
+
+uint32_t register_timer(uint64_t delay, uint64_t slack, timer_callback_t callback, void *data)
+{
+    if (clock.regs == NULL || callback == NULL) {
+        return 0;
+    }
+
+    clock_lock();
+    uint64_t now = get_time();
+    uint64_t latest = now + delay + slack;
+    uint32_t id = timer_wheel_add(&clock.timers, now + delay, latest, callback, data);
+
+    /* Bring the timeout forward if this is now the next event */
+    if (id != 0 && latest < clock.programmed) {
+        program_timeout(now);
+    }
+    clock_unlock();
+    return id;
 }
 
 int remove_timer(uint32_t id)
 {
-    return CLOCK_R_FAIL;
+    if (clock.regs == NULL) {
+        return CLOCK_R_UINT;
+    }
+    /* The timeout is left as it is. If nothing is due when it fires, it
+     * is just programmed again. */
+    clock_lock();
+    bool removed = timer_wheel_remove(&clock.timers, id);
+    clock_unlock();
+    return removed ? CLOCK_R_OK : CLOCK_R_FAIL;
 }
 
 int timer_irq(
@@ -50,15 +226,47 @@ int timer_irq(
     seL4_IRQHandler irq_handler
 )
 {
+    if (clock.regs == NULL) {
+        return CLOCK_R_UINT;
+    }
+
     /* Handle the IRQ */
+    clock_lock();
+    clock.programmed = TIMEOUT_OFF;
+    timer_wheel_advance(&clock.timers, get_time());
+    program_timeout(get_time());
+    clock_unlock();
 
     /* Acknowledge that the IRQ has been handled */
-    return CLOCK_R_FAIL;
+    seL4_IRQHandler_Ack(irq_handler);
+    return CLOCK_R_OK;
+}
+
+void timer_set_dispatch(timer_dispatch_t dispatch)
+{
+    clock.dispatch = dispatch;
+}
+
+void timer_set_lock(timer_lock_t lock, timer_lock_t unlock)
+{
+    clock.lock = lock;
+    clock.unlock = unlock;
 }
 
 int stop_timer(void)
 {
+    if (clock.regs == NULL) {
+        return CLOCK_R_UINT;
+    }
+
     /* Stop the timer from producing further interrupts and remove all
      * existing timeouts */
-    return CLOCK_R_FAIL;
+    clock_lock();
+    for (timeout_id_t timer = MESON_TIMER_A; timer <= MESON_TIMER_D; timer++) {
+        configure_timeout(clock.regs, timer, false, false, TIMEOUT_TIMEBASE_1_US, 0);
+    }
+    timer_wheel_destroy(&clock.timers);
+    clock.programmed = TIMEOUT_OFF;
+    clock_unlock();
+    return CLOCK_R_OK;
 }
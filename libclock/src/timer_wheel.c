@@ -0,0 +1,379 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <clock/timer_wheel.h>
+#include <utils/util.h>
+
+#define NIL                 UINT32_MAX
+
+/* Timer ids hold the pool index (plus one, so 0 is never an id) in the
+ * low bits and the generation of the pool entry in the high bits */
+#define ID_INDEX_BITS       20
+#define ID_GENERATION_BITS  (32 - ID_INDEX_BITS)
+#define MAX_TIMERS          (BIT(ID_INDEX_BITS) - 1)
+#define INITIAL_CAPACITY    64
+
+/* The keys timers are indexed by, see timer_wheel_t */
+#define KEY_EARLIEST        0
+#define KEY_LATEST          1
+
+/* Which list of an index a timer is in: a slot (level * TIMER_WHEEL_SLOTS
+ * + slot), the due list or the free list */
+#define LIST_SLOT(level, slot)  ((level) * TIMER_WHEEL_SLOTS + (slot))
+#define LIST_DUE                0xfffe
+#define LIST_FREE               0xffff
+
+/* Number of microseconds covered by one slot on a level, and by a level */
+#define SLOT_SHIFT(level)   ((level) * TIMER_WHEEL_SLOT_BITS)
+#define WHEEL_RANGE         (1ull << SLOT_SHIFT(TIMER_WHEEL_LEVELS))
+
+/* A timer's place in one index */
+typedef struct {
+    uint32_t prev;
+    uint32_t next;
+    uint16_t list;
+} node_link_t;
+
+struct timer_wheel_node {
+    /* Start and end of the window the timer expires in, by key */
+    uint64_t key[TIMER_WHEEL_KEYS];
+    timer_wheel_callback_t callback;
+    void *data;
+    node_link_t link[TIMER_WHEEL_KEYS];
+    uint16_t generation;
+};
+
+static inline uint32_t node_id(timer_wheel_t *wheel, uint32_t index)
+{
+    return ((uint32_t) wheel->nodes[index].generation << ID_INDEX_BITS) | (index + 1);
+}
+
+static uint32_t *list_head(timer_wheel_index_t *idx, uint16_t list)
+{
+    if (list == LIST_DUE) {
+        return &idx->due;
+    }
+    assert(list < LIST_SLOT(TIMER_WHEEL_LEVELS, 0));
+    return &idx->slots[list / TIMER_WHEEL_SLOTS][list % TIMER_WHEEL_SLOTS];
+}
+
+static void link_node(timer_wheel_t *wheel, int key, uint32_t index, uint16_t list)
+{
+    timer_wheel_index_t *idx = &wheel->index[key];
+    node_link_t *link = &wheel->nodes[index].link[key];
+    uint32_t *head = list_head(idx, list);
+
+    link->list = list;
+    link->prev = NIL;
+    link->next = *head;
+    if (*head != NIL) {
+        wheel->nodes[*head].link[key].prev = index;
+    }
+    *head = index;
+
+    if (list != LIST_DUE) {
+        idx->occupied[list / TIMER_WHEEL_SLOTS] |= BIT(list % TIMER_WHEEL_SLOTS);
+    }
+}
+
+static void unlink_node(timer_wheel_t *wheel, int key, uint32_t index)
+{
+    timer_wheel_index_t *idx = &wheel->index[key];
+    node_link_t *link = &wheel->nodes[index].link[key];
+    uint32_t *head = list_head(idx, link->list);
+
+    if (link->prev != NIL) {
+        wheel->nodes[link->prev].link[key].next = link->next;
+    } else {
+        *head = link->next;
+    }
+    if (link->next != NIL) {
+        wheel->nodes[link->next].link[key].prev = link->prev;
+    }
+
+    if (*head == NIL && link->list != LIST_DUE) {
+        idx->occupied[link->list / TIMER_WHEEL_SLOTS] &= ~BIT(link->list % TIMER_WHEEL_SLOTS);
+    }
+    link->prev = NIL;
+    link->next = NIL;
+}
+
+/* Put a timer in the list of an index for its key, relative to the time
+ * the index has been advanced to */
+static void place_node(timer_wheel_t *wheel, int key, uint32_t index)
+{
+    timer_wheel_index_t *idx = &wheel->index[key];
+    uint64_t time = wheel->nodes[index].key[key];
+    if (time <= idx->now) {
+        link_node(wheel, key, index, LIST_DUE);
+        return;
+    }
+
+    uint64_t delta = time - idx->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1ull << SLOT_SHIFT(level + 1)) {
+        level++;
+    }
+
+    /* Timers beyond the range of the top level wait in its furthest slot,
+     * and are placed again when that slot is cascaded */
+    time = MIN(time, idx->now + WHEEL_RANGE - 1);
+    uint32_t slot = (time >> SLOT_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+    link_node(wheel, key, index, LIST_SLOT(level, slot));
+}
+
+static bool grow_pool(timer_wheel_t *wheel)
+{
+    if (wheel->capacity == MAX_TIMERS) {
+        return false;
+    }
+
+    uint32_t capacity = wheel->capacity == 0 ? INITIAL_CAPACITY : MIN(wheel->capacity * 2, MAX_TIMERS);
+    timer_wheel_node_t *nodes = realloc(wheel->nodes, capacity * sizeof(*nodes));
+    if (nodes == NULL) {
+        return false;
+    }
+
+    /* Add the new entries to the free list in order. It is linked through
+     * the first index's links. */
+    for (uint32_t i = capacity; i > wheel->capacity; i--) {
+        timer_wheel_node_t *node = &nodes[i - 1];
+        *node = (timer_wheel_node_t) { 0 };
+        for (int key = 0; key < TIMER_WHEEL_KEYS; key++) {
+            node->link[key] = (node_link_t) {
+                .prev = NIL,
+                .next = NIL,
+                .list = LIST_FREE,
+            };
+        }
+        node->link[0].next = wheel->free;
+        wheel->free = i - 1;
+    }
+    wheel->nodes = nodes;
+    wheel->capacity = capacity;
+    return true;
+}
+
+/* Take a timer out of both indexes and return it to the pool */
+static void free_node(timer_wheel_t *wheel, uint32_t index)
+{
+    timer_wheel_node_t *node = &wheel->nodes[index];
+    for (int key = 0; key < TIMER_WHEEL_KEYS; key++) {
+        unlink_node(wheel, key, index);
+        node->link[key].list = LIST_FREE;
+    }
+    node->generation = (node->generation + 1) & MASK(ID_GENERATION_BITS);
+    node->callback = NULL;
+    node->data = NULL;
+    node->link[0].next = wheel->free;
+    wheel->free = index;
+    wheel->count--;
+}
+
+/* Expire every timer in a list of an index */
+static void fire_list(timer_wheel_t *wheel, int key, uint16_t list)
+{
+    uint32_t *head = list_head(&wheel->index[key], list);
+    while (*head != NIL) {
+        uint32_t index = *head;
+        timer_wheel_node_t *node = &wheel->nodes[index];
+        timer_wheel_callback_t callback = node->callback;
+        void *data = node->data;
+        uint32_t id = node_id(wheel, index);
+
+        /* Free the timer first, so the callback can add new ones */
+        free_node(wheel, index);
+        if (wheel->dispatch != NULL) {
+            wheel->dispatch(callback, id, data);
+        } else {
+            callback(id, data);
+        }
+    }
+}
+
+/* Move the timers in a slot of an index down to the levels below */
+static void cascade(timer_wheel_t *wheel, int key, int level, uint32_t slot)
+{
+    timer_wheel_index_t *idx = &wheel->index[key];
+    uint32_t index = idx->slots[level][slot];
+    idx->slots[level][slot] = NIL;
+    idx->occupied[level] &= ~BIT(slot);
+
+    while (index != NIL) {
+        uint32_t next = wheel->nodes[index].link[key].next;
+        place_node(wheel, key, index);
+        index = next;
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    *wheel = (timer_wheel_t) {
+        .free = NIL,
+    };
+    for (int key = 0; key < TIMER_WHEEL_KEYS; key++) {
+        timer_wheel_index_t *idx = &wheel->index[key];
+        idx->now = now;
+        idx->due = NIL;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+                idx->slots[level][slot] = NIL;
+            }
+        }
+    }
+}
+
+void timer_wheel_destroy(timer_wheel_t *wheel)
+{
+    free(wheel->nodes);
+    timer_wheel_init(wheel, wheel->index[KEY_EARLIEST].now);
+}
+
+uint32_t timer_wheel_add(timer_wheel_t *wheel, uint64_t earliest, uint64_t latest,
+                         timer_wheel_callback_t callback, void *data)
+{
+    if (wheel->free == NIL && !grow_pool(wheel)) {
+        return 0;
+    }
+
+    uint32_t index = wheel->free;
+    timer_wheel_node_t *node = &wheel->nodes[index];
+    wheel->free = node->link[0].next;
+    wheel->count++;
+
+    node->key[KEY_EARLIEST] = earliest;
+    node->key[KEY_LATEST] = MAX(earliest, latest);
+    node->callback = callback;
+    node->data = data;
+    for (int key = 0; key < TIMER_WHEEL_KEYS; key++) {
+        place_node(wheel, key, index);
+    }
+
+    return node_id(wheel, index);
+}
+
+bool timer_wheel_remove(timer_wheel_t *wheel, uint32_t id)
+{
+    uint32_t index = (id & MASK(ID_INDEX_BITS)) - 1;
+    if (id == 0 || index >= wheel->capacity) {
+        return false;
+    }
+
+    timer_wheel_node_t *node = &wheel->nodes[index];
+    if (node->link[0].list == LIST_FREE || node->generation != id >> ID_INDEX_BITS) {
+        return false;
+    }
+
+    free_node(wheel, index);
+    return true;
+}
+
+/* Find the first non-empty slot on a level of an index, in the order the
+ * slots come up, and the time it starts */
+static uint32_t first_slot(timer_wheel_index_t *idx, int level, uint64_t *start)
+{
+    /* Slots after the current one come first. The current slot itself
+     * holds timers for the next rotation of the wheel. */
+    uint64_t occupied = idx->occupied[level];
+    uint64_t block = idx->now >> SLOT_SHIFT(level);
+    uint32_t next = (block + 1) & (TIMER_WHEEL_SLOTS - 1);
+    uint64_t rotated = next == 0 ? occupied : (occupied >> next) | (occupied << (64 - next));
+    uint32_t skip = CTZL(rotated);
+
+    *start = (block + 1 + skip) << SLOT_SHIFT(level);
+    return (next + skip) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+/* Find the earliest time a non-empty slot of an index needs to be
+ * cascaded or fired */
+static bool next_slot_start(timer_wheel_index_t *idx, uint64_t *time)
+{
+    bool found = false;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t start;
+        if (idx->occupied[level] != 0) {
+            first_slot(idx, level, &start);
+            if (!found || start < *time) {
+                *time = start;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool timer_wheel_next_event(timer_wheel_t *wheel, uint64_t *time)
+{
+    timer_wheel_index_t *idx = &wheel->index[KEY_LATEST];
+    if (idx->due != NIL) {
+        *time = idx->now;
+        return true;
+    }
+
+    /* The earliest timer on each level is in its first non-empty slot. On
+     * level 0 every timer in a slot has the same key; above it, the slot's
+     * timers are searched. */
+    bool found = false;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (idx->occupied[level] == 0) {
+            continue;
+        }
+        uint64_t start;
+        uint32_t index = idx->slots[level][first_slot(idx, level, &start)];
+        do {
+            uint64_t latest = wheel->nodes[index].key[KEY_LATEST];
+            if (!found || latest < *time) {
+                *time = latest;
+                found = true;
+            }
+            index = level == 0 ? NIL : wheel->nodes[index].link[KEY_LATEST].next;
+        } while (index != NIL);
+    }
+    return found;
+}
+
+/* Advance one index to a new time, expiring the timers whose key it passes */
+static void advance_index(timer_wheel_t *wheel, int key, uint64_t now)
+{
+    timer_wheel_index_t *idx = &wheel->index[key];
+    uint64_t event;
+
+    fire_list(wheel, key, LIST_DUE);
+    while (next_slot_start(idx, &event) && event <= now) {
+        idx->now = event;
+
+        /* Cascade every level whose slot starts now, from the top down */
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((idx->now & MASK(SLOT_SHIFT(level))) == 0) {
+                uint32_t slot = (idx->now >> SLOT_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+                if (idx->occupied[level] & BIT(slot)) {
+                    cascade(wheel, key, level, slot);
+                }
+            }
+        }
+
+        fire_list(wheel, key, LIST_SLOT(0, idx->now & (TIMER_WHEEL_SLOTS - 1)));
+        fire_list(wheel, key, LIST_DUE);
+    }
+
+    idx->now = MAX(idx->now, now);
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now)
+{
+    /* Every timer whose window closes by now has also opened by now, so
+     * advancing by the end of the windows only keeps that index in step */
+    advance_index(wheel, KEY_EARLIEST, now);
+    advance_index(wheel, KEY_LATEST, now);
+}
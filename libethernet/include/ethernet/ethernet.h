@@ -13,6 +13,7 @@
 
 #include <autoconf.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -56,8 +57,42 @@ typedef struct {
     uintptr_t (*dma_phys_to_virt)(uintptr_t phys);
     uint32_t (*flush_dcache_range)(uintptr_t addr, size_t size);
     uint32_t (*invalidate_dcache_range)(uintptr_t addr, size_t size);
+    /* Optional, may be NULL. Queue a flush_dcache_range() to be done by the
+     * next flush_queued(), so that ranges queued together can be merged.
+     * Without these, every flush is done at once. */
+    uint32_t (*queue_flush_dcache_range)(uintptr_t addr, size_t size);
+    uint32_t (*flush_queued)(void);
 } ethif_dma_ops_t;
 
+/*
+ * Depths of the transmit and receive descriptor rings
+ */
+typedef struct {
+    uint32_t tx_descriptors;
+    uint32_t rx_descriptors;
+    /* Receive buffers beyond one per descriptor, which can be lent out by
+     * ethif_set_recv_lend_callback() */
+    uint32_t rx_spare_buffers;
+} ethif_ring_config_t;
+
+/*
+ * Counts of received frames, and of frames dropped because the receive ring
+ * was full. Counts only increase.
+ */
+typedef struct {
+    /* Frames passed to either receive callback */
+    uint64_t rx_frames;
+    /* Frames copied to the recv_callback because no spare buffer was free to
+     * lend in their place */
+    uint64_t rx_copied;
+    /* Frames the MAC dropped because the DMA had no free receive descriptor */
+    uint64_t rx_missed;
+    /* Frames the MAC dropped because its receive FIFO overflowed */
+    uint64_t rx_fifo_overflows;
+    /* Interrupts at which the DMA had found no free receive descriptor */
+    uint64_t rx_unavailable;
+} ethif_stats_t;
+
 /**
  * Called by ethernet driver when a frame is received (inside an ethif_recv())
  * This function must be defined by code which uses this driver, and passed into ethif_init.
@@ -69,6 +104,37 @@ typedef struct {
  */
 typedef void (*ethif_recv_callback_t)(uint8_t *in_packet, int len);
 
+/**
+ * Receive frames without copying them.
+ *
+ * While there are spare receive buffers, ethif_recv() passes each frame to
+ * lend_callback in the DMA buffer it was received into, and gives the
+ * receive descriptor a spare buffer in its place. The frame's buffer then
+ * belongs to the callee until it is handed back with
+ * ethif_rx_buffer_return(). When no spare buffer is left, frames go to the
+ * recv_callback given to ethif_init() as before, and must be copied.
+ *
+ * @param lend_callback  Called with each lent frame, or NULL to always copy.
+ */
+void ethif_set_recv_lend_callback(ethif_recv_callback_t lend_callback);
+
+/**
+ * Return a buffer lent by the driver, so it can receive another frame.
+ * Buffers that are not currently lent out are ignored.
+ *
+ * @param buffer  in_packet as passed to the lend callback
+ */
+void ethif_rx_buffer_return(uint8_t *buffer);
+
+/**
+ * Set the depths of the descriptor rings. Must be called before ethif_init(),
+ * which allocates the rings and a buffer for each descriptor. Deeper receive
+ * rings absorb longer bursts before the MAC has to drop frames.
+ *
+ * @param rings  ring depths. Both rings need at least one descriptor.
+ */
+void ethif_set_ring_config(const ethif_ring_config_t *rings);
+
 /**
  * Initialise the ethernet interface.
  *
@@ -93,6 +159,35 @@ ethif_err_t ethif_init(uint64_t base_addr, uint8_t mac_out[6], ethif_dma_ops_t *
  */
 ethif_err_t ethif_send(uint8_t *buf, uint32_t len);
 
+/**
+ * Copy a frame into the next transmit descriptor, without starting it.
+ *
+ * Queued frames are sent by the next ethif_send_flush() (or ethif_send(),
+ * which flushes). Starting many frames at once means cleaning their buffers
+ * and descriptors as one range each, and a single poll demand to the DMA.
+ *
+ * @param buf   buffer containing frame contents to send
+ * @param len   length of buffer to send
+ * @return ETHIF_ERROR if there is no free transmit descriptor
+ */
+ethif_err_t ethif_send_queue(uint8_t *buf, uint32_t len);
+
+/**
+ * Start transmitting every queued frame.
+ */
+void ethif_send_flush(void);
+
+/**
+ * Queue a batch of frames and start them all together.
+ *
+ * @param bufs   buffers containing the contents of each frame
+ * @param lens   length of each frame
+ * @param count  number of frames
+ * @return the number of frames sent. Sending stops at the first frame for
+ *         which there is no free transmit descriptor.
+ */
+uint32_t ethif_send_batch(uint8_t *const bufs[], const uint32_t lens[], uint32_t count);
+
 /**
  * Poll the receive buffers for a packet.
  *
@@ -106,4 +201,47 @@ ethif_err_t ethif_send(uint8_t *buf, uint32_t len);
  */
 ethif_err_t ethif_recv(int *len);
 
+/**
+ * Hand the receive descriptors freed by ethif_recv() since the last call
+ * back to the DMA, and write back any buffers returned with
+ * ethif_rx_buffer_return().
+ *
+ * With the queue_flush_dcache_range() DMA op, freed descriptors only
+ * reach the DMA once this is called, so call it after each run of
+ * ethif_recv() calls.
+ */
+void ethif_recv_flush(void);
+
+/**
+ * Acknowledge an interrupt from the MAC.
+ */
 void ethif_irq(void);
+
+/**
+ * Mask or unmask receive interrupts, so frames can be polled for with
+ * ethif_recv() while the interrupt is off.
+ */
+void ethif_rx_irq_enable(bool enable);
+
+/**
+ * @return true if a received frame is waiting for ethif_recv().
+ */
+bool ethif_rx_pending(void);
+
+/**
+ * Coalesce receive interrupts with the MAC's RX interrupt watchdog timer.
+ * Rather than interrupting for every frame, the MAC interrupts once the
+ * timer expires after a frame arrives.
+ *
+ * @param riwt  timeout in units of 256 system clock cycles, up to 255.
+ *              0 interrupts for every frame.
+ */
+void ethif_rx_coalesce(uint32_t riwt);
+
+/**
+ * Read the receive counters, so that ring depths can be tuned against the
+ * rate at which frames are dropped.
+ *
+ * @param stats  filled in with the counts since ethif_init()
+ */
+void ethif_get_stats(ethif_stats_t *stats);
@@ -26,6 +26,11 @@ static struct eth_device uboot_eth_dev;
 
 ethif_dma_ops_t dma_ops = {NULL};
 ethif_recv_callback_t ethif_recv_callback = NULL;
+ethif_recv_callback_t ethif_recv_lend_callback = NULL;
+
+/* Ring depths from ethif_set_ring_config(), NULL for the driver's defaults */
+static ethif_ring_config_t ring_config_store;
+static ethif_ring_config_t *ring_config = NULL;
 
 ethif_err_t ethif_send(uint8_t *buf, uint32_t len)
 {
@@ -33,6 +38,27 @@ ethif_err_t ethif_send(uint8_t *buf, uint32_t len)
     return (uboot_eth_dev.send(&uboot_eth_dev, buf, len) == 0) ? ETHIF_NOERROR : ETHIF_ERROR;
 }
 
+ethif_err_t ethif_send_queue(uint8_t *buf, uint32_t len)
+{
+    assert(buf);
+    return (designware_send_queue(&uboot_eth_dev, buf, len) == 0) ? ETHIF_NOERROR : ETHIF_ERROR;
+}
+
+void ethif_send_flush(void)
+{
+    designware_send_kick(&uboot_eth_dev);
+}
+
+uint32_t ethif_send_batch(uint8_t *const bufs[], const uint32_t lens[], uint32_t count)
+{
+    uint32_t sent = 0;
+    while (sent < count && ethif_send_queue(bufs[sent], lens[sent]) == ETHIF_NOERROR) {
+        sent++;
+    }
+    ethif_send_flush();
+    return sent;
+}
+
 ethif_err_t ethif_recv(int *len)
 {
     assert(len);
@@ -44,11 +70,36 @@ ethif_err_t ethif_recv(int *len)
     return ETHIF_ERROR;
 }
 
+void ethif_recv_flush(void)
+{
+    designware_recv_flush(&uboot_eth_dev);
+}
+
 void uboot_process_received_packet(uint8_t *in_packet, int len)
 {
     ethif_recv_callback(in_packet, len);
 }
 
+bool uboot_rx_lending_enabled(void)
+{
+    return ethif_recv_lend_callback != NULL;
+}
+
+void uboot_process_lent_packet(uint8_t *in_packet, int len)
+{
+    ethif_recv_lend_callback(in_packet, len);
+}
+
+void ethif_set_recv_lend_callback(ethif_recv_callback_t lend_callback)
+{
+    ethif_recv_lend_callback = lend_callback;
+}
+
+void ethif_rx_buffer_return(uint8_t *buffer)
+{
+    designware_rx_buffer_return(&uboot_eth_dev, buffer);
+}
+
 ethif_dma_ops_t *uboot_get_dma_ops()
 {
     return &dma_ops;
@@ -60,6 +111,34 @@ void ethif_irq(void)
     designware_ack(&uboot_eth_dev);
 }
 
+void ethif_rx_irq_enable(bool enable)
+{
+    designware_rx_irq_enable(&uboot_eth_dev, enable);
+}
+
+bool ethif_rx_pending(void)
+{
+    return designware_rx_pending(&uboot_eth_dev);
+}
+
+void ethif_rx_coalesce(uint32_t riwt)
+{
+    designware_rx_coalesce(&uboot_eth_dev, riwt);
+}
+
+void ethif_get_stats(ethif_stats_t *stats)
+{
+    assert(stats);
+    designware_get_stats(&uboot_eth_dev, stats);
+}
+
+void ethif_set_ring_config(const ethif_ring_config_t *rings)
+{
+    assert(rings);
+    ring_config_store = *rings;
+    ring_config = &ring_config_store;
+}
+
 ethif_err_t ethif_init(uint64_t base_addr, uint8_t mac_out[6], ethif_dma_ops_t *ops,
                        ethif_recv_callback_t recv_callback)
 {
@@ -83,7 +162,7 @@ ethif_err_t ethif_init(uint64_t base_addr, uint8_t mac_out[6], ethif_dma_ops_t *
     phy_init();
 
     /* Populate the eth_dev functions, also does some more PHY init */
-    int ret = designware_initialize(base_addr, 0, &uboot_eth_dev);
+    int ret = designware_initialize(base_addr, 0, &uboot_eth_dev, ring_config);
 
     if (ret != 0) {
         ZF_LOGE("Failed: designware_initialize.");
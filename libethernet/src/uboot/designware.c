@@ -172,7 +172,7 @@ static void tx_descs_init(struct dw_eth_dev *priv)
 	struct dmamacdescr *desc_p;
 	u32 idx;
 
-	for (idx = 0; idx < CONFIG_TX_DESCR_NUM; idx++) {
+	for (idx = 0; idx < priv->tx_descr_num; idx++) {
 		desc_p = &desc_table_vptr[idx];
 		desc_p->dmamac_addr = (ulong)&txbuffs_pptr[idx * CONFIG_ETH_BUFSIZE];
 		desc_p->dmamac_next = (ulong)&desc_table_pptr[idx + 1];
@@ -222,7 +222,7 @@ static void rx_descs_init(struct dw_eth_dev *priv)
 	 * GMAC data will be corrupted. */
 	uboot_flush_dcache_range((ulong)priv->rxbuffs.vaddr, (ulong)priv->rxbuffs.vaddr + (ulong)priv->rxbuffs.size);
 
-	for (idx = 0; idx < CONFIG_RX_DESCR_NUM; idx++) {
+	for (idx = 0; idx < priv->rx_descr_num; idx++) {
 		desc_p = &desc_table_vptr[idx];
 		desc_p->dmamac_addr = (ulong)&rxbuffs_pptr[idx * CONFIG_ETH_BUFSIZE];
 		desc_p->dmamac_next = (ulong)&desc_table_pptr[idx + 1];
@@ -244,6 +244,7 @@ static void rx_descs_init(struct dw_eth_dev *priv)
 
 	writel((ulong)&desc_table_pptr[0], &dma_p->rxdesclistaddr);
 	priv->rx_currdescnum = 0;
+	priv->rx_nqueued = 0;
 }
 
 static int _dw_write_hwaddr(struct dw_eth_dev *priv, u8 *mac_id)
@@ -396,16 +397,23 @@ int designware_eth_enable(struct dw_eth_dev *priv)
 
 #define ETH_ZLEN	60
 
-static int _dw_eth_send(struct dw_eth_dev *priv, void *packet, int length)
+/*
+ * Write a frame into the next TX descriptor, without handing it to the DMA.
+ * Frames queued this way are started together by _dw_eth_kick().
+ */
+static int _dw_eth_queue(struct dw_eth_dev *priv, void *packet, int length)
 {
-	struct eth_dma_regs *dma_p = priv->dma_regs_p;
 	u32 desc_num = priv->tx_currdescnum;
 	struct dmamacdescr *desc_vptr = &((struct dmamacdescr*)priv->tx_mac_descrtable.vaddr)[desc_num];
 	ulong desc_vstart = (ulong)desc_vptr;
 	ulong desc_vend = desc_vstart +
 		roundup(sizeof(*desc_vptr), ARCH_DMA_MINALIGN);
 	ulong data_vstart = uboot_dma_phys_to_virt(desc_vptr->dmamac_addr);
-	ulong data_vend = data_vstart + roundup(length, ARCH_DMA_MINALIGN);
+
+	/* Every descriptor already holds a queued frame */
+	if (priv->tx_npending == priv->tx_descr_num)
+		return -ENOSPC;
+
 	/*
 	 * Strictly we only need to invalidate the "txrx_status" field
 	 * for the following check, but on some platforms we cannot
@@ -417,25 +425,19 @@ static int _dw_eth_send(struct dw_eth_dev *priv, void *packet, int length)
 	uboot_invalidate_dcache_range(desc_vstart, desc_vend);
 
 	/* Check if the descriptor is owned by CPU */
-	if (desc_vptr->txrx_status & DESC_TXSTS_OWNBYDMA) {
-		printf("CPU not owner of tx frame\n");
+	if (desc_vptr->txrx_status & DESC_TXSTS_OWNBYDMA)
 		return -EPERM;
-	}
 
 	length = max(length, ETH_ZLEN);
 
 	memcpy((void *)data_vstart, packet, length);
 
-	/* Flush data to be sent */
-	uboot_flush_dcache_range(data_vstart, data_vend);
-
 #if defined(CONFIG_DW_ALTDESCRIPTOR)
 	desc_vptr->txrx_status |= DESC_TXSTS_TXFIRST | DESC_TXSTS_TXLAST;
 	desc_vptr->dmamac_cntl |= (length << DESC_TXCTRL_SIZE1SHFT) &
 			       DESC_TXCTRL_SIZE1MASK;
 
 	desc_vptr->txrx_status &= ~(DESC_TXSTS_MSK);
-	desc_vptr->txrx_status |= DESC_TXSTS_OWNBYDMA;
 #else
 	/* Reset the descriptor size mask. Not sure what the intention of the old behaviour was... */
 	desc_vptr->dmamac_cntl &= ~DESC_TXCTRL_SIZE1MASK;
@@ -443,18 +445,67 @@ static int _dw_eth_send(struct dw_eth_dev *priv, void *packet, int length)
 	desc_vptr->dmamac_cntl |= ((length << DESC_TXCTRL_SIZE1SHFT) & DESC_TXCTRL_SIZE1MASK
 			       ) | DESC_TXCTRL_TXLAST |
 			       DESC_TXCTRL_TXFIRST;
-
-	desc_vptr->txrx_status = DESC_TXSTS_OWNBYDMA;
 #endif
 
-	/* Flush modified buffer descriptor */
-	uboot_flush_dcache_range(desc_vstart, desc_vend);
-
 	/* Test the wrap-around condition. */
-	if (++desc_num >= CONFIG_TX_DESCR_NUM)
+	if (++desc_num >= priv->tx_descr_num)
 		desc_num = 0;
 
 	priv->tx_currdescnum = desc_num;
+	priv->tx_npending++;
+
+	return 0;
+}
+
+/*
+ * Queue a flush of count consecutive elements of a ring, starting at first.
+ * This is one range, or two if the elements wrap around the end.
+ */
+static void flush_ring(ulong base, ulong elem_size, u32 ring_size, u32 first, u32 count)
+{
+	u32 end = MIN(first + count, ring_size);
+
+	uboot_queue_flush_dcache_range(base + first * elem_size, base + end * elem_size);
+	if (first + count > ring_size)
+		uboot_queue_flush_dcache_range(base, base + (first + count - ring_size) * elem_size);
+}
+
+/*
+ * Hand every queued frame to the DMA and start transmitting them. The
+ * buffers and the descriptors are each cleaned as a single batch, which
+ * costs far fewer cache maintenance calls than one per frame. The buffers
+ * must reach memory before any descriptor does, so they are not batched
+ * together.
+ */
+static int _dw_eth_kick(struct dw_eth_dev *priv)
+{
+	struct eth_dma_regs *dma_p = priv->dma_regs_p;
+	struct dmamacdescr *desc_table = (struct dmamacdescr*)priv->tx_mac_descrtable.vaddr;
+	u32 count = priv->tx_npending;
+	u32 first = (priv->tx_currdescnum + priv->tx_descr_num - count) % priv->tx_descr_num;
+	u32 idx;
+
+	if (count == 0)
+		return 0;
+
+	/* Flush data to be sent */
+	flush_ring(priv->txbuffs.vaddr, CONFIG_ETH_BUFSIZE, priv->tx_descr_num, first, count);
+	uboot_flush_queued();
+
+	/* Only now can the DMA be given the descriptors */
+	for (idx = 0; idx < count; idx++) {
+#if defined(CONFIG_DW_ALTDESCRIPTOR)
+		desc_table[(first + idx) % priv->tx_descr_num].txrx_status |= DESC_TXSTS_OWNBYDMA;
+#else
+		desc_table[(first + idx) % priv->tx_descr_num].txrx_status = DESC_TXSTS_OWNBYDMA;
+#endif
+	}
+
+	/* Flush modified buffer descriptors */
+	flush_ring((ulong)desc_table, sizeof(*desc_table), priv->tx_descr_num, first, count);
+	uboot_flush_queued();
+
+	priv->tx_npending = 0;
 
 	/* Start the transmission */
 	writel(POLL_DATA, &dma_p->txpolldemand);
@@ -462,6 +513,19 @@ static int _dw_eth_send(struct dw_eth_dev *priv, void *packet, int length)
 	return 0;
 }
 
+static int _dw_eth_send(struct dw_eth_dev *priv, void *packet, int length)
+{
+	int ret = _dw_eth_queue(priv, packet, length);
+
+	if (ret == -EPERM)
+		printf("CPU not owner of tx frame\n");
+
+	/* Start any frames queued before this one, even if it failed */
+	_dw_eth_kick(priv);
+
+	return ret;
+}
+
 static int _dw_eth_recv(struct dw_eth_dev *priv, uchar **packetp)
 {
 	u32 status, desc_num = priv->rx_currdescnum;
@@ -493,6 +557,67 @@ static int _dw_eth_recv(struct dw_eth_dev *priv, uchar **packetp)
 	return length;
 }
 
+static u32 rx_buf_index(struct dw_eth_dev *priv, ulong vaddr)
+{
+	return (vaddr - priv->rxbuffs.vaddr) / CONFIG_ETH_BUFSIZE;
+}
+
+/*
+ * Give the current RX descriptor a spare buffer, so that the buffer it
+ * received into can be lent to the network stack. Returns 0 if there is
+ * no spare buffer, in which case the frame has to be copied.
+ */
+static int _dw_rx_lend(struct dw_eth_dev *priv)
+{
+	u32 desc_num = priv->rx_currdescnum;
+	struct dmamacdescr *desc_vptr = &((struct dmamacdescr*)priv->rx_mac_descrtable.vaddr)[desc_num];
+	ulong lent = uboot_dma_phys_to_virt(desc_vptr->dmamac_addr);
+
+	if (priv->rx_nfree_bufs == 0)
+		return 0;
+
+	/* A returned buffer must be written back before a descriptor that
+	 * points at it is, and flushing a batch does not keep that order */
+	if (priv->rx_returns_queued) {
+		uboot_flush_queued();
+		priv->rx_returns_queued = false;
+	}
+
+	ulong vaddr = priv->rx_free_bufs[--priv->rx_nfree_bufs];
+	desc_vptr->dmamac_addr = priv->rxbuffs.paddr + (vaddr - priv->rxbuffs.vaddr);
+	priv->rx_lent[rx_buf_index(priv, lent)] = true;
+
+	return 1;
+}
+
+static void _dw_rx_buffer_return(struct dw_eth_dev *priv, uchar *buffer)
+{
+	ulong vaddr = (ulong)buffer;
+	u32 index = rx_buf_index(priv, vaddr);
+
+	if (vaddr < priv->rxbuffs.vaddr || index >= priv->rx_buf_num || !priv->rx_lent[index])
+		return;
+
+	/*
+	 * The stack may have written to the buffer. Write back and drop
+	 * those lines before a descriptor is given the buffer, so they cannot
+	 * later be evicted over a frame the DMA has written.
+	 */
+	uboot_queue_flush_dcache_range(vaddr, vaddr + CONFIG_ETH_BUFSIZE);
+	priv->rx_returns_queued = true;
+
+	priv->rx_lent[index] = false;
+	priv->rx_free_bufs[priv->rx_nfree_bufs++] = vaddr;
+}
+
+/* Hand the freed RX descriptors back to the DMA */
+static void _dw_recv_flush(struct dw_eth_dev *priv)
+{
+	uboot_flush_queued();
+	priv->rx_nqueued = 0;
+	priv->rx_returns_queued = false;
+}
+
 static int _dw_free_pkt(struct dw_eth_dev *priv)
 {
 	u32 desc_num = priv->rx_currdescnum;
@@ -501,17 +626,30 @@ static int _dw_free_pkt(struct dw_eth_dev *priv)
 	ulong desc_vend = desc_vstart +
 		roundup(sizeof(*desc_vptr), ARCH_DMA_MINALIGN);
 
+	/* Interrupt mitigation is switched on and off as descriptors are
+	 * returned, as the DMA may be writing to any it owns */
+	if (priv->rx_intdis)
+		desc_vptr->dmamac_cntl |= DESC_RXCTRL_RXINTDIS;
+	else
+		desc_vptr->dmamac_cntl &= ~DESC_RXCTRL_RXINTDIS;
+
 	/*
 	 * Make the current descriptor valid again and go to
 	 * the next one
 	 */
 	desc_vptr->txrx_status |= DESC_RXSTS_OWNBYDMA;
 
-	/* Flush only status field - others weren't changed */
-	uboot_flush_dcache_range(desc_vstart, desc_vend);
+	/*
+	 * Flush the descriptor along with the rest freed in this poll. If
+	 * every descriptor is waiting, the next one to be received into is
+	 * too, and must be flushed before it is invalidated.
+	 */
+	uboot_queue_flush_dcache_range(desc_vstart, desc_vend);
+	if (++priv->rx_nqueued == priv->rx_descr_num)
+		_dw_recv_flush(priv);
 
 	/* Test the wrap-around condition. */
-	if (++desc_num >= CONFIG_RX_DESCR_NUM)
+	if (++desc_num >= priv->rx_descr_num)
 		desc_num = 0;
 	priv->rx_currdescnum = desc_num;
 
@@ -566,13 +704,21 @@ static int dw_eth_send(struct eth_device *dev, void *packet, int length)
 
 static int dw_eth_recv(struct eth_device *dev)
 {
+	struct dw_eth_dev *priv = dev->priv;
 	uchar *packet;
 	int length;
 
-	length = _dw_eth_recv(dev->priv, &packet);
+	length = _dw_eth_recv(priv, &packet);
 	if (length == -EAGAIN)
 		return 0;
-	uboot_process_received_packet(packet, length);
+	priv->stats.rx_frames++;
+	if (uboot_rx_lending_enabled() && _dw_rx_lend(priv)) {
+		uboot_process_lent_packet(packet, length);
+	} else {
+		if (uboot_rx_lending_enabled())
+			priv->stats.rx_copied++;
+		uboot_process_received_packet(packet, length);
+	}
 
 	_dw_free_pkt(dev->priv);
 
@@ -589,17 +735,116 @@ static int dw_write_hwaddr(struct eth_device *dev)
 	return _dw_write_hwaddr(dev->priv, dev->enetaddr);
 }
 
+/*
+ * Add the MAC's missed frame counters to the driver's totals. The register
+ * clears when read, and its counters stop at their maximum with an
+ * overflow bit set.
+ */
+static void dw_update_missed(struct dw_eth_dev *priv)
+{
+	u32 missed = readl(&priv->dma_regs_p->missedframes);
+
+	if (missed & MISSED_FRAMES_OVF)
+		priv->stats.rx_missed += MISSED_FRAMES_MASK + 1;
+	else
+		priv->stats.rx_missed += missed & MISSED_FRAMES_MASK;
+
+	if (missed & FIFO_OVERFLOWS_OVF)
+		priv->stats.rx_fifo_overflows += (FIFO_OVERFLOWS_MASK >> FIFO_OVERFLOWS_SHIFT) + 1;
+	else
+		priv->stats.rx_fifo_overflows += (missed & FIFO_OVERFLOWS_MASK) >> FIFO_OVERFLOWS_SHIFT;
+}
+
 int designware_ack(struct eth_device *dev)
 {
     struct dw_eth_dev *priv = dev->priv;
-    writel(DMA_INTR_DEFAULT_MASK, &priv->dma_regs_p->status);
+    u32 status = readl(&priv->dma_regs_p->status);
+
+    /* The DMA found no free RX descriptor, or the RX FIFO overflowed. These
+     * are not in the interrupt mask, so are cleared here */
+    if (status & DMA_STATUS_RU)
+        priv->stats.rx_unavailable++;
+    if (status & (DMA_STATUS_RU | DMA_STATUS_OVF)) {
+        dw_update_missed(priv);
+    }
+
+    writel(DMA_INTR_DEFAULT_MASK | (status & (DMA_STATUS_RU | DMA_STATUS_OVF)),
+           &priv->dma_regs_p->status);
+    return 0;
+}
+
+void designware_get_stats(struct eth_device *dev, ethif_stats_t *stats)
+{
+	struct dw_eth_dev *priv = dev->priv;
+
+	dw_update_missed(priv);
+	*stats = priv->stats;
+}
+
+void designware_rx_irq_enable(struct eth_device *dev, bool enable)
+{
+	struct dw_eth_dev *priv = dev->priv;
+	u32 intenable = readl(&priv->dma_regs_p->intenable);
+
+	if (enable)
+		intenable |= DMA_INTR_ENA_RIE;
+	else
+		intenable &= ~DMA_INTR_ENA_RIE;
+	writel(intenable, &priv->dma_regs_p->intenable);
+}
+
+int designware_rx_pending(struct eth_device *dev)
+{
+	struct dw_eth_dev *priv = dev->priv;
+	struct dmamacdescr *desc_vptr = &((struct dmamacdescr*)priv->rx_mac_descrtable.vaddr)[priv->rx_currdescnum];
+	ulong desc_vstart = (ulong)desc_vptr;
+
+	uboot_invalidate_dcache_range(desc_vstart, desc_vstart +
+		roundup(sizeof(*desc_vptr), ARCH_DMA_MINALIGN));
+
+	return !(desc_vptr->txrx_status & DESC_RXSTS_OWNBYDMA);
+}
+
+void designware_rx_coalesce(struct eth_device *dev, u32 riwt)
+{
+	struct dw_eth_dev *priv = dev->priv;
+
+	priv->rx_intdis = riwt != 0;
+	writel(riwt & RIWT_MASK, &priv->dma_regs_p->riwt);
+}
+
+int designware_send_queue(struct eth_device *dev, void *packet, int length)
+{
+	return _dw_eth_queue(dev->priv, packet, length);
+}
+
+int designware_send_kick(struct eth_device *dev)
+{
+	return _dw_eth_kick(dev->priv);
+}
+
+void designware_rx_buffer_return(struct eth_device *dev, u8 *buffer)
+{
+	_dw_rx_buffer_return(dev->priv, buffer);
+}
+
+void designware_recv_flush(struct eth_device *dev)
+{
+	_dw_recv_flush(dev->priv);
 }
 
 int designware_read_hwaddr(struct eth_device *dev, u8 *mac_out) {
 	return _dw_read_hwaddr(dev->priv, mac_out);
 }
 
-int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev)
+static const ethif_ring_config_t default_rings = {
+	.tx_descriptors = CONFIG_TX_DESCR_NUM,
+	.rx_descriptors = CONFIG_RX_DESCR_NUM,
+	.rx_spare_buffers = CONFIG_RX_SPARE_BUFS,
+};
+
+int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev,
+			  const ethif_ring_config_t *rings)
 {
 	struct dw_eth_dev *priv;
 
@@ -620,12 +865,31 @@ int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev
 	memset(dev, 0, sizeof(struct eth_device));
 	memset(priv, 0, sizeof(struct dw_eth_dev));
 
+	if (!rings)
+		rings = &default_rings;
+	if (rings->tx_descriptors == 0 || rings->rx_descriptors == 0) {
+		printf("designware: rings need at least one descriptor\n");
+		return -EINVAL;
+	}
+
+	priv->tx_descr_num = rings->tx_descriptors;
+	priv->rx_descr_num = rings->rx_descriptors;
+	priv->rx_buf_num = rings->rx_descriptors + rings->rx_spare_buffers;
+
+	/* One extra entry, so that no spares does not mean a zero-sized allocation */
+	priv->rx_free_bufs = calloc(rings->rx_spare_buffers + 1, sizeof(*priv->rx_free_bufs));
+	priv->rx_lent = calloc(priv->rx_buf_num, sizeof(*priv->rx_lent));
+	if (!priv->rx_free_bufs || !priv->rx_lent) {
+		printf("designware: out of memory allocating RX buffer lists\n");
+		return -ENOMEM;
+	}
+
 	/* The descriptors and TX/RX buffers must be DMA, addresses are directly passed to hardware */
 
 	priv->tx_mac_descrtable =
-		uboot_dma_malloc(sizeof(struct dmamacdescr) * CONFIG_TX_DESCR_NUM, ARCH_DMA_MINALIGN);
+		uboot_dma_malloc(sizeof(struct dmamacdescr) * priv->tx_descr_num, ARCH_DMA_MINALIGN);
 	priv->rx_mac_descrtable =
-		uboot_dma_malloc(sizeof(struct dmamacdescr) * CONFIG_RX_DESCR_NUM, ARCH_DMA_MINALIGN);
+		uboot_dma_malloc(sizeof(struct dmamacdescr) * priv->rx_descr_num, ARCH_DMA_MINALIGN);
 
 	if (priv->tx_mac_descrtable.vaddr == 0 || priv->tx_mac_descrtable.paddr == 0 ||
 	    priv->rx_mac_descrtable.vaddr == 0 || priv->rx_mac_descrtable.paddr == 0) {
@@ -633,8 +897,8 @@ int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev
 		return -ENOMEM;
 	}
 
-	priv->txbuffs = uboot_dma_malloc(TX_TOTAL_BUFSIZE, ARCH_DMA_MINALIGN);
-	priv->rxbuffs = uboot_dma_malloc(RX_TOTAL_BUFSIZE, ARCH_DMA_MINALIGN);
+	priv->txbuffs = uboot_dma_malloc(CONFIG_ETH_BUFSIZE * priv->tx_descr_num, ARCH_DMA_MINALIGN);
+	priv->rxbuffs = uboot_dma_malloc(CONFIG_ETH_BUFSIZE * priv->rx_buf_num, ARCH_DMA_MINALIGN);
 
 	if (priv->txbuffs.vaddr == 0 || priv->txbuffs.paddr == 0 ||
 	    priv->rxbuffs.vaddr == 0 || priv->rxbuffs.paddr == 0) {
@@ -647,6 +911,11 @@ int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev
 	memset((void*)priv->txbuffs.vaddr, 0, priv->txbuffs.size);
 	memset((void*)priv->rxbuffs.vaddr, 0, priv->rxbuffs.size);
 
+	/* The buffers after the first one per descriptor start out spare */
+	for (u32 idx = priv->rx_descr_num; idx < priv->rx_buf_num; idx++)
+		priv->rx_free_bufs[priv->rx_nfree_bufs++] =
+			priv->rxbuffs.vaddr + idx * CONFIG_ETH_BUFSIZE;
+
 	sprintf(dev->name, "dwmac.%lx", base_addr);
 	dev->iobase = (int)base_addr;
 	dev->priv = priv;
@@ -705,8 +974,11 @@ int designware_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 int designware_eth_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct dw_eth_dev *priv = dev_get_priv(dev);
+	int ret = _dw_free_pkt(priv);
 
-	return _dw_free_pkt(priv);
+	/* Driver model callers free one frame at a time */
+	_dw_recv_flush(priv);
+	return ret;
 }
 
 void designware_eth_stop(struct udevice *dev)
@@ -15,11 +15,12 @@
 #include <asm-generic/gpio.h>
 #endif
 
+/* Ring depths used unless ethif_set_ring_config() says otherwise */
 #define CONFIG_TX_DESCR_NUM	16
 #define CONFIG_RX_DESCR_NUM	16
 #define CONFIG_ETH_BUFSIZE	2048
-#define TX_TOTAL_BUFSIZE	(CONFIG_ETH_BUFSIZE * CONFIG_TX_DESCR_NUM)
-#define RX_TOTAL_BUFSIZE	(CONFIG_ETH_BUFSIZE * CONFIG_RX_DESCR_NUM)
+/* RX buffers beyond one per descriptor, which can be lent out */
+#define CONFIG_RX_SPARE_BUFS	32
 
 #define CONFIG_MACRESET_TIMEOUT	(3 * CONFIG_SYS_HZ)
 #define CONFIG_MDIO_TIMEOUT	(3 * CONFIG_SYS_HZ)
@@ -75,7 +76,8 @@ struct eth_dma_regs {
 	u32 status;		/* 0x14 */
 	u32 opmode;		/* 0x18 */
 	u32 intenable;		/* 0x1c */
-	u32 reserved1[2];
+	u32 missedframes;	/* 0x20 */
+	u32 riwt;		/* 0x24 */
 	u32 axibus;		/* 0x28 */
 	u32 reserved2[7];
 	u32 currhosttxdesc;	/* 0x48 */
@@ -101,6 +103,20 @@ struct eth_dma_regs {
 #define RXHIGHPRIO		(1 << 1)
 #define DMAMAC_SRST		(1 << 0)
 
+/* RX interrupt watchdog timer, in units of 256 system clock cycles */
+#define RIWT_MASK		(0xFF)
+
+/* Missed frame and buffer overflow counter definitions */
+#define MISSED_FRAMES_MASK	(0xFFFF)
+#define MISSED_FRAMES_OVF	(1 << 16)
+#define FIFO_OVERFLOWS_SHIFT	(17)
+#define FIFO_OVERFLOWS_MASK	(0x7FF << FIFO_OVERFLOWS_SHIFT)
+#define FIFO_OVERFLOWS_OVF	(1 << 28)
+
+/* Status register definitions */
+#define DMA_STATUS_RU		(1 << 7)
+#define DMA_STATUS_OVF		(1 << 4)
+
 /* Poll demand definitions */
 #define POLL_DATA		(0xFFFFFFFF)
 
@@ -233,6 +249,28 @@ struct dw_eth_dev {
 	u32 max_speed;
 	u32 tx_currdescnum;
 	u32 rx_currdescnum;
+	/* Frames written to the descriptors before tx_currdescnum that have
+	 * not been handed to the DMA yet */
+	u32 tx_npending;
+	/* Ring depths, and the number of RX buffers (descriptors plus spares) */
+	u32 tx_descr_num;
+	u32 rx_descr_num;
+	u32 rx_buf_num;
+	/* RX buffers not attached to a descriptor or lent out */
+	ulong *rx_free_bufs;
+	u32 rx_nfree_bufs;
+	/* Which RX buffers are lent out */
+	bool *rx_lent;
+	/* RX descriptors freed since the last designware_recv_flush(), whose
+	 * flush is queued */
+	u32 rx_nqueued;
+	/* Whether a returned RX buffer's flush is queued */
+	bool rx_returns_queued;
+	/* Counts of received and dropped frames */
+	ethif_stats_t stats;
+	/* Set RXINTDIS on RX descriptors, leaving RX interrupts to the
+	 * RI watchdog timer */
+	bool rx_intdis;
 
 	struct eth_mac_regs *mac_regs_p;
 	struct eth_dma_regs *dma_regs_p;
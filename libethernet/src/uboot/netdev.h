@@ -41,7 +41,16 @@ int cs8900_initialize(u8 dev_num, int base_addr);
 int davinci_emac_initialize(void);
 int dc21x4x_initialize(bd_t *bis);
 int designware_read_hwaddr(struct eth_device *dev, u8 *mac_out);
-int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev);
+void designware_rx_buffer_return(struct eth_device *dev, u8 *buffer);
+void designware_recv_flush(struct eth_device *dev);
+int designware_send_queue(struct eth_device *dev, void *packet, int length);
+int designware_send_kick(struct eth_device *dev);
+void designware_rx_irq_enable(struct eth_device *dev, bool enable);
+int designware_rx_pending(struct eth_device *dev);
+void designware_rx_coalesce(struct eth_device *dev, u32 riwt);
+void designware_get_stats(struct eth_device *dev, ethif_stats_t *stats);
+int designware_initialize(ulong base_addr, u32 interface, struct eth_device *dev,
+			  const ethif_ring_config_t *rings);
 int dm9000_initialize(bd_t *bis);
 int dnet_eth_initialize(int id, void *regs, unsigned int phy_addr);
 int e1000_initialize(bd_t *bis);
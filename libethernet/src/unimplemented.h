@@ -27,6 +27,11 @@ ethif_dma_ops_t *uboot_get_dma_ops();
 
 void uboot_process_received_packet(uint8_t *in_packet, int len);
 
+/* Whether received buffers may be lent out, rather than copied */
+bool uboot_rx_lending_enabled(void);
+
+void uboot_process_lent_packet(uint8_t *in_packet, int len);
+
 extern uint64_t uboot_timestamp_freq;
 
 void uboot_timer_init();
@@ -61,6 +66,22 @@ static inline uint32_t uboot_invalidate_dcache_range(unsigned long start, unsign
     return uboot_get_dma_ops()->invalidate_dcache_range(start, stop - start);
 }
 
+/* Flush a range by the next uboot_flush_queued(), or now if the ops cannot queue */
+static inline uint32_t uboot_queue_flush_dcache_range(unsigned long start, unsigned long stop)
+{
+    ethif_dma_ops_t *ops = uboot_get_dma_ops();
+    if (ops->queue_flush_dcache_range == NULL) {
+        return ops->flush_dcache_range(start, stop - start);
+    }
+    return ops->queue_flush_dcache_range(start, stop - start);
+}
+
+static inline uint32_t uboot_flush_queued(void)
+{
+    ethif_dma_ops_t *ops = uboot_get_dma_ops();
+    return ops->flush_queued == NULL ? 0 : ops->flush_queued();
+}
+
 /***********************************************************************************
  * The rest of this file is a dumping ground of missing symbols required by u-boot *
  ***********************************************************************************/
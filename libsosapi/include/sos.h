@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <sel4/sel4.h>
+#include <aos/sos_abi.h>
 
 /* System calls for SOS */
 
@@ -23,8 +24,7 @@
 #define SOS_IPC_EP_CAP     (0x1)
 #define TIMER_IPC_EP_CAP   (0x2)
 
-/* Limits */
-#define PROCESS_MAX_FILES 16
+/* Limits. PROCESS_MAX_FILES is in <aos/sos_abi.h>. */
 #define MAX_IO_BUF 0x1000
 #define N_NAME 32
 
@@ -34,9 +34,7 @@
 #define FM_READ  4
 typedef int fmode_t;
 
-/* stat file types */
-#define ST_FILE    1    /* plain file */
-#define ST_SPECIAL 2    /* special (console) file */
+/* stat file types, ST_FILE, ST_SPECIAL and ST_DIR, are in <aos/sos_abi.h> */
 typedef int st_type_t;
 
 
@@ -92,6 +90,15 @@ int sos_getdirent(int pos, char *name, size_t nbyte);
  * -1 if error (non-existent entry).
  */
 
+int sos_getdirents(const char *path, unsigned long *cookie, void *buf, size_t nbyte);
+/* Reads as many entries of directory "path" as fit into "buf", max "nbyte"
+ * bytes, as packed sos_dirent_t records. "cookie" is where to start, 0 for
+ * the first entry, and is advanced past the entries returned.
+ * Returns the number of bytes of records, zero at the end of the directory,
+ * -1 if error (bad directory, or "buf" too small for the next entry).
+ * Costs one IPC per SOS_GETDIRENTS_MAX_BYTES of records, not per entry.
+ */
+
 int sos_stat(const char *path, sos_stat_t *buf);
 /* Returns information about file "path" through "buf".
  * Returns 0 if successful, -1 otherwise (invalid name).
@@ -121,8 +128,18 @@ pid_t sos_process_wait(pid_t pid);
  * to exit. Returns the pid of the process which exited.
  */
 
+int sos_null_syscall(void);
+/* Makes a syscall that does nothing, for measuring syscall overhead.
+ * Returns 0.
+ */
+
 int64_t sos_time_stamp(void);
 /* Returns time in microseconds since booting.
+ * Read from the time page SOS shares with each process, without a syscall.
+ */
+
+int64_t sos_time_stamp_ns(void);
+/* Returns time in nanoseconds since booting, also read from the time page.
  */
 
 void sos_usleep(int usec);
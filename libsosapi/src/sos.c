@@ -10,12 +10,41 @@
  * @TAG(DATA61_GPL)
  */
 #include <stdarg.h>
+#include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sos.h>
 
 #include <sel4/sel4.h>
+#include <utils/util.h>
+#include <aos/sos_abi.h>
+#include <aos/time_page.h>
+
+/* Mapped read-only into every process by SOS */
+static const sos_time_page_t *const time_page = (const sos_time_page_t *) SOS_TIME_PAGE_VADDR;
+
+/*
+ * Make a fast path syscall (see <aos/sos_abi.h>). The number and arguments
+ * are passed in registers, and the IPC buffer is not touched.
+ *
+ * @return  the first word of the reply.
+ */
+static seL4_Word sos_fastpath_call(seL4_Word number, seL4_Word nargs,
+                                   seL4_Word arg0, seL4_Word arg1, seL4_Word arg2)
+{
+    assert(nargs <= SOS_FASTPATH_MAX_ARGS);
+    seL4_Word mr0 = number, mr1 = arg0, mr2 = arg1, mr3 = arg2;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, nargs + 1);
+    seL4_CallWithMRs(SOS_IPC_EP_CAP, tag, &mr0, &mr1, &mr2, &mr3);
+    return mr0;
+}
+
+#define sos_fastpath_call0(n)             sos_fastpath_call(n, 0, 0, 0, 0)
+#define sos_fastpath_call1(n, a)          sos_fastpath_call(n, 1, a, 0, 0)
+#define sos_fastpath_call2(n, a, b)       sos_fastpath_call(n, 2, a, b, 0)
+#define sos_fastpath_call3(n, a, b, c)    sos_fastpath_call(n, 3, a, b, c)
 
 static size_t sos_debug_print(const void *vData, size_t count)
 {
@@ -29,31 +58,101 @@ static size_t sos_debug_print(const void *vData, size_t count)
     return count;
 }
 
+/*
+ * Make a file call (see <aos/sos_abi.h>) with a path after its arguments.
+ *
+ * @return  the first word of the reply, or -ENAMETOOLONG if the path is too
+ *          long.
+ */
+static long sos_path_call(seL4_Word number, seL4_Word arg, const char *path)
+{
+    size_t path_len = strlen(path) + 1;
+    if (path_len > SOS_IO_MAX_BYTES) {
+        return -ENAMETOOLONG;
+    }
+
+    seL4_SetMR(0, number);
+    seL4_SetMR(1, arg);
+    seL4_SetMR(2, 0);
+    memcpy(&seL4_GetIPCBuffer()->msg[SOS_IO_HEADER_WORDS], path, path_len);
+    seL4_Word len = SOS_IO_HEADER_WORDS + DIV_ROUND_UP(path_len, sizeof(seL4_Word));
+    seL4_Call(SOS_IPC_EP_CAP, seL4_MessageInfo_new(0, 0, 0, len));
+    return seL4_GetMR(0);
+}
+
 int sos_open(const char *path, fmode_t mode)
 {
-    assert(!"You need to implement this");
-    return -1;
+    long fd = sos_path_call(SOS_SYSCALL_OPEN, mode, path);
+    if (fd < 0) {
+        /* SOS replies with the reason, which is kept for open() */
+        errno = -fd;
+        if (fd == -EBUSY) {
+            /* The console is open for reading elsewhere, so let that
+             * reader run rather than retry straight away */
+            seL4_Yield();
+        }
+        return -1;
+    }
+    return fd;
 }
 
 int sos_close(int file)
 {
-    assert(!"You need to implement this");
-    return -1;
+    return (long) sos_fastpath_call1(SOS_SYSCALL_CLOSE, file);
 }
 
 int sos_read(int file, char *buf, size_t nbyte)
 {
-    assert(!"You need to implement this");
-    return -1;
+    seL4_Word *msg = seL4_GetIPCBuffer()->msg;
+    size_t done = 0;
+    while (done < nbyte) {
+        size_t want = MIN(nbyte - done, SOS_IO_MAX_BYTES);
+        seL4_SetMR(0, SOS_SYSCALL_READ);
+        seL4_SetMR(1, file);
+        seL4_SetMR(2, want);
+        seL4_Call(SOS_IPC_EP_CAP, seL4_MessageInfo_new(0, 0, 0, SOS_IO_HEADER_WORDS));
+
+        long got = seL4_GetMR(0);
+        if (got < 0) {
+            return done > 0 ? (int) done : -1;
+        }
+        memcpy(buf + done, &msg[SOS_IO_HEADER_WORDS], got);
+        done += got;
+        if ((size_t) got < want) {
+            break;
+        }
+    }
+    return done;
 }
 
 int sos_write(int file, const char *buf, size_t nbyte)
 {
-    /* MILESTONE 0: implement this to use your syscall and
-     * writes to the network console!
-     * Writing to files will come in later milestones.
-     */
-    return sos_debug_print(buf, nbyte);
+    if (file == 1 || file == 2) {
+        /* stdout and stderr go to the kernel's debug console */
+        return sos_debug_print(buf, nbyte);
+    }
+
+    seL4_Word *msg = seL4_GetIPCBuffer()->msg;
+    size_t done = 0;
+    while (done < nbyte) {
+        size_t want = MIN(nbyte - done, SOS_IO_MAX_BYTES);
+        seL4_SetMR(0, SOS_SYSCALL_WRITE);
+        seL4_SetMR(1, file);
+        seL4_SetMR(2, want);
+        memcpy(&msg[SOS_IO_HEADER_WORDS], buf + done, want);
+        seL4_Word len = SOS_IO_HEADER_WORDS + DIV_ROUND_UP(want, sizeof(seL4_Word));
+        seL4_Call(SOS_IPC_EP_CAP, seL4_MessageInfo_new(0, 0, 0, len));
+
+        long put = seL4_GetMR(0);
+        if (put < 0) {
+            return done > 0 ? (int) done : -1;
+        }
+        done += put;
+        if ((size_t) put < want) {
+            break;
+        }
+    }
+    return done;
 }
 
 int sos_getdirent(int pos, char *name, size_t nbyte)
@@ -62,10 +161,55 @@ int sos_getdirent(int pos, char *name, size_t nbyte)
     return -1;
 }
 
+int sos_getdirents(const char *path, unsigned long *cookie, void *buf, size_t nbyte)
+{
+    size_t path_len = strlen(path) + 1;
+    if (path_len > SOS_GETDIRENTS_MAX_BYTES) {
+        return -1;
+    }
+
+    seL4_Word *msg = seL4_GetIPCBuffer()->msg;
+    size_t done = 0;
+    while (done < nbyte) {
+        size_t want = MIN(nbyte - done, SOS_GETDIRENTS_MAX_BYTES);
+        seL4_SetMR(0, SOS_SYSCALL_GETDIRENTS);
+        seL4_SetMR(1, *cookie);
+        seL4_SetMR(2, want);
+        memcpy(&msg[SOS_GETDIRENTS_HEADER_WORDS], path, path_len);
+        seL4_Word len = SOS_GETDIRENTS_HEADER_WORDS + DIV_ROUND_UP(path_len, sizeof(seL4_Word));
+        seL4_Call(SOS_IPC_EP_CAP, seL4_MessageInfo_new(0, 0, 0, len));
+
+        long got = seL4_GetMR(0);
+        if (got < 0) {
+            return done > 0 ? (int) done : -1;
+        }
+        *cookie = seL4_GetMR(1);
+        memcpy((char *) buf + done, &msg[SOS_GETDIRENTS_HEADER_WORDS], got);
+        done += got;
+
+        /* Stop at the end of the directory, or once the next entry did not
+         * fit in the caller's buffer rather than in the message */
+        bool end = seL4_GetMR(2) != 0;
+        if (end || got == 0 || want < SOS_GETDIRENTS_MAX_BYTES) {
+            break;
+        }
+    }
+    return done;
+}
+
 int sos_stat(const char *path, sos_stat_t *buf)
 {
-    assert(!"You need to implement this");
-    return -1;
+    if (sos_path_call(SOS_SYSCALL_STAT, 0, path) != 0) {
+        return -1;
+    }
+    buf->st_type = seL4_GetMR(1);
+    /* The owner's permission bits are in the same order as FM_READ,
+     * FM_WRITE and FM_EXEC */
+    buf->st_fmode = (seL4_GetMR(2) >> 6) & (FM_READ | FM_WRITE | FM_EXEC);
+    buf->st_size = seL4_GetMR(3);
+    buf->st_ctime = seL4_GetMR(4);
+    buf->st_atime = seL4_GetMR(5);
+    return 0;
 }
 
 pid_t sos_process_create(const char *path)
@@ -105,8 +249,22 @@ void sos_usleep(int msec)
     assert(!"You need to implement this");
 }
 
+int sos_share_vm(void *adr, size_t size, int writable)
+{
+    return sos_fastpath_call3(SOS_SYSCALL_SHARE_VM, (seL4_Word) adr, size, writable != 0);
+}
+
+int sos_null_syscall(void)
+{
+    return sos_fastpath_call0(SOS_SYSCALL_NULL);
+}
+
 int64_t sos_time_stamp(void)
 {
-    assert(!"You need to implement this");
-    return -1;
+    return sos_time_page_us(time_page);
+}
+
+int64_t sos_time_stamp_ns(void)
+{
+    return sos_time_page_ns(time_page);
 }
@@ -149,6 +149,9 @@ long sys_ioctl(va_list ap)
 static long sos_open_wrapper(const char *pathname, int flags)
 {
     long fd = sos_open(pathname, flags);
+    if (fd < 0) {
+        return -errno;
+    }
     if (fd == STDIN_FD || fd == STDOUT_FD || fd == STDERR_FD) {
         /* Internally muslc believes it is on a posix system with
          * stdin, stdout and stderr already open with fd's 0, 1 and 2
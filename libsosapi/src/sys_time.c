@@ -39,11 +39,11 @@ long sys_clock_gettime(va_list ap)
 {
     clockid_t clk_id = va_arg(ap, clockid_t);
     struct timespec *res = va_arg(ap, struct timespec *);
-    if (clk_id != CLOCK_REALTIME) {
+    if (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC) {
         return -EINVAL;
     }
-    int64_t micros = sos_time_stamp();
-    res->tv_sec = micros / US_IN_S;
-    res->tv_nsec = (micros % US_IN_S) * NS_IN_US;
+    int64_t nanos = sos_time_stamp_ns();
+    res->tv_sec = nanos / NS_IN_S;
+    res->tv_nsec = nanos % NS_IN_S;
     return 0;
 }
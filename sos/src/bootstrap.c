@@ -438,7 +438,7 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
     uintptr_t dma_vaddr = ALIGN_UP(bootstrap_data.next_free_vaddr + PAGE_SIZE_4K, BIT(seL4_LargePageBits));
     err = dma_init(cspace, seL4_CapInitThreadVSpace, dma_cptr, dma_paddr, dma_vaddr);
     ZF_LOGF_IF(err, "Failed to initialise DMA");
-    bootstrap_data.next_free_vaddr = dma_vaddr + BIT(seL4_LargePageBits) + PAGE_SIZE_4K;
+    bootstrap_data.next_free_vaddr = dma_vaddr + DMA_VSPACE_SIZE + PAGE_SIZE_4K;
 
     /* now record all the cptrs we have already used to bootstrap */
     for (seL4_CPtr i = 0; i < ALIGN_DOWN(first_free_slot, slots_per_cnode); i += slots_per_cnode) {
@@ -20,6 +20,7 @@
 #define CHANNEL_SEND(name, channel, message)    name##_channel_send(channel, message)
 #define CHANNEL_RECV(name, channel)             name##_channel_recv(channel)
 #define CHANNEL_IS_EMPTY(name, channel)         name##_channel_is_empty(channel)
+#define CHANNEL_IS_FULL(name, channel)          name##_channel_is_full(channel)
 
 #define CHANNEL_DEFINE_HEADER(name, type, size) \
     typedef struct { \
@@ -37,7 +38,8 @@
     CHANNEL_TYPE(name) *name##_channel_create(seL4_CPtr read_available); \
     void name##_channel_send(CHANNEL_TYPE(name) *channel, type message); \
     type name##_channel_recv(CHANNEL_TYPE(name) *channel); \
-    bool name##_channel_is_empty(CHANNEL_TYPE(name) *channel);
+    bool name##_channel_is_empty(CHANNEL_TYPE(name) *channel); \
+    bool name##_channel_is_full(CHANNEL_TYPE(name) *channel);
 
 #define CHANNEL_DEFINE_SOURCE(name, type, size) \
     CHANNEL_TYPE(name) *name##_channel_create(seL4_CPtr read_available) { \
@@ -57,6 +59,8 @@
         while ((channel->next_empty + 1) % (size) == channel->next_msg) seL4_Wait(channel->read_ntfn, NULL); \
         /* Write the message into the channel */ \
         channel->messages[channel->next_empty] = message; \
+        /* Make the message visible before the index, for receivers on other cores */ \
+        THREAD_MEMORY_RELEASE(); \
         /* Update the write index */ \
         channel->next_empty += 1; \
         channel->next_empty %= size; \
@@ -67,8 +71,11 @@
     type name##_channel_recv(CHANNEL_TYPE(name) *channel) { \
         /* assert at least one message */ \
         assert (channel->next_empty % (size) != channel->next_msg); \
+        THREAD_MEMORY_ACQUIRE(); \
         /* read the message from the channel */ \
         type message = channel->messages[channel->next_msg]; \
+        /* Finish reading the slot before handing it back to the sender */ \
+        THREAD_MEMORY_RELEASE(); \
         /* Update the read index */ \
         channel->next_msg += 1; \
         channel->next_msg %= size; \
@@ -79,4 +86,8 @@
     \
     bool name##_channel_is_empty(CHANNEL_TYPE(name) *channel) { \
         return channel->next_empty % (size) == channel->next_msg % (size); \
+    } \
+    \
+    bool name##_channel_is_full(CHANNEL_TYPE(name) *channel) { \
+        return (channel->next_empty + 1) % (size) == channel->next_msg % (size); \
     }
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "console.h"
+
+#include <errno.h>
+#include <utils/util.h>
+#include <aos/sos_abi.h>
+#include <networkconsole/networkconsole.h>
+
+#include "coroutine.h"
+
+/* Input kept while nobody is reading */
+#define CONSOLE_BUF_SIZE    1024
+
+typedef struct {
+    struct network_console *net;
+    /* A ring of input not yet read */
+    char buf[CONSOLE_BUF_SIZE];
+    size_t head;
+    size_t count;
+    /* Whether it is open for reading */
+    bool reading;
+    /* The coroutine waiting for input, if any */
+    coroutine_t *reader;
+} console_t;
+
+static console_t console;
+
+/* Called by the network stack for each character received */
+static void console_recv(UNUSED struct network_console *net, char c)
+{
+    if (console.count == CONSOLE_BUF_SIZE) {
+        return;
+    }
+    console.buf[(console.head + console.count) % CONSOLE_BUF_SIZE] = c;
+    console.count++;
+    if (console.reader != NULL) {
+        coroutine_wakeup(console.reader);
+        console.reader = NULL;
+    }
+}
+
+/* There is only the file itself, at the mount point */
+static int console_lookup(UNUSED vfs_t *vfs, const char *path, UNUSED int flags, vnode_t *vn)
+{
+    if (path[0] != '\0') {
+        return -ENOENT;
+    }
+    vn->data = &console;
+    return 0;
+}
+
+static int console_open(UNUSED vnode_t *vn, int flags)
+{
+    if (console.net == NULL) {
+        return -ENODEV;
+    }
+    if (flags & VFS_O_READ) {
+        if (console.reading) {
+            return -EBUSY;
+        }
+        console.reading = true;
+    }
+    return 0;
+}
+
+static ssize_t console_read(UNUSED vnode_t *vn, UNUSED uint64_t offset, void *buf, size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    while (console.count == 0) {
+        console.reader = coroutine_current();
+        coroutine_wait();
+    }
+
+    char *out = buf;
+    size_t done = 0;
+    while (done < count && console.count > 0) {
+        char c = console.buf[console.head];
+        console.head = (console.head + 1) % CONSOLE_BUF_SIZE;
+        console.count--;
+        out[done++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    return done;
+}
+
+static ssize_t console_write(UNUSED vnode_t *vn, UNUSED uint64_t offset, const void *buf, size_t count)
+{
+    int sent = network_console_send(console.net, (char *) buf, count);
+    return sent < 0 ? -EIO : sent;
+}
+
+static int console_close(UNUSED vnode_t *vn, int flags)
+{
+    if (flags & VFS_O_READ) {
+        console.reading = false;
+    }
+    return 0;
+}
+
+static int console_stat(UNUSED vnode_t *vn, vfs_stat_t *st)
+{
+    *st = (vfs_stat_t) {
+        .type = ST_SPECIAL,
+        .mode = 0666,
+    };
+    return 0;
+}
+
+const vnode_ops_t console_ops = {
+    .lookup = console_lookup,
+    .open = console_open,
+    .read = console_read,
+    .write = console_write,
+    .stat = console_stat,
+    .close = console_close,
+};
+
+int console_init(void)
+{
+    console.net = network_console_init();
+    if (console.net == NULL) {
+        return -ENODEV;
+    }
+    return network_console_register_handler(console.net, console_recv);
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The console, a filesystem holding a single ST_SPECIAL file, for mounting
+ * in the VFS (see vfs.h) at "console".
+ *
+ * Writes go out over the network console. Reads wait for input typed into
+ * it, and return what has arrived up to the end of the first line. Input
+ * that arrives with nobody reading is kept, up to a limit, and the rest is
+ * dropped. The console may be open for reading only once at a time.
+ */
+
+#include "vfs.h"
+
+extern const vnode_ops_t console_ops;
+
+/*
+ * Start taking input from the network console. Must be called after
+ * network_init().
+ *
+ * @return  0 on success, or a negative error.
+ */
+int console_init(void);
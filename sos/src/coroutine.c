@@ -0,0 +1,186 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "coroutine.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <utils/util.h>
+#include <libco.h>
+#include <sos/gen_config.h>
+
+/* Number of 4K pages of stack given to each coroutine */
+#define COROUTINE_STACK_PAGES 4
+#define COROUTINE_STACK_SIZE  (COROUTINE_STACK_PAGES * PAGE_SIZE_4K)
+
+#define COROUTINE_POOL_SIZE   CONFIG_SOS_COROUTINE_POOL_SIZE
+
+typedef enum {
+    /* In the free list, waiting to be started */
+    COROUTINE_FREE,
+    /* Currently executing */
+    COROUTINE_RUNNING,
+    /* Waiting for a coroutine_wakeup() */
+    COROUTINE_BLOCKED,
+    /* Woken, and in the run queue */
+    COROUTINE_RUNNABLE,
+} coroutine_state_t;
+
+struct coroutine {
+    cothread_t thread;
+    coroutine_state_t state;
+    /* Set if coroutine_wakeup() was called while the coroutine was running */
+    bool woken;
+    /* The function the coroutine was started with, and its argument */
+    coroutine_fn_t fn;
+    void *arg;
+    /* Next coroutine in either the free list or the run queue */
+    coroutine_t *next;
+};
+
+static char coroutine_stacks[COROUTINE_POOL_SIZE][COROUTINE_STACK_SIZE] ALIGN(PAGE_SIZE_4K);
+
+static struct {
+    /* The context of the main event loop */
+    cothread_t main;
+    /* The coroutine currently executing, NULL when in the main loop */
+    coroutine_t *current;
+    /* Singly linked list of free coroutines */
+    coroutine_t *free;
+    /* FIFO of coroutines waiting to be resumed */
+    coroutine_t *runnable_head;
+    coroutine_t *runnable_tail;
+    coroutine_t pool[COROUTINE_POOL_SIZE];
+} coroutines;
+
+/* Every coroutine runs this loop, so a coroutine can be reused for many
+ * calls without deriving a new context each time. */
+static void coroutine_entry(void)
+{
+    while (true) {
+        coroutine_t *co = coroutines.current;
+        co->fn(co->arg);
+
+        /* Return to the pool and give control back to the event loop */
+        co->state = COROUTINE_FREE;
+        co->fn = NULL;
+        co->arg = NULL;
+        co->next = coroutines.free;
+        coroutines.free = co;
+        coroutines.current = NULL;
+        co_switch(coroutines.main);
+    }
+}
+
+static void coroutine_resume(coroutine_t *co)
+{
+    /* Coroutines are only resumed from the main event loop */
+    assert(coroutines.current == NULL);
+    co->state = COROUTINE_RUNNING;
+    coroutines.current = co;
+    co_switch(co->thread);
+}
+
+void coroutines_init(void)
+{
+    coroutines.main = co_active();
+    for (int i = COROUTINE_POOL_SIZE - 1; i >= 0; i--) {
+        coroutine_t *co = &coroutines.pool[i];
+        co->thread = co_derive(coroutine_stacks[i], COROUTINE_STACK_SIZE, coroutine_entry);
+        ZF_LOGF_IF(co->thread == NULL, "Failed to create coroutine");
+        co->state = COROUTINE_FREE;
+        co->next = coroutines.free;
+        coroutines.free = co;
+    }
+}
+
+bool coroutine_available(void)
+{
+    return coroutines.free != NULL;
+}
+
+coroutine_t *coroutine_start(coroutine_fn_t fn, void *arg)
+{
+    coroutine_t *co = coroutines.free;
+    if (co == NULL) {
+        return NULL;
+    }
+    coroutines.free = co->next;
+
+    co->next = NULL;
+    co->woken = false;
+    co->fn = fn;
+    co->arg = arg;
+    coroutine_resume(co);
+    return co;
+}
+
+bool coroutine_finished(coroutine_t *co)
+{
+    return co->state == COROUTINE_FREE;
+}
+
+coroutine_t *coroutine_current(void)
+{
+    return coroutines.current;
+}
+
+void coroutine_wait(void)
+{
+    coroutine_t *co = coroutines.current;
+    ZF_LOGF_IF(co == NULL, "The event loop cannot block");
+
+    if (co->woken) {
+        /* The event already happened */
+        co->woken = false;
+        return;
+    }
+
+    co->state = COROUTINE_BLOCKED;
+    coroutines.current = NULL;
+    co_switch(coroutines.main);
+}
+
+void coroutine_wakeup(coroutine_t *co)
+{
+    assert(co != NULL);
+    switch (co->state) {
+    case COROUTINE_RUNNING:
+        co->woken = true;
+        break;
+    case COROUTINE_BLOCKED:
+        co->state = COROUTINE_RUNNABLE;
+        co->next = NULL;
+        if (coroutines.runnable_tail != NULL) {
+            coroutines.runnable_tail->next = co;
+        } else {
+            coroutines.runnable_head = co;
+        }
+        coroutines.runnable_tail = co;
+        break;
+    default:
+        /* Already queued to run */
+        break;
+    }
+}
+
+void coroutines_run(void)
+{
+    while (coroutines.runnable_head != NULL) {
+        coroutine_t *co = coroutines.runnable_head;
+        coroutines.runnable_head = co->next;
+        if (coroutines.runnable_head == NULL) {
+            coroutines.runnable_tail = NULL;
+        }
+        co->next = NULL;
+        coroutine_resume(co);
+    }
+}
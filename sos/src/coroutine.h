@@ -0,0 +1,93 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * A fixed pool of libco coroutines, used by the syscall loop to run each
+ * incoming syscall in its own context.
+ *
+ * A handler that has to wait for an asynchronous event (an NFS callback,
+ * a timer or console input) calls coroutine_wait(). This switches back to
+ * the main event loop, which keeps handling IRQs and other syscalls. The
+ * callback for the event calls coroutine_wakeup() on the waiting
+ * coroutine, and the event loop resumes it from coroutines_run() once it
+ * has finished dispatching the current event.
+ *
+ * A typical use from a handler is:
+ *
+ *     struct { coroutine_t *co; int status; } wait = { coroutine_current() };
+ *     nfs_open_async(nfs, path, flags, open_cb, &wait);
+ *     coroutine_wait();
+ *
+ * where open_cb() stores the status and calls coroutine_wakeup(wait->co).
+ *
+ * Coroutines are only ever resumed from the main loop, never from within
+ * another coroutine or from inside a callback.
+ */
+
+#include <stdbool.h>
+
+typedef struct coroutine coroutine_t;
+typedef void (*coroutine_fn_t)(void *arg);
+
+/*
+ * Initialise the coroutine pool. Must be called before any coroutine is
+ * started.
+ */
+void coroutines_init(void);
+
+/*
+ * @return  true iff a coroutine is free to be started.
+ */
+bool coroutine_available(void);
+
+/*
+ * Run fn(arg) on a free coroutine from the pool. The function runs
+ * immediately, until it either returns or first calls coroutine_wait().
+ *
+ * Must be called from the main event loop.
+ *
+ * @return  the coroutine that was started, NULL if the pool is exhausted.
+ */
+coroutine_t *coroutine_start(coroutine_fn_t fn, void *arg);
+
+/*
+ * @return  true iff the coroutine has returned from the function it was
+ *          started with (and has returned to the pool).
+ */
+bool coroutine_finished(coroutine_t *co);
+
+/*
+ * @return  the coroutine currently executing, or NULL if called from the
+ *          main event loop.
+ */
+coroutine_t *coroutine_current(void);
+
+/*
+ * Block the current coroutine until coroutine_wakeup() is called on it.
+ *
+ * If the wakeup already happened (e.g. an async call completed its callback
+ * synchronously), this returns immediately.
+ */
+void coroutine_wait(void);
+
+/*
+ * Mark a coroutine as runnable. It will be resumed by the next call to
+ * coroutines_run(). Safe to call from callbacks and from other coroutines.
+ */
+void coroutine_wakeup(coroutine_t *co);
+
+/*
+ * Resume every coroutine that has been woken, until none are runnable.
+ * Called by the main event loop after dispatching each event.
+ */
+void coroutines_run(void);
@@ -10,9 +10,23 @@
  * @TAG(DATA61_GPL)
  */
 /**
- * This file implements very simple DMA for sos.
+ * This file implements DMA memory for sos.
  *
- * It does not free.
+ * DMA memory comes from a large page stolen from untyped memory at boot and
+ * mapped at the virtual address given to dma_init(). Once it runs out,
+ * allocations of up to a page can also take single pages from the ut table.
+ * Those are mapped after the large page as they are needed, and handed back
+ * to the ut table when they are empty again.
+ *
+ * Allocations of up to a page are made from slabs: pages divided into
+ * objects of a single power-of-two size class, no smaller than a cache line.
+ * Each slab keeps its own free list and a count of objects in use, so a slab
+ * that empties can give its page back, while partly used slabs of each class
+ * stay on a list to allocate from. Larger allocations take whole pages of the
+ * large page.
+ *
+ * Cache maintenance on many ranges can be batched, which merges ranges that
+ * overlap or touch so that each contiguous span costs a single operation.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,40 +35,127 @@
 
 #include <sel4/types.h>
 #include <cspace/cspace.h>
+#include <aos/sel4_zf_logif.h>
+#include <sos/gen_config.h>
 #include "dma.h"
 #include "mapping.h"
 #include "ut.h"
 #include "vmem_layout.h"
 
+/* Smallest size class. A multiple of the cache line size, so no two objects
+ * share a line. */
 #define DMA_ALIGN_BITS  7 /* 128 */
-#define DMA_ALIGN(a)    ROUND_UP((a), DMA_ALIGN_BITS)
+
+/* Cache line size of the Cortex-A53 and A55 */
+#define DMA_CACHE_LINE  64
+
+#define DMA_REGION_SIZE     BIT(SOS_DMA_SIZE_BITS)
+#define DMA_REGION_PAGES    BIT(SOS_DMA_SIZE_BITS - seL4_PageBits)
+#define DMA_EXTRA_PAGES     CONFIG_SOS_DMA_EXTRA_PAGES
+#define DMA_PAGES           (DMA_REGION_PAGES + DMA_EXTRA_PAGES)
+
+/* Size classes from 2^DMA_ALIGN_BITS up to a page */
+#define DMA_N_CLASSES       (seL4_PageBits - DMA_ALIGN_BITS + 1)
+
+/* Page info: a page that starts a run of whole pages holds its length in
+ * pages, a slab page holds DMA_PAGE_SLAB and its size class. */
+#define DMA_PAGE_SLAB       BIT(15)
+#define DMA_PAGE_CLASS_MASK (DMA_PAGE_SLAB - 1)
+
+/* End of a list of slab pages */
+#define DMA_NO_PAGE         (-1)
+
+/* A free object in a slab */
+typedef struct dma_free_obj {
+    struct dma_free_obj *next;
+} dma_free_obj_t;
+
+typedef struct {
+    /* what the page holds, see DMA_PAGE_SLAB */
+    uint16_t info;
+    /* objects in use, if the page is a slab */
+    uint16_t in_use;
+    /* free objects, if the page is a slab */
+    dma_free_obj_t *free;
+    /* next slab of the same size class with free objects */
+    int next;
+} dma_page_t;
+
+/* A page taken from the ut table */
+typedef struct {
+    /* NULL while the page is not in use */
+    ut_t *ut;
+    seL4_CPtr frame;
+    uintptr_t paddr;
+} dma_extra_page_t;
 
 typedef struct {
     /* the first virtual address */
     uintptr_t vstart;
-    /* the first physical address */
+    /* the first physical address of the large page */
     uintptr_t pstart;
-    /* the next available physical address */
-    uintptr_t pnext;
-    /* the last available physical address */
-    uintptr_t pend;
-    /* a ut cptr, sufficient to allocate   */
-    seL4_CPtr cap;
-    /* vspace for flushing address ranges */
+    /* cspace for the frames and paging structures of extra pages */
+    cspace_t *cspace;
+    /* vspace for mapping and flushing address ranges */
     seL4_CPtr vspace;
+    /* one bit for each page of the large page in use */
+    seL4_Word used[DMA_REGION_PAGES / seL4_WordBits];
+    /* the large page followed by the extra pages */
+    dma_page_t pages[DMA_PAGES];
+    dma_extra_page_t extra[DMA_EXTRA_PAGES];
+    /* one more than the highest extra page ever used */
+    size_t extra_high;
+    /* slabs with free objects, for each size class */
+    int partial[DMA_N_CLASSES];
 } dma_t;
 
 /* global dma data structure */
 static dma_t dma;
 
+static uintptr_t page_vaddr(int page)
+{
+    return dma.vstart + page * PAGE_SIZE_4K;
+}
+
+/* Page holding vaddr, or DMA_NO_PAGE if it is not mapped DMA memory */
+static int page_of_vaddr(uintptr_t vaddr)
+{
+    if (vaddr < dma.vstart || vaddr >= dma.vstart + DMA_PAGES * PAGE_SIZE_4K) {
+        return DMA_NO_PAGE;
+    }
+    int page = (vaddr - dma.vstart) / PAGE_SIZE_4K;
+    if (page >= DMA_REGION_PAGES && dma.extra[page - DMA_REGION_PAGES].ut == NULL) {
+        return DMA_NO_PAGE;
+    }
+    return page;
+}
+
 uintptr_t sos_dma_phys_to_virt(uintptr_t phys)
 {
-    return dma.vstart + (phys - dma.pstart);
+    if (phys >= dma.pstart && phys < dma.pstart + DMA_REGION_SIZE) {
+        return dma.vstart + (phys - dma.pstart);
+    }
+    for (size_t i = 0; i < dma.extra_high; i++) {
+        dma_extra_page_t *extra = &dma.extra[i];
+        if (extra->ut != NULL && ALIGN_DOWN(phys, PAGE_SIZE_4K) == extra->paddr) {
+            return page_vaddr(DMA_REGION_PAGES + i) + (phys - extra->paddr);
+        }
+    }
+    ZF_LOGE("%p is not DMA memory", (void *) phys);
+    return 0;
 }
 
 uintptr_t sos_dma_virt_to_phys(uintptr_t vaddr)
 {
-    return dma.pstart + (vaddr - dma.vstart);
+    int page = page_of_vaddr(vaddr);
+    if (page == DMA_NO_PAGE) {
+        ZF_LOGE("%p is not DMA memory", (void *) vaddr);
+        return 0;
+    }
+    if (page < DMA_REGION_PAGES) {
+        return dma.pstart + (vaddr - dma.vstart);
+    }
+    return dma.extra[page - DMA_REGION_PAGES].paddr + (vaddr - page_vaddr(page));
 }
 
 int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart, uintptr_t vstart)
@@ -63,37 +164,247 @@ int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart,
         return -1;
     }
 
-    dma.pstart = pstart;
     dma.vstart = vstart;
-    dma.pend = dma.pstart + BIT(seL4_LargePageBits);
-    dma.pnext = dma.pstart;
+    dma.pstart = pstart;
+    dma.cspace = cspace;
     dma.vspace = vspace;
+    for (int class = 0; class < DMA_N_CLASSES; class++) {
+        dma.partial[class] = DMA_NO_PAGE;
+    }
 
     /* now map the frame */
-    uintptr_t vaddr = sos_dma_phys_to_virt(dma.pstart);
-    ZF_LOGI("DMA initialised %p <--> %p\n", (void *) vaddr, (void *) sos_dma_phys_to_virt(dma.pend));
-    return map_frame(NULL, ut, dma.vspace, vaddr, seL4_AllRights, seL4_ARM_Default_VMAttributes);
+    seL4_Error err = map_frame(cspace, ut, vspace, vstart, seL4_AllRights, seL4_ARM_Default_VMAttributes);
+    if (err) {
+        ZF_LOGE("Failed to map DMA region at %p", (void *) vstart);
+        return err;
+    }
+    ZF_LOGI("DMA region %p <--> %p", (void *) vstart, (void *) (vstart + DMA_REGION_SIZE));
+    return 0;
+}
+
+static bool page_used(size_t page)
+{
+    return dma.used[page / seL4_WordBits] & BIT(page % seL4_WordBits);
+}
+
+static void set_pages_used(size_t first, size_t n, bool used)
+{
+    for (size_t page = first; page < first + n; page++) {
+        if (used) {
+            dma.used[page / seL4_WordBits] |= BIT(page % seL4_WordBits);
+        } else {
+            dma.used[page / seL4_WordBits] &= ~BIT(page % seL4_WordBits);
+        }
+    }
+}
+
+/* Find n free pages in the large page, starting at a multiple of align pages */
+static bool find_pages(size_t n, size_t align, size_t *first)
+{
+    for (size_t start = 0; start + n <= DMA_REGION_PAGES; start += align) {
+        size_t page;
+        for (page = start; page < start + n && !page_used(page); page++);
+        if (page == start + n) {
+            *first = start;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Allocate n contiguous pages of the large page */
+static int alloc_pages(size_t n, size_t align, uint16_t info)
+{
+    size_t first;
+    if (n > DMA_REGION_PAGES || align > DMA_REGION_PAGES || !find_pages(n, align, &first)) {
+        return DMA_NO_PAGE;
+    }
+    set_pages_used(first, n, true);
+    dma.pages[first].info = info;
+    return first;
+}
+
+/* Take a page from the ut table and map it after the large page */
+static int alloc_extra_page(uint16_t info)
+{
+    size_t i;
+    for (i = 0; i < DMA_EXTRA_PAGES && dma.extra[i].ut != NULL; i++);
+    if (i == DMA_EXTRA_PAGES) {
+        return DMA_NO_PAGE;
+    }
+
+    dma_extra_page_t *extra = &dma.extra[i];
+    int page = DMA_REGION_PAGES + i;
+    extra->ut = ut_alloc_4k_untyped(&extra->paddr);
+    if (extra->ut == NULL) {
+        return DMA_NO_PAGE;
+    }
+
+    extra->frame = cspace_alloc_slot(dma.cspace);
+    if (extra->frame == seL4_CapNull) {
+        goto out_ut;
+    }
+
+    seL4_Error err = cspace_untyped_retype(dma.cspace, extra->ut->cap, extra->frame, seL4_ARM_SmallPageObject,
+                                           seL4_PageBits);
+    if (err) {
+        goto out_slot;
+    }
+
+    err = map_frame(dma.cspace, extra->frame, dma.vspace, page_vaddr(page), seL4_AllRights,
+                    seL4_ARM_Default_VMAttributes);
+    if (err) {
+        ZF_LOGE("Failed to map DMA page at %p", (void *) page_vaddr(page));
+        cspace_delete(dma.cspace, extra->frame);
+        goto out_slot;
+    }
+
+    dma.extra_high = MAX(dma.extra_high, i + 1);
+    dma.pages[page].info = info;
+    return page;
+
+out_slot:
+    cspace_free_slot(dma.cspace, extra->frame);
+out_ut:
+    ut_free(extra->ut);
+    extra->ut = NULL;
+    return DMA_NO_PAGE;
+}
+
+/* Give back a single page, to the large page or the ut table */
+static void free_page(int page)
+{
+    dma.pages[page].info = 0;
+    if (page < DMA_REGION_PAGES) {
+        set_pages_used(page, 1, false);
+        return;
+    }
+
+    dma_extra_page_t *extra = &dma.extra[page - DMA_REGION_PAGES];
+    seL4_Error err = seL4_ARM_Page_Unmap(extra->frame);
+    ZF_LOGE_IFERR(err, "Failed to unmap DMA page at %p", (void *) page_vaddr(page));
+    cspace_delete(dma.cspace, extra->frame);
+    cspace_free_slot(dma.cspace, extra->frame);
+    ut_free(extra->ut);
+    extra->ut = NULL;
+}
+
+/* Size class that holds size bytes aligned to align, or -1 if that is more than a page */
+static int size_class(size_t size, size_t align)
+{
+    size_t bytes = MAX(size, align);
+    if (bytes > PAGE_SIZE_4K) {
+        return -1;
+    }
+
+    int class = 0;
+    while (BIT(DMA_ALIGN_BITS + class) < bytes) {
+        class++;
+    }
+    return class;
+}
+
+static void remove_partial(int class, int page)
+{
+    int *link = &dma.partial[class];
+    while (*link != page) {
+        assert(*link != DMA_NO_PAGE);
+        link = &dma.pages[*link].next;
+    }
+    *link = dma.pages[page].next;
+}
+
+static uintptr_t alloc_object(int class)
+{
+    if (dma.partial[class] == DMA_NO_PAGE) {
+        /* Carve a new slab into objects of this class, from the large page
+         * while it lasts */
+        uint16_t info = DMA_PAGE_SLAB | class;
+        int page = alloc_pages(1, 1, info);
+        if (page == DMA_NO_PAGE) {
+            page = alloc_extra_page(info);
+            if (page == DMA_NO_PAGE) {
+                return 0;
+            }
+        }
+
+        dma_page_t *slab = &dma.pages[page];
+        size_t obj_size = BIT(DMA_ALIGN_BITS + class);
+        slab->in_use = 0;
+        slab->free = NULL;
+        for (size_t offset = PAGE_SIZE_4K; offset > 0; offset -= obj_size) {
+            dma_free_obj_t *obj = (dma_free_obj_t *)(page_vaddr(page) + offset - obj_size);
+            obj->next = slab->free;
+            slab->free = obj;
+        }
+        slab->next = DMA_NO_PAGE;
+        dma.partial[class] = page;
+    }
+
+    int page = dma.partial[class];
+    dma_page_t *slab = &dma.pages[page];
+    dma_free_obj_t *obj = slab->free;
+    slab->free = obj->next;
+    slab->in_use++;
+    if (slab->free == NULL) {
+        dma.partial[class] = slab->next;
+    }
+    return (uintptr_t) obj;
+}
+
+static void free_object(int page, uintptr_t vaddr)
+{
+    dma_page_t *slab = &dma.pages[page];
+    int class = slab->info & DMA_PAGE_CLASS_MASK;
+
+    if (slab->free == NULL) {
+        /* it was full, so it has free objects again */
+        slab->next = dma.partial[class];
+        dma.partial[class] = page;
+    }
+    dma_free_obj_t *obj = (dma_free_obj_t *) vaddr;
+    obj->next = slab->free;
+    slab->free = obj;
+    slab->in_use--;
+
+    /* Give back an empty slab, unless it is the last one of its class, which
+     * is kept so that allocating and freeing a single object does not take
+     * and return a page each time. */
+    if (slab->in_use == 0 && (dma.partial[class] != page || slab->next != DMA_NO_PAGE)) {
+        remove_partial(class, page);
+        free_page(page);
+    }
 }
 
 dma_addr_t sos_dma_malloc(size_t size, int align)
 {
     dma_addr_t addr = {0, 0};
+    uintptr_t vaddr = 0;
 
-    dma.pnext = DMA_ALIGN(dma.pnext);
+    if (size == 0 || align < 0 || (align & (align - 1)) != 0) {
+        ZF_LOGE("Invalid DMA allocation of %zu bytes aligned to %d", size, align);
+        return addr;
+    }
 
-    /* Round up to the alignment */
-    dma.pnext = ROUND_UP(dma.pnext, align);
+    int class = size_class(size, align);
+    if (class >= 0) {
+        vaddr = alloc_object(class);
+    } else {
+        size_t pages = ALIGN_UP(size, PAGE_SIZE_4K) / PAGE_SIZE_4K;
+        size_t align_pages = MAX((size_t) align / PAGE_SIZE_4K, 1ul);
+        int first = alloc_pages(pages, align_pages, pages);
+        if (first != DMA_NO_PAGE) {
+            vaddr = page_vaddr(first);
+        }
+    }
 
-    if (dma.pnext + size >= dma.pend) {
+    if (vaddr == 0) {
         ZF_LOGE("Out of DMA memory");
         return addr;
     }
 
-    addr.vaddr = sos_dma_phys_to_virt(dma.pnext);
-    addr.paddr = dma.pnext;
-
-    /* set return values */
-    dma.pnext += size;
+    addr.vaddr = vaddr;
+    addr.paddr = sos_dma_virt_to_phys(vaddr);
     ZF_LOGD("DMA: 0x%x\n", (uintptr_t) addr.vaddr);
 
     /* Clean invalidate the range to prevent seL4 cache bombs */
@@ -101,17 +412,135 @@ dma_addr_t sos_dma_malloc(size_t size, int align)
     return addr;
 }
 
+void sos_dma_free(dma_addr_t addr)
+{
+    int page = page_of_vaddr(addr.vaddr);
+    if (page == DMA_NO_PAGE || dma.pages[page].info == 0) {
+        ZF_LOGE("Freeing %p, which is not allocated DMA memory", (void *) addr.vaddr);
+        return;
+    }
+
+    uint16_t info = dma.pages[page].info;
+    if (info & DMA_PAGE_SLAB) {
+        free_object(page, addr.vaddr);
+    } else {
+        set_pages_used(page, info, false);
+        dma.pages[page].info = 0;
+    }
+}
+
+#ifdef CONFIG_SOS_DMA_USER_CACHE_OPS
+/* Maintain the cache by virtual address from user level. There is no
+ * invalidate-only instruction available at EL0, so invalidating cleans too.
+ * That is the same as long as the CPU has not written to the range since it
+ * was last cleaned, which holds for buffers owned by a device. */
+static void user_cache_op(dma_cache_op_t op, uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t line = ALIGN_DOWN(start, DMA_CACHE_LINE); line < end; line += DMA_CACHE_LINE) {
+        if (op == DMA_CACHE_CLEAN) {
+            asm volatile("dc cvac, %0" :: "r"(line) : "memory");
+        } else {
+            asm volatile("dc civac, %0" :: "r"(line) : "memory");
+        }
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+#else
+static seL4_Error kernel_cache_op(dma_cache_op_t op, uintptr_t start, uintptr_t end)
+{
+    switch (op) {
+    case DMA_CACHE_CLEAN:
+        return seL4_ARM_VSpace_Clean_Data(dma.vspace, start, end);
+    case DMA_CACHE_INVALIDATE:
+        return seL4_ARM_VSpace_Invalidate_Data(dma.vspace, start, end);
+    default:
+        return seL4_ARM_VSpace_CleanInvalidate_Data(dma.vspace, start, end);
+    }
+}
+#endif /* CONFIG_SOS_DMA_USER_CACHE_OPS */
+
+static seL4_Error cache_op(dma_cache_op_t op, uintptr_t start, uintptr_t end)
+{
+#ifdef CONFIG_SOS_DMA_USER_CACHE_OPS
+    user_cache_op(op, start, end);
+    return seL4_NoError;
+#else
+    /* The kernel only operates on a range within a single frame: the large
+     * page, or one of the pages after it */
+    while (start < end) {
+        uintptr_t frame_size = start < dma.vstart + DMA_REGION_SIZE ? DMA_REGION_SIZE : PAGE_SIZE_4K;
+        uintptr_t frame_end = MIN(end, ALIGN_DOWN(start, frame_size) + frame_size);
+        seL4_Error err = kernel_cache_op(op, start, frame_end);
+        if (err) {
+            return err;
+        }
+        start = frame_end;
+    }
+    return seL4_NoError;
+#endif /* CONFIG_SOS_DMA_USER_CACHE_OPS */
+}
+
 seL4_Error sos_dma_cache_invalidate(uintptr_t addr, size_t size)
 {
-    return seL4_ARM_VSpace_Invalidate_Data(dma.vspace, addr, addr + size);
+    return cache_op(DMA_CACHE_INVALIDATE, addr, addr + size);
 }
 
 seL4_Error sos_dma_cache_clean(uintptr_t addr, size_t size)
 {
-    return seL4_ARM_VSpace_Clean_Data(dma.vspace, addr, addr + size);
+    return cache_op(DMA_CACHE_CLEAN, addr, addr + size);
 }
 
 seL4_Error sos_dma_cache_clean_invalidate(uintptr_t addr, size_t size)
 {
-    return seL4_ARM_VSpace_CleanInvalidate_Data(dma.vspace, addr, addr + size);
+    return cache_op(DMA_CACHE_CLEAN_INVALIDATE, addr, addr + size);
+}
+
+void sos_dma_cache_batch_init(dma_cache_batch_t *batch, dma_cache_op_t op)
+{
+    batch->op = op;
+    batch->n_ranges = 0;
+}
+
+seL4_Error sos_dma_cache_batch_add(dma_cache_batch_t *batch, uintptr_t addr, size_t size)
+{
+    uintptr_t start = ALIGN_DOWN(addr, DMA_CACHE_LINE);
+    uintptr_t end = ALIGN_UP(addr + size, DMA_CACHE_LINE);
+    seL4_Error err = seL4_NoError;
+
+    if (size == 0) {
+        return seL4_NoError;
+    }
+
+    /* Absorb every range this one overlaps or touches. Merging may make it
+     * reach another range, so keep going until none are left. */
+    for (size_t i = 0; i < batch->n_ranges;) {
+        dma_cache_range_t *range = &batch->ranges[i];
+        if (range->start <= end && start <= range->end) {
+            start = MIN(start, range->start);
+            end = MAX(end, range->end);
+            *range = batch->ranges[--batch->n_ranges];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (batch->n_ranges == DMA_CACHE_BATCH_SIZE) {
+        err = sos_dma_cache_batch_flush(batch);
+    }
+    batch->ranges[batch->n_ranges++] = (dma_cache_range_t) { start, end };
+    return err;
+}
+
+seL4_Error sos_dma_cache_batch_flush(dma_cache_batch_t *batch)
+{
+    seL4_Error result = seL4_NoError;
+    for (size_t i = 0; i < batch->n_ranges; i++) {
+        seL4_Error err = cache_op(batch->op, batch->ranges[i].start, batch->ranges[i].end);
+        if (err) {
+            result = err;
+        }
+    }
+    batch->n_ranges = 0;
+    return result;
 }
@@ -10,21 +10,50 @@
  * @TAG(DATA61_GPL)
  */
 #include <cspace/cspace.h>
+#include <sos/gen_config.h>
+#include "vmem_layout.h"
 
 typedef struct {
     uintptr_t vaddr; // virtual  address of the allocated DMA memory
     uintptr_t paddr; // physical address of the allocated DMA memory
 } dma_addr_t;
 
+/* Virtual address space used by DMA memory, from the vstart given to dma_init():
+ * the large page, then the pages that can be taken from the ut table */
+#define DMA_VSPACE_SIZE (BIT(SOS_DMA_SIZE_BITS) + CONFIG_SOS_DMA_EXTRA_PAGES * PAGE_SIZE_4K)
+
+/* Number of separate ranges a dma_cache_batch_t holds before it flushes */
+#define DMA_CACHE_BATCH_SIZE 16
+
+typedef enum {
+    DMA_CACHE_CLEAN,
+    DMA_CACHE_INVALIDATE,
+    DMA_CACHE_CLEAN_INVALIDATE,
+} dma_cache_op_t;
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} dma_cache_range_t;
+
+/* Ranges waiting for the same cache operation */
+typedef struct {
+    dma_cache_op_t op;
+    size_t n_ranges;
+    dma_cache_range_t ranges[DMA_CACHE_BATCH_SIZE];
+} dma_cache_batch_t;
+
 /**
  * Initialises a pool of DMA memory.
  *
- * @param cspace       cspace that this allocator can use to allocate a slot with and
- *                     retype the passed in untyped with. Only used in init.
+ * @param cspace       cspace that this allocator can use to allocate slots for the
+ *                     pages it takes from the ut table, and the paging structures
+ *                     needed to map them.
  * @param vspace       cptr to the vspace to use for mapping and cache operations.
- * @param ut           cptr to a ut that is seL4_LargePageBits in size
- * @param pstart       The base physical address of the ut
- * @param vstart       Virtual address to map the large page
+ * @param ut           cptr to a large page frame
+ * @param pstart       The base physical address of the frame
+ * @param vstart       Virtual address to map the large page. Pages taken from the
+ *                     ut table are mapped after it, up to vstart + DMA_VSPACE_SIZE.
  * @return             0 on success
  */
 int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart, uintptr_t vstart);
@@ -32,12 +61,22 @@ int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart,
 /**
  * Allocate an amount of DMA memory.
  *
+ * Allocations are cache line aligned, so that cache maintenance on one
+ * cannot affect another.
+ *
  * @param size in bytes to allocate
- * @param align alignment to align start of address to
+ * @param align alignment to align start of address to, a power of 2
  * @return a dma_addr_t representing the memory. On failure values will be 0.
  */
 dma_addr_t sos_dma_malloc(size_t size, int align);
 
+/**
+ * Free memory allocated by sos_dma_malloc.
+ *
+ * @param addr the dma_addr_t returned by sos_dma_malloc
+ */
+void sos_dma_free(dma_addr_t addr);
+
 /**
  * Convert the provided physical DMA address into a virtual address
  *
@@ -60,3 +99,28 @@ uintptr_t sos_dma_virt_to_phys(uintptr_t virt);
 seL4_Error sos_dma_cache_invalidate(uintptr_t addr, size_t size);
 seL4_Error sos_dma_cache_clean(uintptr_t addr, size_t size);
 seL4_Error sos_dma_cache_clean_invalidate(uintptr_t addr, size_t size);
+
+/*
+ * Batched cache operations. Ranges added to a batch are rounded out to cache
+ * lines and merged with any they overlap or touch, so that flushing the
+ * batch costs one operation per contiguous span rather than one per range.
+ *
+ * A typical use, cleaning the buffers of several descriptors at once:
+ *
+ *     dma_cache_batch_t batch;
+ *     sos_dma_cache_batch_init(&batch, DMA_CACHE_CLEAN);
+ *     for (i = 0; i < n; i++) {
+ *         sos_dma_cache_batch_add(&batch, bufs[i], lens[i]);
+ *     }
+ *     sos_dma_cache_batch_flush(&batch);
+ *
+ * Nothing is guaranteed to have reached memory until the flush returns.
+ */
+void sos_dma_cache_batch_init(dma_cache_batch_t *batch, dma_cache_op_t op);
+
+/* Add a range to the batch. If the batch is full of separate ranges, they
+ * are flushed first, and any error from that is returned. */
+seL4_Error sos_dma_cache_batch_add(dma_cache_batch_t *batch, uintptr_t addr, size_t size);
+
+/* Perform the operation on every range in the batch, and empty it */
+seL4_Error sos_dma_cache_batch_flush(dma_cache_batch_t *batch);
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "fd_table.h"
+
+int fd_table_add(fd_table_t *fds, vfs_file_t *file)
+{
+    for (int fd = FD_TABLE_FIRST; fd < PROCESS_MAX_FILES; fd++) {
+        if (fds->files[fd] == NULL) {
+            fds->files[fd] = file;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+vfs_file_t *fd_table_get(fd_table_t *fds, seL4_Word fd)
+{
+    if (fd < FD_TABLE_FIRST || fd >= PROCESS_MAX_FILES) {
+        return NULL;
+    }
+    return fds->files[fd];
+}
+
+vfs_file_t *fd_table_remove(fd_table_t *fds, seL4_Word fd)
+{
+    vfs_file_t *file = fd_table_get(fds, fd);
+    if (file != NULL) {
+        fds->files[fd] = NULL;
+    }
+    return file;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Tables of the files each process has open.
+ *
+ * A file descriptor is an index into its process's table. Descriptors 0
+ * to 2 are stdin, stdout and stderr, which libsosapi handles without SOS,
+ * so a file opened through SOS gets the lowest free descriptor from
+ * FD_TABLE_FIRST.
+ *
+ * A process makes one syscall at a time, so a descriptor is never closed
+ * while another call is using its file.
+ */
+
+#include <sel4/sel4.h>
+#include <aos/sos_abi.h>
+
+#include "vfs.h"
+
+#define FD_TABLE_FIRST 3
+
+typedef struct {
+    vfs_file_t *files[PROCESS_MAX_FILES];
+} fd_table_t;
+
+/*
+ * Give an open file a descriptor.
+ *
+ * @return  the descriptor, or -1 if the table is full.
+ */
+int fd_table_add(fd_table_t *fds, vfs_file_t *file);
+
+/*
+ * @return  the file open on fd, or NULL if fd is not open.
+ */
+vfs_file_t *fd_table_get(fd_table_t *fds, seL4_Word fd);
+
+/*
+ * Free a descriptor. The file is left open.
+ *
+ * @return  the file that was open on fd, or NULL if fd was not open.
+ */
+vfs_file_t *fd_table_remove(fd_table_t *fds, seL4_Word fd);
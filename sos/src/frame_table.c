@@ -71,6 +71,8 @@ static struct {
     cspace_t *cspace;
     /* vspace used to map pages into SOS. */
     seL4_ARM_PageGlobalDirectory vspace;
+    /* Frees frames held elsewhere when there are none left, or NULL. */
+    size_t (*reclaim)(size_t frames);
 } frame_table = {
     .frames = (void *)SOS_FRAME_TABLE,
     .frame_data = (void *)SOS_FRAME_DATA,
@@ -114,6 +116,11 @@ cspace_t *frame_table_cspace(void)
     return frame_table.cspace;
 }
 
+void frame_table_set_reclaim(size_t (*reclaim)(size_t frames))
+{
+    frame_table.reclaim = reclaim;
+}
+
 frame_ref_t alloc_frame(void)
 {
     frame_t *frame = pop_front(&frame_table.free);
@@ -122,8 +129,13 @@ frame_ref_t alloc_frame(void)
         frame = alloc_fresh_frame();
     }
 
+    if (frame == NULL && frame_table.reclaim != NULL && frame_table.reclaim(1) > 0) {
+        frame = pop_front(&frame_table.free);
+    }
+
     if (frame != NULL) {
         push_back(&frame_table.allocated, frame);
+        frame->refcount = 1;
     }
 
     return ref_from_frame(frame);
@@ -133,12 +145,34 @@ void free_frame(frame_ref_t frame_ref)
 {
     if (frame_ref != NULL_FRAME) {
         frame_t *frame = frame_from_ref(frame_ref);
+        assert(frame->list_id == ALLOCATED_LIST);
+        assert(frame->refcount > 0);
 
-        remove_frame(&frame_table.allocated, frame);
-        push_front(&frame_table.free, frame);
+        frame->refcount -= 1;
+        if (frame->refcount == 0) {
+            remove_frame(&frame_table.allocated, frame);
+            push_front(&frame_table.free, frame);
+        }
     }
 }
 
+bool frame_retain(frame_ref_t frame_ref)
+{
+    frame_t *frame = frame_from_ref(frame_ref);
+    assert(frame->list_id == ALLOCATED_LIST);
+
+    if (frame->refcount == FRAME_MAX_REFS) {
+        return false;
+    }
+    frame->refcount += 1;
+    return true;
+}
+
+size_t frame_refcount(frame_ref_t frame_ref)
+{
+    return frame_from_ref(frame_ref)->refcount;
+}
+
 seL4_ARM_Page frame_page(frame_ref_t frame_ref)
 {
     frame_t *frame = frame_from_ref(frame_ref);
@@ -62,9 +62,12 @@ PACKED struct frame {
     frame_ref_t next : 19;
     /* Indicates which list the frame is in. */
     list_id_t list_id : 2;
-    /* Unused bits */
-    size_t unused : 4;
+    /* Number of references to an allocated frame, see frame_retain(). */
+    size_t refcount : 4;
 };
+
+/* The largest number of references a frame can have. */
+#define FRAME_MAX_REFS (BIT(4) - 1)
 compile_time_assert("Small CPtr size", 20 >= INITIAL_TASK_CSPACE_BITS);
 
 /*
@@ -105,14 +108,36 @@ cspace_t *frame_table_cspace(void);
  */
 frame_ref_t alloc_frame(void);
 
+/*
+ * Set a function for alloc_frame() to call when it has no frame to give,
+ * to free frames held elsewhere that can be dropped, such as clean cached
+ * pages. It must not block, and returns the number of frames it freed.
+ */
+void frame_table_set_reclaim(size_t (*reclaim)(size_t frames));
+
 /*
  * Free a frame allocated by the frame table.
  *
- * This returns the frame to the frame table for re-use rather than
+ * This drops one reference to the frame. Once the last reference is
+ * dropped the frame is returned to the frame table for re-use rather than
  * returning it to the untyped allocator.
  */
 void free_frame(frame_ref_t frame_ref);
 
+/*
+ * Take another reference to an allocated frame, so that it is shared by
+ * the holders of each reference. A frame is allocated with one reference,
+ * and each free_frame() drops one.
+ *
+ * @return  false if the frame already has FRAME_MAX_REFS references.
+ */
+bool frame_retain(frame_ref_t frame_ref);
+
+/*
+ * @return  the number of references to an allocated frame.
+ */
+size_t frame_refcount(frame_ref_t frame_ref);
+
 /*
  * Get the contents of a frame as mapped into SOS.
  *
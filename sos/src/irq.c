@@ -181,6 +181,17 @@ int sos_handle_irq_notification(seL4_Word *badge, bool *have_reply)
     return 0;
 }
 
+int sos_irq_reschedule(seL4_IRQHandler irq_handler)
+{
+    for (unsigned long bit = 0; bit < seL4_BadgeBits; bit++) {
+        if (irq_handlers[bit].callback != NULL && irq_handlers[bit].irq_handler == irq_handler) {
+            seL4_Signal(irq_handlers[bit].notification);
+            return 0;
+        }
+    }
+    return EINVAL;
+}
+
 static int dispatch_irq(irq_handler_t *irq_handler)
 {
     if (irq_handler->callback != NULL) {
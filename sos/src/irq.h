@@ -80,3 +80,14 @@ int sos_register_irq_handler(
  * Returns any errors raised during handling IRQs or 0 on success.
  */
 int sos_handle_irq_notification(seL4_Word *badge, bool *have_reply);
+
+/*
+ * Have the event loop call the handler for an IRQ again, as though the
+ * IRQ had fired. A handler uses this to continue work it stopped to let
+ * the event loop handle other events.
+ *
+ * @irq_handler  The IRQHandler passed to the handler's callback.
+ *
+ * Returns 0 on success, or EINVAL if no handler is registered for it.
+ */
+int sos_irq_reschedule(seL4_IRQHandler irq_handler);
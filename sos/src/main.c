@@ -39,8 +39,18 @@
 #include "elfload.h"
 #include "syscalls.h"
 #include "tests.h"
+#include "timer_thread.h"
 #include "utils.h"
 #include "threads.h"
+#include "coroutine.h"
+#include "sos_syscall.h"
+#include "time_page.h"
+#include "process.h"
+#include "page_cache.h"
+#include "vfs.h"
+#include "nfs_fs.h"
+#include "console.h"
+#include "tmpfs.h"
 #include <sos/gen_config.h>
 #ifdef CONFIG_SOS_GDB_ENABLED
 #include "debugger.h"
@@ -68,11 +78,6 @@
  * process */
 #define INITIAL_PROCESS_EXTRA_STACK_PAGES 4
 
-/*
- * A dummy starting syscall
- */
-#define SOS_SYSCALL0 0
-
 /* The linker will link this symbol to the start address  *
  * of an archive of attached applications.                */
 extern char _cpio_archive[];
@@ -104,66 +109,60 @@ static struct {
 
     ut_t *stack_ut;
     seL4_CPtr stack;
+
+    fd_table_t fds;
 } user_process;
 
-/**
- * Deals with a syscall and sets the message registers before returning the
- * message info to be passed through to seL4_ReplyRecv()
- */
-seL4_MessageInfo_t handle_syscall(UNUSED seL4_Word badge, UNUSED int num_args, bool *have_reply)
+seL4_CPtr process_vspace(seL4_Word badge)
 {
-    seL4_MessageInfo_t reply_msg;
-
-    /* get the first word of the message, which in the SOS protocol is the number
-     * of the SOS "syscall". */
-    seL4_Word syscall_number = seL4_GetMR(0);
-
-    /* Set the reply flag */
-    *have_reply = true;
-
-    /* Process system call */
-    switch (syscall_number) {
-    case SOS_SYSCALL0:
-        ZF_LOGV("syscall: thread example made syscall 0!\n");
-        /* construct a reply message of length 1 */
-        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
-        /* Set the first (and only) word in the message to 0 */
-        seL4_SetMR(0, 0);
-
-        break;
-    default:
-        reply_msg = seL4_MessageInfo_new(0, 0, 0, 0);
-        ZF_LOGE("Unknown syscall %lu\n", syscall_number);
-        /* Don't reply to an unknown syscall */
-        *have_reply = false;
-    }
-
-    return reply_msg;
+    return badge == APP_EP_BADGE ? user_process.vspace : seL4_CapNull;
 }
 
-NORETURN void syscall_loop(seL4_CPtr ep)
+fd_table_t *process_fd_table(seL4_Word badge)
 {
-    seL4_CPtr reply;
-
-    /* Create reply object */
-    ut_t *reply_ut = alloc_retype(&reply, seL4_ReplyObject, seL4_ReplyBits);
-    if (reply_ut == NULL) {
-        ZF_LOGF("Failed to alloc reply object ut");
-    }
+    return badge == APP_EP_BADGE ? &user_process.fds : NULL;
+}
 
-    bool have_reply = false;
-    seL4_MessageInfo_t reply_msg = seL4_MessageInfo_new(0, 0, 0, 0);
+NORETURN void syscall_loop(seL4_CPtr ep, seL4_CPtr ntfn)
+{
+    /* A syscall that completed without blocking, whose reply is still to be sent */
+    sos_syscall_t *reply_call = NULL;
 
     while (1) {
         seL4_Word badge = 0;
         seL4_MessageInfo_t message;
-
-        /* Reply (if there is a reply) and block on ep, waiting for an IPC
-         * sent over ep, or a notification from our bound notification object */
-        if (have_reply) {
-            message = seL4_ReplyRecv(ep, reply_msg, &badge, reply);
+        sos_syscall_t *call;
+        /* Message words passed in registers, see <aos/sos_abi.h> */
+        seL4_Word mrs[SOS_FASTPATH_WORDS];
+
+        /* Resume any syscalls whose events arrived while handling the last message */
+#ifdef CONFIG_SOS_TIMER_THREAD
+        timer_thread_run_wakeups();
+#endif /* CONFIG_SOS_TIMER_THREAD */
+        coroutines_run();
+
+        if (reply_call != NULL) {
+            /* Reply, and receive the next message on the same reply object */
+            call = reply_call;
+            reply_call = NULL;
+            seL4_MessageInfo_t reply = sos_syscall_reply_info(call, mrs);
+            message = seL4_ReplyRecvWithMRs(ep, reply, &badge, &mrs[0], &mrs[1], &mrs[2], &mrs[3],
+                                            call->reply);
         } else {
-            message = seL4_Recv(ep, &badge, reply);
+            call = sos_syscall_alloc();
+            if (call == NULL) {
+                /* Every coroutine is blocked on an event, or every call is held
+                 * by the worker. Leave further syscalls queued on the endpoint and
+                 * only wait for notifications, which are what allow the blocked
+                 * syscalls to complete. */
+                seL4_Wait(ntfn, &badge);
+                UNUSED bool have_reply;
+                sos_handle_irq_notification(&badge, &have_reply);
+                continue;
+            }
+            /* Block on ep, waiting for an IPC sent over ep, or a notification
+             * from our bound notification object */
+            message = seL4_RecvWithMRs(ep, &badge, &mrs[0], &mrs[1], &mrs[2], &mrs[3], call->reply);
         }
 
         /* Awake! We got a message - check the label and badge to
@@ -173,19 +172,25 @@ NORETURN void syscall_loop(seL4_CPtr ep)
         if (badge & IRQ_EP_BADGE) {
             /* It's a notification from our bound notification
              * object! */
+            UNUSED bool have_reply;
             sos_handle_irq_notification(&badge, &have_reply);
+            sos_syscall_free(call);
         } else if (label == seL4_Fault_NullFault) {
 
             /* It's not a fault or an interrupt, it must be an IPC
-             * message from console_test! */
-            reply_msg = handle_syscall(badge, seL4_MessageInfo_get_length(message) - 1, &have_reply);
+             * message from console_test! Run it on a coroutine. */
+            if (sos_syscall_start(call, badge, message, mrs)) {
+                if (call->have_reply) {
+                    reply_call = call;
+                } else {
+                    sos_syscall_free(call);
+                }
+            }
         } else {
             /* some kind of fault */
             debug_print_fault(message, APP_NAME);
             /* dump registers too */
             debug_dump_registers(user_process.tcb);
-            /* Don't reply and recv on nothing */
-            have_reply = false;
 
             ZF_LOGF("The SOS skeleton does not know how to handle faults!");
         }
@@ -476,6 +481,13 @@ bool start_first_process(char *app_name, seL4_CPtr ep)
         return false;
     }
 
+    /* Map in the time page, so the process can read the time without a syscall */
+    err = time_page_map(&cspace, user_process.vspace);
+    if (err != 0) {
+        ZF_LOGE("Unable to map time page for user app");
+        return false;
+    }
+
     /* Start the new process */
     seL4_UserContext context = {
         .pc = elf_getEntryPoint(&elf_file),
@@ -600,9 +612,51 @@ NORETURN void *main_continued(UNUSED void *arg)
 
     /* Initialises the timer */
     printf("Timer init\n");
-    start_timer(timer_vaddr);
-    /* You will need to register an IRQ handler for the timer here.
-     * See "irq.h". */
+    int timer_err = start_timer(timer_vaddr);
+    ZF_LOGF_IF(timer_err != CLOCK_R_OK, "Failed to start timer");
+#ifdef CONFIG_SOS_BENCHMARK_CLOCK
+    benchmark_clock();
+#endif /* CONFIG_SOS_BENCHMARK_CLOCK */
+    time_page_init();
+
+    /* The worker and the timer thread hand work back to the syscall loop, and wake
+     * it with a cap to our notification carrying only the IRQ badge bit, which the
+     * IRQ dispatcher ignores. */
+    seL4_CPtr loop_ntfn = cspace_alloc_slot(&cspace);
+    ZF_LOGF_IF(loop_ntfn == seL4_CapNull, "Failed to alloc loop notification slot");
+    seL4_Error mint_err = cspace_mint(&cspace, loop_ntfn, &cspace, ntfn, seL4_CanWrite, IRQ_EP_BADGE);
+    ZF_LOGF_IFERR(mint_err, "Failed to mint loop notification");
+#ifdef CONFIG_SOS_TIMER_THREAD
+    timer_thread_init(loop_ntfn);
+#endif /* CONFIG_SOS_TIMER_THREAD */
+
+    seL4_IRQHandler timer_irq_handler;
+    timer_err = sos_register_irq_handler(meson_timeout_irq(CLOCK_TIMEOUT_TIMER), true, timer_irq, NULL,
+                                         &timer_irq_handler);
+    ZF_LOGF_IF(timer_err != 0, "Failed to register timer IRQ handler");
+
+    /* Set up the reply objects, coroutines and worker for handling syscalls */
+    sos_syscall_init(loop_ntfn);
+
+    /* Start writing back the NFS page cache */
+    page_cache_init();
+    test_nfs_io();
+
+    /* NFS is the root filesystem */
+    int mount_err = vfs_mount("/", &nfs_fs_ops, NULL);
+    ZF_LOGF_IF(mount_err != 0, "Failed to mount NFS: %d", mount_err);
+    tmpfs_t *tmpfs = tmpfs_create();
+    ZF_LOGF_IF(tmpfs == NULL, "Failed to create tmpfs");
+    mount_err = vfs_mount("/tmp", &tmpfs_ops, tmpfs);
+    ZF_LOGF_IF(mount_err != 0, "Failed to mount tmpfs: %d", mount_err);
+    test_tmpfs();
+
+    /* The console is the network console, which needs the network up */
+    int console_err = console_init();
+    if (console_err == 0) {
+        console_err = vfs_mount("/console", &console_ops, NULL);
+    }
+    ZF_LOGE_IF(console_err != 0, "Failed to start the console: %d", console_err);
 
     /* Start the user application */
     printf("Start first process\n");
@@ -610,7 +664,7 @@ NORETURN void *main_continued(UNUSED void *arg)
     ZF_LOGF_IF(!success, "Failed to start first process");
 
     printf("\nSOS entering syscall loop\n");
-    syscall_loop(ipc_ep);
+    syscall_loop(ipc_ep, ntfn);
 }
 /*
  * Main entry point - called by crt.
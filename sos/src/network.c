@@ -60,12 +60,22 @@
 #define NETWORK_IRQ (40)
 #define WATCHDOG_TIMEOUT 1000
 
+/* Frames received per pass in adaptive polling mode, before the event loop
+ * gets to handle other events */
+#define NETWORK_POLL_BUDGET 64
+/* RX interrupt coalescing timeout in adaptive polling mode, in units of
+ * 256 MAC clock cycles */
+#define NETWORK_RX_COALESCE 32
+/* Watchdog ticks between checks for frames dropped by the MAC */
+#define NETWORK_STATS_TICKS 10000
+
 #define DHCP_STATUS_WAIT        0
 #define DHCP_STATUS_FINISHED    1
 #define DHCP_STATUS_ERR         2
 
 static struct pico_device pico_dev;
 static struct nfs_context *nfs = NULL;
+static bool nfs_mounted = false;
 static int dhcp_status = DHCP_STATUS_WAIT;
 static char nfs_dir_buf[PATH_MAX];
 static uint8_t ip_octet;
@@ -74,9 +84,15 @@ static void nfs_mount_cb(int status, struct nfs_context *nfs, void *data, void *
 
 static int pico_eth_send(UNUSED struct pico_device *dev, void *input_buf, int len)
 {
-    if (ethif_send(input_buf, len) != ETHIF_NOERROR) {
-        /* If we get an error, just report that we didn't send anything */
-        return 0;
+    /* Frames are only queued here. Everything picotcp sends in a tick is
+     * started together by network_stack_tick(). */
+    if (ethif_send_queue(input_buf, len) != ETHIF_NOERROR) {
+        /* The ring is full of queued frames, so start those and try again */
+        ethif_send_flush();
+        if (ethif_send_queue(input_buf, len) != ETHIF_NOERROR) {
+            /* If we get an error, just report that we didn't send anything */
+            return 0;
+        }
     }
     /* Currently assuming that sending always succeeds unless we get an error code.
      * Given how the u-boot driver is structured, this seems to be a safe assumption. */
@@ -94,6 +110,8 @@ static int pico_eth_poll(UNUSED struct pico_device *dev, int loop_score)
         }
         loop_score--;
     }
+    /* Hand every descriptor freed in this poll back to the DMA at once */
+    ethif_recv_flush();
 
     /* return (original_loop_score - amount_of_packets_received) */
     return loop_score;
@@ -107,6 +125,36 @@ void raw_recv_callback(uint8_t *in_packet, int len)
     pico_stack_recv(&pico_dev, in_packet, len);
 }
 
+/* Called by picotcp when it is done with a frame received by raw_recv_lend_callback */
+static void rx_buffer_free(uint8_t *buffer)
+{
+    ethif_rx_buffer_return(buffer);
+}
+
+/* Called by ethernet driver with a frame whose DMA buffer it has lent us */
+static void raw_recv_lend_callback(uint8_t *in_packet, int len)
+{
+    /* picotcp queues the frame in place, and frees the buffer when it has
+     * been processed. If the frame could not be queued, the buffer may not
+     * have been freed, but returning a buffer twice is harmless. */
+    if (pico_stack_recv_zerocopy_ext_buffer_notify(&pico_dev, in_packet, len, rx_buffer_free) <= 0) {
+        ethif_rx_buffer_return(in_packet);
+    }
+}
+
+/* Flushes queued by the ethernet driver, done together when it asks */
+static dma_cache_batch_t eth_cache_batch;
+
+static uint32_t eth_queue_flush(uintptr_t addr, size_t size)
+{
+    return sos_dma_cache_batch_add(&eth_cache_batch, addr, size);
+}
+
+static uint32_t eth_flush_queued(void)
+{
+    return sos_dma_cache_batch_flush(&eth_cache_batch);
+}
+
 /* This is a bit of a hack - we need a DMA size field in the ethif driver. */
 ethif_dma_addr_t ethif_dma_malloc(uint32_t size, uint32_t align)
 {
@@ -144,12 +192,41 @@ void nfslib_poll()
     }
 }
 
-static void network_tick_internal(void)
+/* Run the picotcp stack, then send the frames it queued in one batch */
+static void network_stack_tick(void)
 {
     pico_bsd_stack_tick();
+    ethif_send_flush();
+}
+
+static void network_tick_internal(void)
+{
+    network_stack_tick();
     nfslib_poll();
 }
 
+#ifdef CONFIG_SOS_NETWORK_ADAPTIVE_POLLING
+/*
+ * Receive up to a budget of frames with the RX interrupt masked. If the
+ * ring still is not empty, the handler runs again once the event loop has
+ * handled whatever else is pending. Otherwise the interrupt is unmasked;
+ * a frame that arrived since the last ack leaves the interrupt raised, so
+ * none is missed.
+ */
+static void network_rx_poll(seL4_IRQHandler irq_handler)
+{
+    pico_eth_poll(&pico_dev, NETWORK_POLL_BUDGET);
+    network_stack_tick();
+
+    if (ethif_rx_pending()) {
+        int err = sos_irq_reschedule(irq_handler);
+        ZF_LOGF_IF(err != 0, "Failed to reschedule network IRQ");
+    } else {
+        ethif_rx_irq_enable(true);
+    }
+}
+#endif /* CONFIG_SOS_NETWORK_ADAPTIVE_POLLING */
+
 /* Handler for IRQs from the ethernet MAC */
 static int network_irq(
     UNUSED void *data,
@@ -158,11 +235,35 @@ static int network_irq(
 )
 {
     ethif_irq();
+#ifdef CONFIG_SOS_NETWORK_ADAPTIVE_POLLING
+    ethif_rx_irq_enable(false);
     seL4_IRQHandler_Ack(irq_handler);
-    pico_bsd_stack_tick();
+    network_rx_poll(irq_handler);
+#else
+    seL4_IRQHandler_Ack(irq_handler);
+    network_stack_tick();
+#endif /* CONFIG_SOS_NETWORK_ADAPTIVE_POLLING */
     return 0;
 }
 
+/* Warn if the MAC has dropped frames since the last check, so the ring
+ * depths can be tuned */
+static void network_check_drops(void)
+{
+    static ethif_stats_t last;
+    ethif_stats_t stats;
+
+    ethif_get_stats(&stats);
+    if (stats.rx_missed != last.rx_missed || stats.rx_fifo_overflows != last.rx_fifo_overflows) {
+        ZF_LOGW("RX overrun: %lu of %lu frames missed, %lu FIFO overflows, ring full %lu times, "
+                "%lu frames copied",
+                stats.rx_missed - last.rx_missed, stats.rx_frames - last.rx_frames,
+                stats.rx_fifo_overflows - last.rx_fifo_overflows,
+                stats.rx_unavailable - last.rx_unavailable, stats.rx_copied - last.rx_copied);
+    }
+    last = stats;
+}
+
 /* Handler for IRQs from the watchdog timer */
 static int network_tick(
     UNUSED void *data,
@@ -170,7 +271,13 @@ static int network_tick(
     seL4_IRQHandler irq_handler
 )
 {
+    static unsigned int ticks;
+
     network_tick_internal();
+    if (++ticks == NETWORK_STATS_TICKS) {
+        ticks = 0;
+        network_check_drops();
+    }
     watchdog_reset();
     seL4_IRQHandler_Ack(irq_handler);
     return 0;
@@ -236,15 +343,29 @@ void network_init(cspace_t *cspace, void *timer_vaddr, seL4_CPtr irq_ntfn)
     ethif_dma_ops.dma_phys_to_virt = &sos_dma_phys_to_virt;
     ethif_dma_ops.flush_dcache_range = &sos_dma_cache_clean_invalidate;
     ethif_dma_ops.invalidate_dcache_range = &sos_dma_cache_invalidate;
+    ethif_dma_ops.queue_flush_dcache_range = &eth_queue_flush;
+    ethif_dma_ops.flush_queued = &eth_flush_queued;
+    sos_dma_cache_batch_init(&eth_cache_batch, DMA_CACHE_CLEAN_INVALIDATE);
 
     /* Try initializing the device.
      *
      * This function will also check what MAC address u-boot programmed into
      * the interface, copy it into mac_addr, and reprogram it into the interface */
 
+    ethif_ring_config_t rings = {
+        .tx_descriptors = CONFIG_SOS_ETH_TX_DESCRIPTORS,
+        .rx_descriptors = CONFIG_SOS_ETH_RX_DESCRIPTORS,
+        .rx_spare_buffers = CONFIG_SOS_ETH_RX_SPARE_BUFFERS,
+    };
+    ethif_set_ring_config(&rings);
+
     uint8_t mac_addr[6];
     error = ethif_init(eth_base_vaddr, mac_addr, &ethif_dma_ops, &raw_recv_callback);
     ZF_LOGF_IF(error != 0, "Failed to initialise ethernet interface");
+    ethif_set_recv_lend_callback(raw_recv_lend_callback);
+#ifdef CONFIG_SOS_NETWORK_ADAPTIVE_POLLING
+    ethif_rx_coalesce(NETWORK_RX_COALESCE);
+#endif /* CONFIG_SOS_NETWORK_ADAPTIVE_POLLING */
 
     pico_bsd_init();
     pico_stack_init();
@@ -301,4 +422,10 @@ void nfs_mount_cb(int status, UNUSED struct nfs_context *nfs, void *data,
     }
 
     printf("Mounted nfs dir %s\n", nfs_dir_buf);
+    nfs_mounted = true;
+}
+
+struct nfs_context *network_nfs(void)
+{
+    return nfs_mounted ? nfs : NULL;
 }
@@ -25,3 +25,9 @@
  *                       and has a completely different programming model!)
  */
 void network_init(cspace_t *cspace, void *timer_vaddr, seL4_CPtr irq_ntfn);
+
+/**
+ * @return  the NFS context for the mounted root directory, or NULL if it has not
+ *          been mounted yet.
+ */
+struct nfs_context *network_nfs(void);
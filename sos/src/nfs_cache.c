@@ -0,0 +1,439 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "nfs_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <utils/time.h>
+#include <aos/sel4_zf_logif.h>
+#include <clock/clock.h>
+#include <nfsc/libnfs.h>
+#include <sos/gen_config.h>
+
+#include "coroutine.h"
+
+#define NFS_CACHE_TTL_US   (CONFIG_SOS_NFS_CACHE_TTL_MS * US_IN_MS)
+#define ATTR_CACHE_BUCKETS 256
+#define ATTR_CACHE_MAX     2048
+#define DIR_CACHE_MAX      8
+
+typedef struct attr attr_t;
+struct attr {
+    char *path;
+    struct nfs_stat_64 st;
+    timestamp_t expires;
+    attr_t *hash_next;
+    /* Oldest first, which is also the order they expire in */
+    attr_t *age_prev;
+    attr_t *age_next;
+};
+
+typedef struct dir_listing dir_listing_t;
+struct dir_listing {
+    char *path;
+    timestamp_t expires;
+    bool cached;
+    size_t n;
+    char **names;
+    dir_listing_t *next;
+};
+
+/* An NFS call the calling coroutine is waiting for */
+typedef struct {
+    coroutine_t *co;
+    bool done;
+    int status;
+    /* The invalidation count when the call was sent. If it has changed by
+     * the time the reply arrives, the reply may be stale and is not cached. */
+    uint64_t generation;
+    const char *path;
+    struct nfs_stat_64 st;
+    dir_listing_t *listing;
+} nfs_cache_call_t;
+
+static struct {
+    attr_t *buckets[ATTR_CACHE_BUCKETS];
+    attr_t *oldest;
+    attr_t *newest;
+    size_t n_attrs;
+    /* Most recently fetched first */
+    dir_listing_t *dirs;
+    size_t n_dirs;
+    uint64_t generation;
+} cache;
+
+/* The root of the mount may be named "", "." or "/" */
+static const char *dir_key(const char *dir)
+{
+    return strcmp(dir, ".") == 0 || strcmp(dir, "/") == 0 ? "" : dir;
+}
+
+/* The path of an entry of the directory dir, which is "" for the root */
+static void entry_path(char path[PATH_MAX], const char *dir, const char *name)
+{
+    snprintf(path, PATH_MAX, "%s%s%s", dir, dir[0] != '\0' ? "/" : "", name);
+}
+
+static attr_t **attr_bucket(const char *path)
+{
+    unsigned long hash = 5381;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char) *c;
+    }
+    return &cache.buckets[hash % ATTR_CACHE_BUCKETS];
+}
+
+static void attr_unlink_age(attr_t *attr)
+{
+    if (attr->age_prev != NULL) {
+        attr->age_prev->age_next = attr->age_next;
+    } else {
+        cache.oldest = attr->age_next;
+    }
+    if (attr->age_next != NULL) {
+        attr->age_next->age_prev = attr->age_prev;
+    } else {
+        cache.newest = attr->age_prev;
+    }
+}
+
+static void attr_push_age(attr_t *attr)
+{
+    attr->age_next = NULL;
+    attr->age_prev = cache.newest;
+    if (cache.newest != NULL) {
+        cache.newest->age_next = attr;
+    } else {
+        cache.oldest = attr;
+    }
+    cache.newest = attr;
+}
+
+static void attr_remove(attr_t *attr)
+{
+    attr_t **prev = attr_bucket(attr->path);
+    while (*prev != attr) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = attr->hash_next;
+    attr_unlink_age(attr);
+    free(attr->path);
+    free(attr);
+    cache.n_attrs--;
+}
+
+static attr_t *attr_find(const char *path)
+{
+    for (attr_t *attr = *attr_bucket(path); attr != NULL; attr = attr->hash_next) {
+        if (strcmp(attr->path, path) == 0) {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+static attr_t *attr_lookup(const char *path)
+{
+    attr_t *attr = attr_find(path);
+    if (attr != NULL && attr->expires <= get_time()) {
+        attr_remove(attr);
+        attr = NULL;
+    }
+    return attr;
+}
+
+static void attr_insert(const char *path, const struct nfs_stat_64 *st)
+{
+    attr_t *attr = attr_find(path);
+    if (attr != NULL) {
+        attr_unlink_age(attr);
+    } else {
+        if (cache.n_attrs >= ATTR_CACHE_MAX) {
+            attr_remove(cache.oldest);
+        }
+        attr = malloc(sizeof(*attr));
+        char *copy = strdup(path);
+        if (attr == NULL || copy == NULL) {
+            free(attr);
+            free(copy);
+            return;
+        }
+        attr->path = copy;
+        attr_t **bucket = attr_bucket(path);
+        attr->hash_next = *bucket;
+        *bucket = attr;
+        cache.n_attrs++;
+    }
+
+    attr->st = *st;
+    attr->expires = get_time() + NFS_CACHE_TTL_US;
+    attr_push_age(attr);
+}
+
+static void dir_free(dir_listing_t *listing)
+{
+    for (size_t i = 0; i < listing->n; i++) {
+        free(listing->names[i]);
+    }
+    free(listing->names);
+    free(listing->path);
+    free(listing);
+}
+
+static void dir_remove(const char *path)
+{
+    for (dir_listing_t **prev = &cache.dirs; *prev != NULL; prev = &(*prev)->next) {
+        dir_listing_t *listing = *prev;
+        if (strcmp(listing->path, path) == 0) {
+            *prev = listing->next;
+            dir_free(listing);
+            cache.n_dirs--;
+            return;
+        }
+    }
+}
+
+static dir_listing_t *dir_lookup(const char *path)
+{
+    for (dir_listing_t *listing = cache.dirs; listing != NULL; listing = listing->next) {
+        if (strcmp(listing->path, path) == 0) {
+            if (listing->expires <= get_time()) {
+                dir_remove(path);
+                return NULL;
+            }
+            return listing;
+        }
+    }
+    return NULL;
+}
+
+static void dir_insert(dir_listing_t *listing)
+{
+    dir_remove(listing->path);
+    if (cache.n_dirs >= DIR_CACHE_MAX) {
+        /* Drop the listing fetched longest ago */
+        dir_listing_t **last = &cache.dirs;
+        while ((*last)->next != NULL) {
+            last = &(*last)->next;
+        }
+        dir_free(*last);
+        *last = NULL;
+        cache.n_dirs--;
+    }
+
+    listing->cached = true;
+    listing->expires = get_time() + NFS_CACHE_TTL_US;
+    listing->next = cache.dirs;
+    cache.dirs = listing;
+    cache.n_dirs++;
+}
+
+static int call_wait(nfs_cache_call_t *call, int err)
+{
+    ZF_LOGF_IF(call->co == NULL, "NFS cache lookups must be called from a coroutine");
+    if (err != 0) {
+        return err;
+    }
+    while (!call->done) {
+        coroutine_wait();
+    }
+    return call->status;
+}
+
+static void stat_cb(int status, UNUSED struct nfs_context *nfs, void *data, void *private_data)
+{
+    nfs_cache_call_t *call = private_data;
+
+    call->status = status;
+    if (status < 0) {
+        ZF_LOGD("NFS stat of %s failed: %s", call->path, (char *) data);
+    } else {
+        call->st = *(struct nfs_stat_64 *) data;
+        if (call->generation == cache.generation) {
+            attr_insert(call->path, &call->st);
+        }
+    }
+
+    call->done = true;
+    coroutine_wakeup(call->co);
+}
+
+int nfs_cache_stat(struct nfs_context *nfs, const char *path, struct nfs_stat_64 *st)
+{
+    attr_t *attr = attr_lookup(path);
+    if (attr != NULL) {
+        *st = attr->st;
+        return 0;
+    }
+
+    nfs_cache_call_t call = {
+        .co = coroutine_current(),
+        .generation = cache.generation,
+        .path = path,
+    };
+    int err = call_wait(&call, nfs_stat64_async(nfs, path, stat_cb, &call));
+    if (err == 0) {
+        *st = call.st;
+    }
+    return err;
+}
+
+/* Build a listing of the directory, and cache the attributes of its entries */
+static dir_listing_t *dir_build(struct nfs_context *nfs, struct nfsdir *nfsdir, const char *path,
+                                bool cache_attrs)
+{
+    dir_listing_t *listing = calloc(1, sizeof(*listing));
+    if (listing == NULL) {
+        return NULL;
+    }
+    listing->path = strdup(path);
+
+    size_t max = 0;
+    for (struct nfsdirent *ent = nfs_readdir(nfs, nfsdir); ent != NULL; ent = nfs_readdir(nfs, nfsdir)) {
+        if (strcmp(ent->name, ".") == 0 || strcmp(ent->name, "..") == 0) {
+            continue;
+        }
+
+        if (listing->n == max) {
+            max = max == 0 ? 32 : max * 2;
+            char **names = realloc(listing->names, max * sizeof(char *));
+            if (names == NULL) {
+                break;
+            }
+            listing->names = names;
+        }
+        listing->names[listing->n] = strdup(ent->name);
+        if (listing->names[listing->n] == NULL) {
+            break;
+        }
+        listing->n++;
+
+        if (cache_attrs) {
+            char ent_path[PATH_MAX];
+            entry_path(ent_path, path, ent->name);
+            struct nfs_stat_64 st = {
+                .nfs_ino = ent->inode,
+                .nfs_mode = ent->mode,
+                .nfs_size = ent->size,
+                .nfs_atime = ent->atime.tv_sec,
+                .nfs_atime_nsec = ent->atime.tv_usec * NS_IN_US,
+                .nfs_mtime = ent->mtime.tv_sec,
+                .nfs_mtime_nsec = ent->mtime.tv_usec * NS_IN_US,
+                .nfs_ctime = ent->ctime.tv_sec,
+                .nfs_ctime_nsec = ent->ctime.tv_usec * NS_IN_US,
+            };
+            attr_insert(ent_path, &st);
+        }
+    }
+
+    if (listing->path == NULL || (max > 0 && listing->names == NULL)) {
+        dir_free(listing);
+        return NULL;
+    }
+    return listing;
+}
+
+static void opendir_cb(int status, struct nfs_context *nfs, void *data, void *private_data)
+{
+    nfs_cache_call_t *call = private_data;
+
+    call->status = status;
+    if (status < 0) {
+        ZF_LOGE("NFS opendir of %s failed: %s", call->path, (char *) data);
+    } else {
+        /* The listing is cached by the caller once it runs. Cached here, it
+         * could be invalidated or evicted and freed before then. */
+        call->listing = dir_build(nfs, data, call->path, call->generation == cache.generation);
+        nfs_closedir(nfs, data);
+        if (call->listing == NULL) {
+            call->status = -ENOMEM;
+        }
+    }
+
+    call->done = true;
+    coroutine_wakeup(call->co);
+}
+
+ssize_t nfs_cache_getdirent(struct nfs_context *nfs, const char *dir, size_t pos, char *name,
+                            size_t nbyte, struct nfs_stat_64 *st)
+{
+    const char *path = dir_key(dir);
+    dir_listing_t *listing = dir_lookup(path);
+
+    if (listing == NULL) {
+        nfs_cache_call_t call = {
+            .co = coroutine_current(),
+            .generation = cache.generation,
+            .path = path,
+        };
+        int err = call_wait(&call, nfs_opendir_async(nfs, path[0] != '\0' ? path : "/", opendir_cb,
+                                                     &call));
+        if (err != 0) {
+            return err;
+        }
+        listing = call.listing;
+        if (call.generation == cache.generation) {
+            dir_insert(listing);
+        }
+    }
+
+    ssize_t ret;
+    char ent_path[PATH_MAX];
+    if (pos > listing->n || nbyte == 0) {
+        ret = -EINVAL;
+    } else if (pos == listing->n) {
+        ret = 0;
+    } else {
+        size_t len = MIN(strlen(listing->names[pos]), nbyte - 1);
+        memcpy(name, listing->names[pos], len);
+        name[len] = '\0';
+        ret = len;
+        entry_path(ent_path, path, listing->names[pos]);
+    }
+
+    /* A listing fetched across an invalidation is used only once */
+    if (!listing->cached) {
+        dir_free(listing);
+    }
+
+    if (ret > 0 && st != NULL) {
+        /* Normally cached by the sweep that listed the directory */
+        int err = nfs_cache_stat(nfs, ent_path, st);
+        if (err != 0) {
+            return err;
+        }
+    }
+    return ret;
+}
+
+void nfs_cache_invalidate(const char *path)
+{
+    cache.generation++;
+
+    attr_t *attr = attr_find(path);
+    if (attr != NULL) {
+        attr_remove(attr);
+    }
+
+    char parent[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    size_t len = slash != NULL ? MIN((size_t) (slash - path), sizeof(parent) - 1) : 0;
+    memcpy(parent, path, len);
+    parent[len] = '\0';
+    dir_remove(dir_key(parent));
+}
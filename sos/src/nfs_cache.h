@@ -0,0 +1,58 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Caches of NFS file attributes and directory listings.
+ *
+ * Reading a directory by entry index would cost a READDIR per entry, and a
+ * stat a GETATTR per call. Instead a directory is listed with one
+ * READDIRPLUS sweep, which also returns the attributes of every entry, and
+ * both the listing and the attributes are kept for CONFIG_SOS_NFS_CACHE_TTL_MS.
+ * Changes made by other NFS clients are seen once the entries expire.
+ *
+ * Changes made by SOS itself must be reported with nfs_cache_invalidate().
+ *
+ * The lookups may block on NFS, so must be called from a coroutine (see
+ * coroutine.h).
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct nfs_context;
+struct nfs_stat_64;
+
+/*
+ * Get the attributes of the file at path.
+ *
+ * @return  0 on success, or a negative error from libnfs.
+ */
+int nfs_cache_stat(struct nfs_context *nfs, const char *path, struct nfs_stat_64 *st);
+
+/*
+ * Copy the name of entry pos of the directory at dir into name, truncated to
+ * nbyte bytes including the terminator. "." and ".." are not listed. If st
+ * is not NULL, the attributes of the entry are stored there too.
+ *
+ * @return  the length of the name copied, 0 if pos is one past the last
+ *          entry, or a negative error if pos is further out or the directory
+ *          could not be read.
+ */
+ssize_t nfs_cache_getdirent(struct nfs_context *nfs, const char *dir, size_t pos, char *name,
+                            size_t nbyte, struct nfs_stat_64 *st);
+
+/*
+ * Forget the cached attributes of path and the listing of the directory
+ * holding it, after SOS has created, written, truncated or removed it.
+ */
+void nfs_cache_invalidate(const char *path);
@@ -0,0 +1,326 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "nfs_fs.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utils/util.h>
+#include <utils/time.h>
+#include <aos/sel4_zf_logif.h>
+#include <aos/sos_abi.h>
+#include <nfsc/libnfs.h>
+
+#include "coroutine.h"
+#include "network.h"
+#include "nfs_cache.h"
+#include "page_cache.h"
+
+typedef struct {
+    /* Relative to the NFS mount, "" for its root */
+    char *path;
+    struct nfsfh *fh;
+    /* Whether fh was opened for writing */
+    bool writable;
+    /* A read-only handle replaced by a writable fh, kept until the files
+     * that may still be reading through it are closed */
+    struct nfsfh *old_fh;
+    /* Written since the last close, so cached attributes are stale */
+    bool written;
+} nfs_vnode_t;
+
+/* An NFS call the calling coroutine is waiting for */
+typedef struct {
+    coroutine_t *co;
+    bool done;
+    int status;
+    struct nfsfh *fh;
+    /* Where to copy the attributes, for fstat */
+    struct nfs_stat_64 *st;
+} nfs_fs_call_t;
+
+static void call_cb(int status, UNUSED struct nfs_context *nfs, void *data, void *private_data)
+{
+    nfs_fs_call_t *call = private_data;
+
+    call->status = status;
+    if (status < 0) {
+        ZF_LOGD("NFS call failed: %s", (char *) data);
+    } else if (call->st != NULL) {
+        *call->st = *(struct nfs_stat_64 *) data;
+    } else {
+        /* The new handle, for open and creat */
+        call->fh = data;
+    }
+
+    call->done = true;
+    coroutine_wakeup(call->co);
+}
+
+static int call_wait(nfs_fs_call_t *call, int err)
+{
+    ZF_LOGF_IF(call->co == NULL, "NFS filesystem calls must be made from a coroutine");
+    if (err != 0) {
+        return -EIO;
+    }
+    while (!call->done) {
+        coroutine_wait();
+    }
+    return call->status;
+}
+
+/* The path libnfs expects, which for the root of the mount is "/" */
+static const char *nfs_path(nfs_vnode_t *nv)
+{
+    return nv->path[0] != '\0' ? nv->path : "/";
+}
+
+static void stat_convert(const struct nfs_stat_64 *nst, vfs_stat_t *st)
+{
+    st->type = S_ISDIR(nst->nfs_mode) ? ST_DIR : ST_FILE;
+    st->mode = nst->nfs_mode & 0777;
+    st->size = nst->nfs_size;
+    st->ctime_ms = nst->nfs_ctime * MS_IN_S + nst->nfs_ctime_nsec / NS_IN_MS;
+    st->atime_ms = nst->nfs_atime * MS_IN_S + nst->nfs_atime_nsec / NS_IN_MS;
+}
+
+/* Write back and close a file handle */
+static int close_fh(struct nfs_context *nfs, struct nfsfh *fh)
+{
+    int err = page_cache_close(fh);
+
+    nfs_fs_call_t call = { .co = coroutine_current() };
+    int close_err = call_wait(&call, nfs_close_async(nfs, fh, call_cb, &call));
+    return err != 0 ? err : close_err;
+}
+
+/* Start caching a handle that has just been opened, closing it on failure */
+static int cache_open(struct nfs_context *nfs, nfs_vnode_t *nv, bool created)
+{
+    struct nfs_stat_64 nst = { .nfs_size = 0 };
+    int err = 0;
+    if (!created) {
+        nfs_fs_call_t call = { .co = coroutine_current(), .st = &nst };
+        err = call_wait(&call, nfs_fstat64_async(nfs, nv->fh, call_cb, &call));
+    }
+    if (err == 0) {
+        err = page_cache_open(nv->fh, nst.nfs_size);
+    }
+    if (err != 0) {
+        close_fh(nfs, nv->fh);
+        nv->fh = NULL;
+    }
+    return err;
+}
+
+static int nfs_fs_lookup(UNUSED vfs_t *fs, const char *path, int flags, vnode_t *vn)
+{
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+
+    nfs_vnode_t *nv = calloc(1, sizeof(*nv));
+    if (nv == NULL) {
+        return -ENOMEM;
+    }
+    nv->path = strdup(path);
+    if (nv->path == NULL) {
+        free(nv);
+        return -ENOMEM;
+    }
+
+    struct nfs_stat_64 nst;
+    int err = nfs_cache_stat(nfs, nfs_path(nv), &nst);
+    if (err == -ENOENT && (flags & VFS_O_CREATE)) {
+        nfs_fs_call_t call = { .co = coroutine_current() };
+        err = call_wait(&call, nfs_creat_async(nfs, nv->path, 0666, call_cb, &call));
+        if (err == 0) {
+            nv->fh = call.fh;
+            nv->writable = true;
+            err = cache_open(nfs, nv, true);
+        }
+        nfs_cache_invalidate(nv->path);
+    }
+    if (err != 0) {
+        free(nv->path);
+        free(nv);
+        return err;
+    }
+
+    vn->data = nv;
+    return 0;
+}
+
+static int nfs_fs_open(vnode_t *vn, int flags)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+
+    bool write = (flags & VFS_O_WRITE) != 0;
+    if (nv->fh != NULL && (nv->writable || !write)) {
+        return 0;
+    }
+
+    nfs_fs_call_t call = { .co = coroutine_current() };
+    int err = call_wait(&call, nfs_open_async(nfs, nfs_path(nv), write ? O_RDWR : O_RDONLY,
+                                              call_cb, &call));
+    if (err != 0) {
+        return err;
+    }
+    if (nv->fh != NULL && (nv->writable || !write)) {
+        /* Another open got there while this one waited */
+        return close_fh(nfs, call.fh);
+    }
+
+    /* A read-only handle is upgraded by replacing it. It never had
+     * anything written through it, so there is nothing to write back. */
+    struct nfsfh *old_fh = nv->fh;
+    nv->fh = call.fh;
+    nv->writable = write;
+    err = cache_open(nfs, nv, false);
+    if (err != 0) {
+        nv->fh = old_fh;
+        nv->writable = false;
+        return err;
+    }
+    if (old_fh != NULL) {
+        if (vn->opens == 0) {
+            close_fh(nfs, old_fh);
+        } else {
+            assert(nv->old_fh == NULL);
+            nv->old_fh = old_fh;
+        }
+    }
+    return 0;
+}
+
+static ssize_t nfs_fs_read(vnode_t *vn, uint64_t offset, void *buf, size_t count)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+    return page_cache_read(nfs, nv->fh, offset, buf, count);
+}
+
+static ssize_t nfs_fs_write(vnode_t *vn, uint64_t offset, const void *buf, size_t count)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+
+    ssize_t ret = page_cache_write(nfs, nv->fh, offset, buf, count);
+    if (ret > 0) {
+        nv->written = true;
+    }
+    return ret;
+}
+
+static int nfs_fs_stat(vnode_t *vn, vfs_stat_t *st)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+
+    struct nfs_stat_64 nst;
+    int err = nfs_cache_stat(nfs, nfs_path(nv), &nst);
+    if (err == 0) {
+        stat_convert(&nst, st);
+    }
+
+    /* While the file is open, the page cache knows its size better than
+     * the server, which has not seen the writes still cached */
+    uint64_t size;
+    if (err == 0 && nv->fh != NULL && page_cache_size(nv->fh, &size) == 0) {
+        st->size = size;
+    }
+    return err;
+}
+
+static ssize_t nfs_fs_getdirent(vnode_t *vn, size_t pos, char *name, size_t nbyte,
+                                vfs_stat_t *st)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        return -EIO;
+    }
+
+    struct nfs_stat_64 nst;
+    ssize_t ret = nfs_cache_getdirent(nfs, nv->path, pos, name, nbyte, st != NULL ? &nst : NULL);
+    if (ret > 0 && st != NULL) {
+        stat_convert(&nst, st);
+    }
+    return ret;
+}
+
+static int nfs_fs_close(vnode_t *vn, UNUSED int flags)
+{
+    nfs_vnode_t *nv = vn->data;
+
+    /* Close-to-open consistency: other clients see the data once it is closed */
+    int err = nv->fh != NULL ? page_cache_flush(nv->fh) : 0;
+
+    /* Once the last file is closed, nothing can still be using a handle
+     * that was replaced */
+    struct nfs_context *nfs = network_nfs();
+    if (vn->opens == 1 && nv->old_fh != NULL && nfs != NULL) {
+        close_fh(nfs, nv->old_fh);
+        nv->old_fh = NULL;
+    }
+    if (nv->written) {
+        nfs_cache_invalidate(nv->path);
+        nv->written = false;
+    }
+    return err;
+}
+
+static void nfs_fs_reclaim(vnode_t *vn)
+{
+    nfs_vnode_t *nv = vn->data;
+    struct nfs_context *nfs = network_nfs();
+
+    if (nv->fh != NULL && nfs != NULL) {
+        int err = close_fh(nfs, nv->fh);
+        if (err != 0) {
+            ZF_LOGE("Failed to close %s: %d", nv->path, err);
+        }
+    }
+    if (nv->old_fh != NULL && nfs != NULL) {
+        close_fh(nfs, nv->old_fh);
+    }
+    free(nv->path);
+    free(nv);
+}
+
+const vnode_ops_t nfs_fs_ops = {
+    .lookup = nfs_fs_lookup,
+    .open = nfs_fs_open,
+    .read = nfs_fs_read,
+    .write = nfs_fs_write,
+    .stat = nfs_fs_stat,
+    .getdirent = nfs_fs_getdirent,
+    .close = nfs_fs_close,
+    .reclaim = nfs_fs_reclaim,
+};
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The NFS filesystem, for mounting in the VFS (see vfs.h).
+ *
+ * File data goes through the page cache, and attributes and directory
+ * listings through the NFS cache. A vnode keeps its NFS file handle open
+ * after the last close, so that opening the file again needs no LOOKUP;
+ * the handle is closed when the VFS reclaims the vnode.
+ *
+ * The size of an open file comes from the page cache, so stat sees writes
+ * that are still cached. Cached attributes of a written file are dropped
+ * once, when it is closed.
+ *
+ * Until the NFS mount made by network_init() completes, every operation
+ * fails with -EIO.
+ */
+
+#include "vfs.h"
+
+extern const vnode_ops_t nfs_fs_ops;
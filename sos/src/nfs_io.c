@@ -0,0 +1,208 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "nfs_io.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <nfsc/libnfs.h>
+#include <sos/gen_config.h>
+
+#include "coroutine.h"
+
+#define NFS_IO_WINDOW CONFIG_SOS_NFS_WINDOW
+
+typedef struct nfs_io nfs_io_t;
+
+/* One RPC in flight */
+typedef struct {
+    nfs_io_t *io;
+    /* Offset of the chunk in the caller's buffer, and its length. A length
+     * of 0 means the slot is free. */
+    size_t start;
+    size_t len;
+} nfs_io_chunk_t;
+
+struct nfs_io {
+    /* The coroutine waiting for the transfer */
+    coroutine_t *co;
+    struct nfs_context *nfs;
+    struct nfsfh *fh;
+    bool write;
+    /* File offset of the start of buf */
+    uint64_t offset;
+    char *buf;
+    /* Largest chunk the server accepts in one RPC */
+    size_t chunk_size;
+    /* Offset in buf of the next chunk to send */
+    size_t next;
+    /* Bytes transferred, as far as is known. Lowered when a chunk comes
+     * back short, as nothing after it can be part of the result. */
+    size_t end;
+    /* First error reported by any chunk */
+    int error;
+    unsigned int in_flight;
+    nfs_io_chunk_t chunks[NFS_IO_WINDOW];
+};
+
+static int libnfs_pread_async(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                              uint64_t count, nfs_cb cb, void *private_data)
+{
+    return nfs_pread_async(nfs, fh, offset, count, cb, private_data);
+}
+
+static int libnfs_pwrite_async(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                               uint64_t count, char *buf, nfs_cb cb, void *private_data)
+{
+    return nfs_pwrite_async(nfs, fh, offset, count, buf, cb, private_data);
+}
+
+static uint64_t libnfs_readmax(struct nfs_context *nfs)
+{
+    return nfs_get_readmax(nfs);
+}
+
+static uint64_t libnfs_writemax(struct nfs_context *nfs)
+{
+    return nfs_get_writemax(nfs);
+}
+
+static const nfs_io_ops_t libnfs_ops = {
+    .pread_async = libnfs_pread_async,
+    .pwrite_async = libnfs_pwrite_async,
+    .readmax = libnfs_readmax,
+    .writemax = libnfs_writemax,
+};
+
+static const nfs_io_ops_t *ops = &libnfs_ops;
+
+static void nfs_io_cb(int status, UNUSED struct nfs_context *nfs, void *data, void *private_data)
+{
+    nfs_io_chunk_t *chunk = private_data;
+    nfs_io_t *io = chunk->io;
+
+    if (status < 0) {
+        ZF_LOGE("NFS %s failed: %s", io->write ? "write" : "read", (char *) data);
+        if (io->error == 0) {
+            io->error = status;
+        }
+    } else {
+        size_t done = MIN((size_t) status, chunk->len);
+        if (!io->write) {
+            memcpy(io->buf + chunk->start, data, done);
+        }
+        if (done < chunk->len) {
+            io->end = MIN(io->end, chunk->start + done);
+        }
+    }
+
+    chunk->len = 0;
+    io->in_flight--;
+    coroutine_wakeup(io->co);
+}
+
+/* Send the next chunk in a free slot */
+static int nfs_io_send(nfs_io_t *io)
+{
+    nfs_io_chunk_t *chunk = NULL;
+    for (int i = 0; i < NFS_IO_WINDOW && chunk == NULL; i++) {
+        if (io->chunks[i].len == 0) {
+            chunk = &io->chunks[i];
+        }
+    }
+    assert(chunk != NULL);
+
+    chunk->io = io;
+    chunk->start = io->next;
+    chunk->len = MIN(io->chunk_size, io->end - io->next);
+
+    int err;
+    if (io->write) {
+        err = ops->pwrite_async(io->nfs, io->fh, io->offset + chunk->start, chunk->len,
+                                io->buf + chunk->start, nfs_io_cb, chunk);
+    } else {
+        err = ops->pread_async(io->nfs, io->fh, io->offset + chunk->start, chunk->len,
+                               nfs_io_cb, chunk);
+    }
+    if (err != 0) {
+        ZF_LOGE("Failed to send NFS %s: %s", io->write ? "write" : "read", nfs_get_error(io->nfs));
+        chunk->len = 0;
+        return err;
+    }
+
+    io->next += chunk->len;
+    io->in_flight++;
+    return 0;
+}
+
+static ssize_t nfs_io_run(nfs_io_t *io)
+{
+    io->co = coroutine_current();
+    ZF_LOGF_IF(io->co == NULL, "NFS I/O must be called from a coroutine");
+
+    if (io->chunk_size == 0) {
+        return -1;
+    }
+
+    while (true) {
+        /* Keep the window full until everything has been sent */
+        while (io->in_flight < NFS_IO_WINDOW && io->next < io->end && io->error == 0) {
+            int err = nfs_io_send(io);
+            if (err != 0 && io->error == 0) {
+                io->error = err;
+            }
+        }
+        if (io->in_flight == 0) {
+            break;
+        }
+        coroutine_wait();
+    }
+
+    return io->error != 0 ? io->error : (ssize_t) io->end;
+}
+
+ssize_t nfs_io_pread(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset, void *buf,
+                     size_t count)
+{
+    nfs_io_t io = {
+        .nfs = nfs,
+        .fh = fh,
+        .write = false,
+        .offset = offset,
+        .buf = buf,
+        .chunk_size = ops->readmax(nfs),
+        .end = count,
+    };
+    return nfs_io_run(&io);
+}
+
+ssize_t nfs_io_pwrite(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                      const void *buf, size_t count)
+{
+    nfs_io_t io = {
+        .nfs = nfs,
+        .fh = fh,
+        .write = true,
+        .offset = offset,
+        .buf = (char *) buf,
+        .chunk_size = ops->writemax(nfs),
+        .end = count,
+    };
+    return nfs_io_run(&io);
+}
+
+void nfs_io_set_ops(const nfs_io_ops_t *new_ops)
+{
+    ops = new_ops != NULL ? new_ops : &libnfs_ops;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Pipelined reads and writes of NFS files.
+ *
+ * A transfer is split into chunks of at most the server's rsize or wsize,
+ * and up to CONFIG_SOS_NFS_WINDOW chunks are kept in flight at once, so a
+ * large transfer costs roughly one round trip per window rather than one
+ * per chunk. Chunks may complete in any order; each is copied to its place
+ * in the caller's buffer as it arrives.
+ *
+ * These block the calling coroutine until the whole transfer has finished,
+ * so must be called from a coroutine (see coroutine.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <nfsc/libnfs.h>
+
+/*
+ * Read up to count bytes at offset into buf.
+ *
+ * @return  the number of bytes read, which is less than count only at the
+ *          end of the file, or a negative error from libnfs.
+ */
+ssize_t nfs_io_pread(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset, void *buf,
+                     size_t count);
+
+/*
+ * Write count bytes from buf at offset.
+ *
+ * @return  the number of bytes written, or a negative error from libnfs.
+ */
+ssize_t nfs_io_pwrite(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                      const void *buf, size_t count);
+
+/*
+ * The libnfs calls a transfer is made with, so that a test can complete
+ * chunks without a server.
+ */
+typedef struct {
+    /* As nfs_pread_async() and nfs_pwrite_async() */
+    int (*pread_async)(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset, uint64_t count,
+                       nfs_cb cb, void *private_data);
+    int (*pwrite_async)(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                        uint64_t count, char *buf, nfs_cb cb, void *private_data);
+    /* As nfs_get_readmax() and nfs_get_writemax() */
+    uint64_t (*readmax)(struct nfs_context *nfs);
+    uint64_t (*writemax)(struct nfs_context *nfs);
+} nfs_io_ops_t;
+
+/*
+ * Make later transfers with ops, or with libnfs itself if ops is NULL.
+ */
+void nfs_io_set_ops(const nfs_io_ops_t *ops);
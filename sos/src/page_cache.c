@@ -0,0 +1,899 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "page_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <utils/time.h>
+#include <aos/sel4_zf_logif.h>
+#include <clock/clock.h>
+#include <nfsc/libnfs.h>
+#include <sos/gen_config.h>
+
+#include "coroutine.h"
+#include "frame_table.h"
+#include "nfs_io.h"
+#include "timer_thread.h"
+
+#define PAGE_CACHE_PAGES        CONFIG_SOS_PAGE_CACHE_PAGES
+#define PAGE_CACHE_WRITEBACK_US (CONFIG_SOS_PAGE_CACHE_WRITEBACK_MS * US_IN_MS)
+/* The write-back timer can fire late, so it can share an interrupt */
+#define PAGE_CACHE_WRITEBACK_SLACK_US (PAGE_CACHE_WRITEBACK_US / 4)
+
+/* Most pages fetched or written back by one pipelined transfer */
+#define PAGE_CACHE_MAX_RUN      64
+#define PAGE_CACHE_BUCKETS      1024
+
+/* Read-ahead windows start at this many pages and double up to the
+ * configured limit, which is kept to a quarter of the cache */
+#define READ_AHEAD_MIN          4
+#define READ_AHEAD_MAX          MIN(CONFIG_SOS_READ_AHEAD_PAGES, PAGE_CACHE_PAGES / 4)
+
+typedef struct page page_t;
+struct page {
+    struct nfs_context *nfs;
+    struct nfsfh *fh;
+    uint64_t index;
+    frame_ref_t frame;
+    /* Bytes of the page that hold file data. Less than a full page only in
+     * the last page of the file, or one the server returned short. The rest
+     * of the page is zero. */
+    size_t valid;
+    /* Modified since it was last written back */
+    bool dirty;
+    /* Being read from or written to the server. Nothing else may touch the
+     * page until this is cleared. */
+    bool busy;
+    page_t *hash_next;
+    page_t *lru_prev;
+    page_t *lru_next;
+};
+
+/* An open file: its size and access pattern */
+typedef struct file_state file_state_t;
+struct file_state {
+    struct nfsfh *fh;
+    /* As on the server when opened, and grown by writes since */
+    uint64_t size;
+    /* The page after the last one read */
+    uint64_t ra_expected;
+    /* The last window read ahead, or none if ra_size is 0. Reaching its
+     * first page triggers the next window. */
+    uint64_t ra_start;
+    size_t ra_size;
+    /* Bytes written by consecutive writes since the run was last sent */
+    uint64_t wc_start;
+    uint64_t wc_end;
+    file_state_t *next;
+};
+
+/* A read-ahead or write-behind RPC in flight for a run of busy pages */
+typedef struct {
+    /* Bytes being written, copied from the pages */
+    char *data;
+    size_t len;
+    size_t n;
+    page_t *pages[];
+} page_chunk_t;
+
+static struct {
+    page_t *buckets[PAGE_CACHE_BUCKETS];
+    /* Every page, most recently used first */
+    page_t *lru_head;
+    page_t *lru_tail;
+    size_t n_pages;
+    size_t n_dirty;
+    /* Coroutines waiting for a busy page */
+    coroutine_t *waiters[CONFIG_SOS_COROUTINE_POOL_SIZE];
+    size_t n_waiters;
+    coroutine_t *writeback_co;
+    file_state_t *files;
+} cache;
+
+static page_t **bucket_of(struct nfsfh *fh, uint64_t index)
+{
+    /* Consecutive pages of a file fall in consecutive buckets */
+    return &cache.buckets[((uintptr_t) fh / sizeof(void *) + index) % PAGE_CACHE_BUCKETS];
+}
+
+static page_t *lookup(struct nfsfh *fh, uint64_t index)
+{
+    for (page_t *page = *bucket_of(fh, index); page != NULL; page = page->hash_next) {
+        if (page->fh == fh && page->index == index) {
+            return page;
+        }
+    }
+    return NULL;
+}
+
+static void lru_remove(page_t *page)
+{
+    if (page->lru_prev != NULL) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        cache.lru_head = page->lru_next;
+    }
+    if (page->lru_next != NULL) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        cache.lru_tail = page->lru_prev;
+    }
+}
+
+static void lru_push(page_t *page)
+{
+    page->lru_prev = NULL;
+    page->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL) {
+        cache.lru_head->lru_prev = page;
+    } else {
+        cache.lru_tail = page;
+    }
+    cache.lru_head = page;
+}
+
+static void lru_touch(page_t *page)
+{
+    if (cache.lru_head != page) {
+        lru_remove(page);
+        lru_push(page);
+    }
+}
+
+/* Block until some page stops being busy. The caller must look its page up
+ * again afterwards, as it may have been evicted. */
+static void wait_for_io(void)
+{
+    coroutine_t *co = coroutine_current();
+    bool waiting = false;
+    for (size_t i = 0; i < cache.n_waiters; i++) {
+        waiting |= cache.waiters[i] == co;
+    }
+    if (!waiting) {
+        assert(cache.n_waiters < ARRAY_SIZE(cache.waiters));
+        cache.waiters[cache.n_waiters++] = co;
+    }
+    coroutine_wait();
+}
+
+static void wake_waiters(void)
+{
+    for (size_t i = 0; i < cache.n_waiters; i++) {
+        coroutine_wakeup(cache.waiters[i]);
+    }
+    cache.n_waiters = 0;
+}
+
+static void set_dirty(page_t *page, bool dirty)
+{
+    if (page->dirty != dirty) {
+        page->dirty = dirty;
+        if (dirty) {
+            cache.n_dirty++;
+        } else {
+            cache.n_dirty--;
+        }
+    }
+}
+
+static void page_free(page_t *page)
+{
+    assert(!page->busy);
+    set_dirty(page, false);
+
+    page_t **prev = bucket_of(page->fh, page->index);
+    while (*prev != page) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = page->hash_next;
+    lru_remove(page);
+
+    free_frame(page->frame);
+    free(page);
+    cache.n_pages--;
+}
+
+/*
+ * Write back a run of consecutive dirty pages of a file, starting before
+ * page if the pages before it are dirty too. Every page in the run but the
+ * last is full, so the run is contiguous in the file.
+ */
+static int write_back_run(page_t *page)
+{
+    page_t *pages[PAGE_CACHE_MAX_RUN];
+    struct nfsfh *fh = page->fh;
+
+    uint64_t first = page->index;
+    while (first > 0 && page->index - first < PAGE_CACHE_MAX_RUN - 1) {
+        page_t *prev = lookup(fh, first - 1);
+        if (prev == NULL || !prev->dirty || prev->busy || prev->valid != PAGE_SIZE_4K) {
+            break;
+        }
+        first--;
+    }
+
+    size_t n = 0;
+    for (uint64_t index = first; n < PAGE_CACHE_MAX_RUN; index++) {
+        page_t *next = lookup(fh, index);
+        if (next == NULL || !next->dirty || next->busy) {
+            break;
+        }
+        pages[n++] = next;
+        if (next->valid != PAGE_SIZE_4K) {
+            break;
+        }
+    }
+    assert(n > 0);
+
+    /* A single page is written straight from its frame */
+    char *data = NULL;
+    if (n > 1) {
+        data = malloc(n * PAGE_SIZE_4K);
+        if (data == NULL) {
+            n = 1;
+        }
+    }
+    size_t len = (n - 1) * PAGE_SIZE_4K + pages[n - 1]->valid;
+
+    for (size_t i = 0; i < n; i++) {
+        pages[i]->busy = true;
+        set_dirty(pages[i], false);
+        if (data != NULL) {
+            memcpy(data + i * PAGE_SIZE_4K, frame_data(pages[i]->frame), pages[i]->valid);
+        }
+    }
+
+    ssize_t written = nfs_io_pwrite(pages[0]->nfs, fh, first * PAGE_SIZE_4K,
+                                    data != NULL ? data : (char *) frame_data(pages[0]->frame), len);
+    int err = 0;
+    if (written < 0 || (size_t) written < len) {
+        ZF_LOGE("Failed to write back %zu pages at page %lu", n, first);
+        err = written < 0 ? written : -EIO;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pages[i]->busy = false;
+        if (err != 0) {
+            set_dirty(pages[i], true);
+        }
+    }
+    free(data);
+    wake_waiters();
+    return err;
+}
+
+/* Drop the least recently used clean page. Never blocks. */
+static bool evict_clean(void)
+{
+    for (page_t *page = cache.lru_tail; page != NULL; page = page->lru_prev) {
+        if (!page->busy && !page->dirty) {
+            page_free(page);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Make room for a page, by dropping a clean page or writing back a dirty
+ * one. Returns false if no page could be freed. */
+static bool evict_one(void)
+{
+    if (evict_clean()) {
+        return true;
+    }
+    for (page_t *page = cache.lru_tail; page != NULL; page = page->lru_prev) {
+        if (!page->busy && page->dirty) {
+            return write_back_run(page) == 0;
+        }
+    }
+    return false;
+}
+
+/*
+ * Add a busy page to the cache, evicting others to make room if needed.
+ * Unless may_block is set, only clean pages are evicted.
+ * Returns NULL with -ENOMEM if there is no memory, or with -EAGAIN if
+ * another coroutine added the page while this one waited.
+ */
+static page_t *page_new(struct nfs_context *nfs, struct nfsfh *fh, uint64_t index, bool may_block,
+                        int *err)
+{
+    bool (*evict)(void) = may_block ? evict_one : evict_clean;
+
+    while (cache.n_pages >= PAGE_CACHE_PAGES) {
+        if (!evict()) {
+            *err = -ENOMEM;
+            return NULL;
+        }
+    }
+
+    frame_ref_t frame = alloc_frame();
+    while (frame == NULL_FRAME) {
+        if (!evict()) {
+            *err = -ENOMEM;
+            return NULL;
+        }
+        frame = alloc_frame();
+    }
+
+    if (lookup(fh, index) != NULL) {
+        free_frame(frame);
+        *err = -EAGAIN;
+        return NULL;
+    }
+
+    page_t *page = malloc(sizeof(*page));
+    if (page == NULL) {
+        free_frame(frame);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    *page = (page_t) {
+        .nfs = nfs,
+        .fh = fh,
+        .index = index,
+        .frame = frame,
+        .busy = true,
+    };
+    page_t **bucket = bucket_of(fh, index);
+    page->hash_next = *bucket;
+    *bucket = page;
+    lru_push(page);
+    cache.n_pages++;
+    return page;
+}
+
+/* Set the contents of a page read from the server, from len bytes of data */
+static void page_fill(page_t *page, const char *data, size_t len)
+{
+    unsigned char *frame = frame_data(page->frame);
+    page->valid = MIN(len, PAGE_SIZE_4K);
+    if (data != (char *) frame) {
+        memcpy(frame, data, page->valid);
+    }
+    memset(frame + page->valid, 0, PAGE_SIZE_4K - page->valid);
+    page->busy = false;
+}
+
+/* Read the contents of a run of consecutive busy pages from the server.
+ * The pages are dropped if the read fails. */
+static int fill_run(page_t *pages[], size_t n)
+{
+    struct nfsfh *fh = pages[0]->fh;
+    uint64_t first = pages[0]->index;
+
+    char *data = n > 1 ? malloc(n * PAGE_SIZE_4K) : (char *) frame_data(pages[0]->frame);
+    ssize_t got = data != NULL ? nfs_io_pread(pages[0]->nfs, fh, first * PAGE_SIZE_4K, data,
+                                              n * PAGE_SIZE_4K) : -ENOMEM;
+
+    for (size_t i = 0; i < n; i++) {
+        if (got < 0) {
+            pages[i]->busy = false;
+            page_free(pages[i]);
+            continue;
+        }
+        size_t start = i * PAGE_SIZE_4K;
+        page_fill(pages[i], data + start, (size_t) got > start ? (size_t) got - start : 0);
+    }
+
+    if (n > 1) {
+        free(data);
+    }
+    wake_waiters();
+    return got < 0 ? got : 0;
+}
+
+/* Add and read in the pages from first that are not cached, up to max of
+ * them and stopping at the first that is. */
+static int fill_missing(struct nfs_context *nfs, struct nfsfh *fh, uint64_t first, size_t max)
+{
+    page_t *pages[PAGE_CACHE_MAX_RUN];
+    size_t n = 0;
+
+    max = MIN(max, (size_t) PAGE_CACHE_MAX_RUN);
+    while (n < max && lookup(fh, first + n) == NULL) {
+        int err;
+        page_t *page = page_new(nfs, fh, first + n, true, &err);
+        if (page == NULL) {
+            if (n == 0) {
+                return err;
+            }
+            break;
+        }
+        pages[n++] = page;
+    }
+
+    return n > 0 ? fill_run(pages, n) : 0;
+}
+
+static void read_ahead_cb(int status, UNUSED struct nfs_context *nfs, void *data,
+                          void *private_data)
+{
+    page_chunk_t *chunk = private_data;
+
+    if (status < 0) {
+        ZF_LOGD("Read-ahead failed: %s", (char *) data);
+    }
+    for (size_t i = 0; i < chunk->n; i++) {
+        if (status < 0) {
+            chunk->pages[i]->busy = false;
+            page_free(chunk->pages[i]);
+            continue;
+        }
+        size_t start = i * PAGE_SIZE_4K;
+        page_fill(chunk->pages[i], (char *) data + start,
+                  (size_t) status > start ? (size_t) status - start : 0);
+    }
+
+    free(chunk);
+    wake_waiters();
+}
+
+/*
+ * Start reading n pages from start into the cache without waiting for them,
+ * skipping pages that are already cached. Only clean pages are evicted to
+ * make room; read-ahead stops early rather than block.
+ */
+static void read_ahead(struct nfs_context *nfs, struct nfsfh *fh, uint64_t start, size_t n)
+{
+    size_t chunk_pages = MIN(nfs_get_readmax(nfs) / PAGE_SIZE_4K, (size_t) PAGE_CACHE_MAX_RUN);
+    if (chunk_pages == 0) {
+        return;
+    }
+
+    uint64_t index = start;
+    while (index < start + n) {
+        if (lookup(fh, index) != NULL) {
+            index++;
+            continue;
+        }
+
+        page_chunk_t *chunk = malloc(sizeof(*chunk) + chunk_pages * sizeof(page_t *));
+        if (chunk == NULL) {
+            return;
+        }
+        chunk->n = 0;
+        uint64_t first = index;
+        while (chunk->n < chunk_pages && index < start + n && lookup(fh, index) == NULL) {
+            int err;
+            page_t *page = page_new(nfs, fh, index, false, &err);
+            if (page == NULL) {
+                break;
+            }
+            chunk->pages[chunk->n++] = page;
+            index++;
+        }
+
+        int err = chunk->n > 0 ? nfs_pread_async(nfs, fh, first * PAGE_SIZE_4K,
+                                                 chunk->n * PAGE_SIZE_4K, read_ahead_cb, chunk) : -1;
+        if (err != 0) {
+            /* Out of memory, or the RPC could not be sent */
+            for (size_t i = 0; i < chunk->n; i++) {
+                chunk->pages[i]->busy = false;
+                page_free(chunk->pages[i]);
+            }
+            free(chunk);
+            return;
+        }
+    }
+}
+
+/* The state of a file, or NULL if it was not opened with page_cache_open() */
+static file_state_t *file_state(struct nfsfh *fh)
+{
+    for (file_state_t *file = cache.files; file != NULL; file = file->next) {
+        if (file->fh == fh) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Record a read of pages first to last of a file, and read ahead if it
+ * continues a sequential stream. The window is placed after the read when a
+ * stream is detected, and each time the reader reaches a window the next
+ * one is read at twice the size. Any other access drops the window.
+ */
+static void read_ahead_update(struct nfs_context *nfs, file_state_t *file, uint64_t first,
+                              uint64_t last)
+{
+    if (READ_AHEAD_MAX == 0) {
+        return;
+    }
+
+    /* A read may carry on from within the last page read */
+    bool sequential = first == file->ra_expected || first + 1 == file->ra_expected;
+    file->ra_expected = last + 1;
+    if (!sequential) {
+        file->ra_size = 0;
+        return;
+    }
+
+    if (file->ra_size == 0) {
+        file->ra_start = last + 1;
+        file->ra_size = MIN(MAX((size_t) READ_AHEAD_MIN, 2 * (size_t) (last - first + 1)),
+                            (size_t) READ_AHEAD_MAX);
+    } else if (last >= file->ra_start) {
+        file->ra_start = MAX(file->ra_start + file->ra_size, last + 1);
+        file->ra_size = MIN(file->ra_size * 2, (size_t) READ_AHEAD_MAX);
+    } else {
+        return;
+    }
+
+    /* Nothing to read past the end of the file */
+    uint64_t end = DIV_ROUND_UP(file->size, PAGE_SIZE_4K);
+    if (file->ra_start >= end) {
+        file->ra_size = 0;
+        return;
+    }
+    read_ahead(nfs, file->fh, file->ra_start, MIN(file->ra_size, end - file->ra_start));
+}
+
+static void write_behind_done(page_chunk_t *chunk, bool failed)
+{
+    for (size_t i = 0; i < chunk->n; i++) {
+        chunk->pages[i]->busy = false;
+        if (failed) {
+            set_dirty(chunk->pages[i], true);
+        }
+    }
+    free(chunk->data);
+    free(chunk);
+    wake_waiters();
+}
+
+static void write_behind_cb(int status, UNUSED struct nfs_context *nfs, void *data,
+                            void *private_data)
+{
+    page_chunk_t *chunk = private_data;
+
+    bool failed = status < 0 || (size_t) status < chunk->len;
+    if (failed) {
+        ZF_LOGE("Write-behind failed: %s", status < 0 ? (char *) data : "short write");
+    }
+    write_behind_done(chunk, failed);
+}
+
+/*
+ * Start writing back the dirty pages of a file from first up to end without
+ * waiting for them, in RPCs of at most wsize. Pages that cannot be sent now
+ * stay dirty for the write-back timer.
+ */
+static void write_behind(struct nfs_context *nfs, struct nfsfh *fh, uint64_t first, uint64_t end)
+{
+    size_t chunk_pages = MIN(nfs_get_writemax(nfs) / PAGE_SIZE_4K, (size_t) PAGE_CACHE_MAX_RUN);
+    if (chunk_pages == 0) {
+        return;
+    }
+
+    uint64_t index = first;
+    while (index < end) {
+        page_t *page = lookup(fh, index);
+        if (page == NULL || !page->dirty || page->busy) {
+            index++;
+            continue;
+        }
+
+        page_chunk_t *chunk = malloc(sizeof(*chunk) + chunk_pages * sizeof(page_t *));
+        char *data = malloc(chunk_pages * PAGE_SIZE_4K);
+        if (chunk == NULL || data == NULL) {
+            free(chunk);
+            free(data);
+            return;
+        }
+        chunk->data = data;
+        chunk->len = 0;
+        chunk->n = 0;
+
+        /* Every page but the last of a run is full, so the run is contiguous */
+        uint64_t start = index;
+        while (chunk->n < chunk_pages && index < end) {
+            page = lookup(fh, index);
+            if (page == NULL || !page->dirty || page->busy) {
+                break;
+            }
+            memcpy(data + chunk->len, frame_data(page->frame), page->valid);
+            chunk->len += page->valid;
+            page->busy = true;
+            set_dirty(page, false);
+            chunk->pages[chunk->n++] = page;
+            index++;
+            if (page->valid < PAGE_SIZE_4K) {
+                break;
+            }
+        }
+
+        int err = nfs_pwrite_async(nfs, fh, start * PAGE_SIZE_4K, chunk->len, data, write_behind_cb,
+                                   chunk);
+        if (err != 0) {
+            ZF_LOGE("Failed to send write-behind: %s", nfs_get_error(nfs));
+            write_behind_done(chunk, true);
+            return;
+        }
+    }
+}
+
+/*
+ * Record a write of bytes offset to end of a file. Consecutive writes are
+ * gathered into a run, and the run is sent as soon as it holds wsize bytes,
+ * or when a write lands somewhere else in the file. Whatever is left is
+ * sent by the write-back timer or on close.
+ */
+static void write_combine_update(struct nfs_context *nfs, file_state_t *file, uint64_t offset,
+                                 uint64_t end)
+{
+    struct nfsfh *fh = file->fh;
+
+    if (offset != file->wc_end) {
+        if (file->wc_end > file->wc_start) {
+            write_behind(nfs, fh, file->wc_start / PAGE_SIZE_4K,
+                         DIV_ROUND_UP(file->wc_end, PAGE_SIZE_4K));
+        }
+        file->wc_start = offset;
+    }
+    file->wc_end = end;
+
+    uint64_t wsize = nfs_get_writemax(nfs);
+    uint64_t full = file->wc_end / PAGE_SIZE_4K;
+    if (wsize > 0 && file->wc_end - file->wc_start >= wsize &&
+        full * PAGE_SIZE_4K > file->wc_start) {
+        /* Keep a partial last page back, as the next write will likely fill it */
+        write_behind(nfs, fh, file->wc_start / PAGE_SIZE_4K, full);
+        file->wc_start = full * PAGE_SIZE_4K;
+    }
+}
+
+/* Grow a file to end bytes. The page that held the old end of the file is
+ * followed by more of the file now, so all of it is file data. */
+static void file_extend(file_state_t *file, uint64_t end)
+{
+    if (end <= file->size) {
+        return;
+    }
+    uint64_t last = file->size / PAGE_SIZE_4K;
+    if (file->size % PAGE_SIZE_4K != 0 && end / PAGE_SIZE_4K > last) {
+        page_t *page = lookup(file->fh, last);
+        if (page != NULL) {
+            page->valid = PAGE_SIZE_4K;
+        }
+    }
+    file->size = end;
+}
+
+int page_cache_open(struct nfsfh *fh, uint64_t size)
+{
+    file_state_t *file = file_state(fh);
+    if (file == NULL) {
+        file = calloc(1, sizeof(*file));
+        if (file == NULL) {
+            return -ENOMEM;
+        }
+        file->fh = fh;
+        file->next = cache.files;
+        cache.files = file;
+    }
+    file->size = size;
+    return 0;
+}
+
+ssize_t page_cache_read(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset, void *buf,
+                        size_t count)
+{
+    file_state_t *file = file_state(fh);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    if (offset >= file->size || count == 0) {
+        return 0;
+    }
+    count = MIN(count, file->size - offset);
+    read_ahead_update(nfs, file, offset / PAGE_SIZE_4K, (offset + count - 1) / PAGE_SIZE_4K);
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (offset + done) / PAGE_SIZE_4K;
+        size_t page_offset = (offset + done) % PAGE_SIZE_4K;
+
+        page_t *page = lookup(fh, index);
+        if (page != NULL && page->busy) {
+            wait_for_io();
+            continue;
+        }
+        if (page == NULL) {
+            uint64_t last = (offset + count - 1) / PAGE_SIZE_4K;
+            int err = fill_missing(nfs, fh, index, last - index + 1);
+            if (err != 0 && err != -EAGAIN) {
+                return done > 0 ? (ssize_t) done : err;
+            }
+            continue;
+        }
+
+        /* Past the valid bytes the page is zero, which is what the file
+         * holds there if it has since been extended */
+        lru_touch(page);
+        size_t len = MIN(PAGE_SIZE_4K - page_offset, count - done);
+        memcpy((char *) buf + done, frame_data(page->frame) + page_offset, len);
+        done += len;
+    }
+    return done;
+}
+
+ssize_t page_cache_write(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                         const void *buf, size_t count)
+{
+    file_state_t *file = file_state(fh);
+    if (file == NULL) {
+        return -EBADF;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (offset + done) / PAGE_SIZE_4K;
+        size_t page_offset = (offset + done) % PAGE_SIZE_4K;
+        size_t len = MIN(PAGE_SIZE_4K - page_offset, count - done);
+
+        page_t *page = lookup(fh, index);
+        if (page != NULL && page->busy) {
+            wait_for_io();
+            continue;
+        }
+        if (page == NULL) {
+            int err;
+            page = page_new(nfs, fh, index, true, &err);
+            if (page == NULL && err != -EAGAIN) {
+                return done > 0 ? (ssize_t) done : err;
+            }
+            if (page == NULL) {
+                continue;
+            }
+            if (len < PAGE_SIZE_4K && index * PAGE_SIZE_4K < file->size) {
+                /* The rest of the page has to come from the server */
+                err = fill_run(&page, 1);
+                if (err != 0) {
+                    return done > 0 ? (ssize_t) done : err;
+                }
+                continue;
+            }
+            /* The whole page is overwritten, or is past the end of the file
+             * and so zero, and nothing needs to be read */
+            if (len < PAGE_SIZE_4K) {
+                memset(frame_data(page->frame), 0, PAGE_SIZE_4K);
+            }
+            page->busy = false;
+        }
+
+        lru_touch(page);
+        memcpy(frame_data(page->frame) + page_offset, (const char *) buf + done, len);
+        page->valid = MAX(page->valid, page_offset + len);
+        set_dirty(page, true);
+        done += len;
+    }
+
+    if (done > 0) {
+        file_extend(file, offset + done);
+        write_combine_update(nfs, file, offset, offset + done);
+    }
+    return done;
+}
+
+int page_cache_size(struct nfsfh *fh, uint64_t *size)
+{
+    file_state_t *file = file_state(fh);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    *size = file->size;
+    return 0;
+}
+
+int page_cache_flush(struct nfsfh *fh)
+{
+    while (cache.n_dirty > 0) {
+        page_t *page;
+        for (page = cache.lru_head; page != NULL; page = page->lru_next) {
+            if (page->dirty && (fh == NULL || page->fh == fh)) {
+                break;
+            }
+        }
+        if (page == NULL) {
+            break;
+        }
+        if (page->busy) {
+            wait_for_io();
+            continue;
+        }
+
+        int err = write_back_run(page);
+        if (err != 0) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+int page_cache_close(struct nfsfh *fh)
+{
+    int err = page_cache_flush(fh);
+
+    page_t *page = cache.lru_head;
+    while (page != NULL) {
+        page_t *next = page->lru_next;
+        if (page->fh == fh) {
+            if (page->busy) {
+                /* Wait for the I/O, then start again as the list may have changed */
+                wait_for_io();
+                next = cache.lru_head;
+            } else {
+                page_free(page);
+            }
+        }
+        page = next;
+    }
+
+    for (file_state_t **file = &cache.files; *file != NULL; file = &(*file)->next) {
+        if ((*file)->fh == fh) {
+            file_state_t *found = *file;
+            *file = found->next;
+            free(found);
+            break;
+        }
+    }
+    return err;
+}
+
+size_t page_cache_reclaim(size_t pages)
+{
+    size_t freed = 0;
+    page_t *page = cache.lru_tail;
+    while (page != NULL && freed < pages) {
+        page_t *prev = page->lru_prev;
+        if (!page->busy && !page->dirty) {
+            page_free(page);
+            freed++;
+        }
+        page = prev;
+    }
+    return freed;
+}
+
+static void writeback_timer(UNUSED uint32_t id, UNUSED void *data)
+{
+    timer_callback_wakeup(cache.writeback_co);
+}
+
+static void writeback_coroutine(UNUSED void *arg)
+{
+    while (true) {
+        uint32_t timer = register_timer(PAGE_CACHE_WRITEBACK_US, PAGE_CACHE_WRITEBACK_SLACK_US,
+                                        writeback_timer, NULL);
+        ZF_LOGF_IF(timer == 0, "Failed to register the write-back timer");
+        coroutine_wait();
+
+        int err = page_cache_flush(NULL);
+        if (err != 0) {
+            ZF_LOGE("Write-back failed: %d", err);
+        }
+    }
+}
+
+void page_cache_init(void)
+{
+    cache.writeback_co = coroutine_start(writeback_coroutine, NULL);
+    ZF_LOGF_IF(cache.writeback_co == NULL, "No coroutine for write-back");
+    frame_table_set_reclaim(page_cache_reclaim);
+}
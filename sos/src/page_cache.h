@@ -0,0 +1,121 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * A cache of NFS file pages, held in frame table frames.
+ *
+ * Pages are keyed by file handle and page index. Reads are served from
+ * cached pages, and only pages that are missing go to the server, with a
+ * run of missing pages fetched by one pipelined read (see nfs_io.h).
+ * Writes only update the cached page and mark it dirty.
+ *
+ * Dirty pages are written back to the server by a write-back coroutine
+ * every CONFIG_SOS_PAGE_CACHE_WRITEBACK_MS (except with SosTimerThread,
+ * whose callbacks cannot wake coroutines), by page_cache_flush(), and
+ * before they are evicted. Pages are evicted in least recently used order
+ * when the cache holds CONFIG_SOS_PAGE_CACHE_PAGES pages, or when the
+ * frame table has no frame to give it. Clean pages are also given back
+ * whenever the frame table runs out of frames for anyone else.
+ *
+ * Sequential reads of a file are detected and the pages after them read
+ * ahead asynchronously, so a streaming reader finds them cached. The
+ * read-ahead window starts small and doubles each time the reader catches
+ * up with it, up to CONFIG_SOS_READ_AHEAD_PAGES; a read anywhere else in
+ * the file drops it.
+ *
+ * Small consecutive writes to a file are combined: once they add up to the
+ * server's wsize, the full pages are written behind asynchronously, as is
+ * the run so far when a write lands elsewhere in the file. The write-back
+ * timer sends what is left of a run that has gone idle.
+ *
+ * The cache keeps the size of each open file, taken from the server when
+ * the file is opened and grown by writes, and reads stop there. Changes
+ * other clients make to the size while the file is open are not seen.
+ *
+ * Everything except page_cache_init() and page_cache_reclaim() may block
+ * on NFS, so must be called from a coroutine (see coroutine.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct nfs_context;
+struct nfsfh;
+
+/*
+ * Start the write-back coroutine, and let the frame table reclaim clean
+ * pages. Must be called from the event loop, after the coroutines and the
+ * timer have been initialised.
+ */
+void page_cache_init(void);
+
+/*
+ * Start caching a file handle that has just been opened. Must be called
+ * before any other call on the handle.
+ *
+ * @param size  the size of the file on the server.
+ * @return      0 on success, or -ENOMEM.
+ */
+int page_cache_open(struct nfsfh *fh, uint64_t size);
+
+/*
+ * Read up to count bytes at offset of a file into buf.
+ *
+ * @return  the number of bytes read, which is less than count only at the
+ *          end of the file, or a negative error.
+ */
+ssize_t page_cache_read(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset, void *buf,
+                        size_t count);
+
+/*
+ * Write count bytes from buf at offset of a file. The data reaches the
+ * server when the pages are written back.
+ *
+ * @return  the number of bytes written, or a negative error.
+ */
+ssize_t page_cache_write(struct nfs_context *nfs, struct nfsfh *fh, uint64_t offset,
+                         const void *buf, size_t count);
+
+/*
+ * Get the size of a file, including writes that have not reached the
+ * server yet.
+ *
+ * @return  0 on success, or -EBADF if the file was not opened with
+ *          page_cache_open().
+ */
+int page_cache_size(struct nfsfh *fh, uint64_t *size);
+
+/*
+ * Write back the dirty pages of a file, or of every file if fh is NULL.
+ *
+ * @return  0 on success, or the first error from writing a page back. Pages
+ *          that failed to be written stay dirty.
+ */
+int page_cache_flush(struct nfsfh *fh);
+
+/*
+ * Write back and drop every page of a file, and forget its size and access
+ * pattern. Must be called before the file handle is closed.
+ *
+ * @return  as for page_cache_flush(). Pages are dropped even on failure.
+ */
+int page_cache_close(struct nfsfh *fh);
+
+/*
+ * Free clean pages that are not in use, least recently used first, for
+ * when memory is needed elsewhere. Never blocks.
+ *
+ * @return  the number of pages freed.
+ */
+size_t page_cache_reclaim(size_t pages);
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <sel4/sel4.h>
+
+#include "fd_table.h"
+
+/*
+ * Find the vspace of the process that made a syscall.
+ *
+ * @param badge  Badge of the endpoint capability the syscall was made on.
+ * @return       The vspace of the process, or seL4_CapNull if the badge
+ *               does not belong to a process.
+ */
+seL4_CPtr process_vspace(seL4_Word badge);
+
+/*
+ * Find the open files of the process that made a syscall.
+ *
+ * @param badge  Badge of the endpoint capability the syscall was made on.
+ * @return       The process's file descriptor table, or NULL if the badge
+ *               does not belong to a process.
+ */
+fd_table_t *process_fd_table(seL4_Word badge);
@@ -0,0 +1,284 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "share_vm.h"
+
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+
+#include "frame_table.h"
+#include "mapping.h"
+#include "vmem_layout.h"
+
+/* Largest number of distinct shared pages */
+#define SHARED_PAGES_MAX    256
+/* The shared page table holds one reference to each frame itself */
+#define SHARED_MAPPINGS_MAX (FRAME_MAX_REFS - 1)
+
+typedef struct {
+    /* vspace of the process */
+    seL4_CPtr vspace;
+    /* Copy of the frame's page cap, mapped into vspace */
+    seL4_CPtr cap;
+    /* Whether the process allows other processes to write */
+    bool writable;
+    /* Whether the process is currently mapped with write access */
+    bool mapped_writable;
+    /* Set while the share_vm() call that added or changed the mapping is
+     * still sharing pages, so that it can be undone if a later page fails */
+    bool pending;
+    /* Whether that call added the mapping, rather than changing its rights */
+    bool added;
+    /* writable before that call changed it */
+    bool prev_writable;
+} shared_mapping_t;
+
+typedef struct {
+    seL4_Word vaddr;
+    frame_ref_t frame;
+    size_t num_mappings;
+    shared_mapping_t mappings[SHARED_MAPPINGS_MAX];
+} shared_page_t;
+
+static shared_page_t shared_pages[SHARED_PAGES_MAX];
+static size_t num_shared_pages;
+
+static shared_page_t *find_shared_page(seL4_Word vaddr)
+{
+    for (size_t i = 0; i < num_shared_pages; i++) {
+        if (shared_pages[i].vaddr == vaddr) {
+            return &shared_pages[i];
+        }
+    }
+    return NULL;
+}
+
+static shared_page_t *new_shared_page(seL4_Word vaddr)
+{
+    if (num_shared_pages == SHARED_PAGES_MAX) {
+        ZF_LOGE("Too many shared pages");
+        return NULL;
+    }
+
+    frame_ref_t frame = alloc_frame();
+    if (frame == NULL_FRAME) {
+        ZF_LOGE("Failed to allocate shared frame");
+        return NULL;
+    }
+    memset(frame_data(frame), 0, PAGE_SIZE_4K);
+
+    shared_page_t *page = &shared_pages[num_shared_pages++];
+    *page = (shared_page_t) {
+        .vaddr = vaddr,
+        .frame = frame,
+    };
+    return page;
+}
+
+/* Forget a page that nothing maps any more, and drop the table's reference */
+static void release_shared_page(shared_page_t *page)
+{
+    free_frame(page->frame);
+    *page = shared_pages[--num_shared_pages];
+}
+
+static shared_mapping_t *find_mapping(shared_page_t *page, seL4_CPtr vspace)
+{
+    for (size_t i = 0; i < page->num_mappings; i++) {
+        if (page->mappings[i].vspace == vspace) {
+            return &page->mappings[i];
+        }
+    }
+    return NULL;
+}
+
+/* A process may only write if every other process made the page writable */
+static bool may_write(shared_page_t *page, shared_mapping_t *mapping)
+{
+    for (size_t i = 0; i < page->num_mappings; i++) {
+        if (&page->mappings[i] != mapping && !page->mappings[i].writable) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static seL4_Error map_shared(cspace_t *cspace, shared_page_t *page, shared_mapping_t *mapping, bool writable)
+{
+    seL4_CapRights_t rights = writable ? seL4_ReadWrite : seL4_CanRead;
+    seL4_Error err = map_frame(cspace, mapping->cap, mapping->vspace, page->vaddr, rights,
+                               seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever);
+    if (err == seL4_NoError) {
+        mapping->mapped_writable = writable;
+    }
+    return err;
+}
+
+/* Bring the rights of every existing mapping in line with the sharing rule */
+static seL4_Error update_rights(cspace_t *cspace, shared_page_t *page)
+{
+    for (size_t i = 0; i < page->num_mappings; i++) {
+        shared_mapping_t *mapping = &page->mappings[i];
+        bool writable = may_write(page, mapping);
+        if (writable == mapping->mapped_writable) {
+            continue;
+        }
+
+        seL4_Error err = seL4_ARM_Page_Unmap(mapping->cap);
+        if (err != seL4_NoError) {
+            ZF_LOGE("Failed to unmap shared page");
+            return err;
+        }
+        err = map_shared(cspace, page, mapping, writable);
+        if (err != seL4_NoError) {
+            ZF_LOGE("Failed to remap shared page");
+            return err;
+        }
+    }
+    return seL4_NoError;
+}
+
+/* Unmap a mapping and drop its reference to the frame */
+static void remove_mapping(cspace_t *cspace, shared_page_t *page, shared_mapping_t *mapping)
+{
+    seL4_Error err = seL4_ARM_Page_Unmap(mapping->cap);
+    ZF_LOGE_IF(err != seL4_NoError, "Failed to unmap shared page");
+    cspace_delete(cspace, mapping->cap);
+    cspace_free_slot(cspace, mapping->cap);
+    free_frame(page->frame);
+    *mapping = page->mappings[--page->num_mappings];
+}
+
+static int share_page(cspace_t *cspace, seL4_CPtr vspace, seL4_Word vaddr, bool writable)
+{
+    shared_page_t *page = find_shared_page(vaddr);
+    if (page == NULL) {
+        page = new_shared_page(vaddr);
+        if (page == NULL) {
+            return -1;
+        }
+    }
+
+    shared_mapping_t *mapping = find_mapping(page, vspace);
+    if (mapping != NULL) {
+        /* Already shared by this process, only the rights change */
+        mapping->prev_writable = mapping->writable;
+        mapping->writable = writable;
+        mapping->pending = true;
+        mapping->added = false;
+        return update_rights(cspace, page) == seL4_NoError ? 0 : -1;
+    }
+
+    if (page->num_mappings == SHARED_MAPPINGS_MAX || !frame_retain(page->frame)) {
+        ZF_LOGE("Too many processes sharing page %p", (void *) vaddr);
+        goto out_page;
+    }
+
+    mapping = &page->mappings[page->num_mappings];
+    *mapping = (shared_mapping_t) {
+        .vspace = vspace,
+        .writable = writable,
+        .pending = true,
+        .added = true,
+    };
+
+    mapping->cap = cspace_alloc_slot(cspace);
+    if (mapping->cap == seL4_CapNull) {
+        ZF_LOGE("Failed to alloc slot for shared page");
+        goto out_frame;
+    }
+
+    seL4_Error err = cspace_copy(cspace, mapping->cap, frame_table_cspace(), frame_page(page->frame),
+                                 seL4_AllRights);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to copy shared page cap");
+        goto out_slot;
+    }
+
+    page->num_mappings += 1;
+    err = map_shared(cspace, page, mapping, may_write(page, mapping));
+    if (err != seL4_NoError) {
+        /* Most likely the address is already mapped in the process */
+        ZF_LOGE("Failed to map shared page %p", (void *) vaddr);
+        page->num_mappings -= 1;
+        cspace_delete(cspace, mapping->cap);
+        goto out_slot;
+    }
+
+    return update_rights(cspace, page) == seL4_NoError ? 0 : -1;
+
+out_slot:
+    cspace_free_slot(cspace, mapping->cap);
+out_frame:
+    free_frame(page->frame);
+out_page:
+    if (page->num_mappings == 0) {
+        /* The page was created for this mapping */
+        release_shared_page(page);
+    }
+    return -1;
+}
+
+/*
+ * Finish the share_vm() call that got as far as last_page. If it failed,
+ * every mapping it added is removed and every change of rights undone.
+ */
+static void finish_share(cspace_t *cspace, seL4_CPtr vspace, seL4_Word vaddr, seL4_Word last_page,
+                         bool failed)
+{
+    for (seL4_Word vpage = vaddr; vpage <= last_page; vpage += PAGE_SIZE_4K) {
+        shared_page_t *page = find_shared_page(vpage);
+        shared_mapping_t *mapping = page != NULL ? find_mapping(page, vspace) : NULL;
+        if (mapping == NULL || !mapping->pending) {
+            continue;
+        }
+
+        mapping->pending = false;
+        if (!failed) {
+            continue;
+        }
+        if (mapping->added) {
+            remove_mapping(cspace, page, mapping);
+            if (page->num_mappings == 0) {
+                release_shared_page(page);
+                continue;
+            }
+        } else {
+            mapping->writable = mapping->prev_writable;
+        }
+        if (update_rights(cspace, page) != seL4_NoError) {
+            ZF_LOGE("Failed to restore rights of shared page %p", (void *) vpage);
+        }
+    }
+}
+
+int share_vm(cspace_t *cspace, seL4_CPtr vspace, seL4_Word vaddr, seL4_Word size, bool writable)
+{
+    if (!IS_ALIGNED(vaddr, seL4_PageBits) || !IS_ALIGNED(size, seL4_PageBits) || size == 0) {
+        return -1;
+    }
+    /* Only allow regions below the SOS-managed parts of the address space */
+    if (vaddr + size < vaddr || vaddr + size > PROCESS_IPC_BUFFER) {
+        return -1;
+    }
+
+    seL4_Word page;
+    int ret = 0;
+    for (page = vaddr; page < vaddr + size; page += PAGE_SIZE_4K) {
+        ret = share_page(cspace, vspace, page, writable);
+        if (ret != 0) {
+            break;
+        }
+    }
+    finish_share(cspace, vspace, vaddr, MIN(page, vaddr + size - PAGE_SIZE_4K), ret != 0);
+    return ret;
+}
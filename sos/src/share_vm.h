@@ -0,0 +1,47 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Shared memory regions between processes (sos_share_vm()).
+ *
+ * A shared page is identified by its virtual address. The first process to
+ * share an address gets a fresh frame, and every process that shares the
+ * same address afterwards gets a copy of that frame's page cap mapped at it,
+ * so all of them see the same memory. Each mapping holds a reference to the
+ * frame in the frame table.
+ *
+ * A process may write to a shared page only if every other process sharing
+ * it asked for it to be writable. Existing mappings are downgraded or
+ * upgraded as processes join.
+ */
+
+#include <stdbool.h>
+#include <sel4/sel4.h>
+#include <cspace/cspace.h>
+
+/*
+ * Share the pages in [vaddr, vaddr + size) of a process.
+ *
+ * The pages must not already be mapped in the process by anything other
+ * than an earlier call to share_vm().
+ *
+ * @param cspace    cspace to allocate slots for the mapped caps in.
+ * @param vspace    vspace of the calling process.
+ * @param vaddr     start of the region, page aligned.
+ * @param size      size of the region, a multiple of the page size.
+ * @param writable  whether other processes may write to the region.
+ * @return          0 on success, -1 on an invalid region or if resources
+ *                  ran out. On failure no page of the region is shared
+ *                  that was not before, and the rights are as they were.
+ */
+int share_vm(cspace_t *cspace, seL4_CPtr vspace, seL4_Word vaddr, seL4_Word size, bool writable);
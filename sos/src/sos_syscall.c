@@ -0,0 +1,431 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "sos_syscall.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <aos/sos_abi.h>
+#include <sos/gen_config.h>
+
+#include "coroutine.h"
+#include "process.h"
+#include "share_vm.h"
+#include "threads.h"
+#include "utils.h"
+#include "vfs.h"
+#include "worker.h"
+
+/* Calls that can be queued on the worker thread at once */
+#ifdef CONFIG_SOS_SYSCALL_WORKER
+#define SYSCALL_WORKER_CALLS WORKER_QUEUE_SIZE
+#else
+#define SYSCALL_WORKER_CALLS 0
+#endif
+
+/* One call for every coroutine, plus one that has completed and is waiting
+ * for the event loop to reply to it, plus those handed to the worker. */
+#define SYSCALL_POOL_SIZE (CONFIG_SOS_COROUTINE_POOL_SIZE + 1 + SYSCALL_WORKER_CALLS)
+
+/* The *WithMRs system calls take exactly four message registers */
+compile_time_assert(fastpath_words, SOS_FASTPATH_WORDS == 4);
+
+static sos_syscall_t calls[SYSCALL_POOL_SIZE];
+static sos_syscall_t *free_calls;
+
+/* Calls finished by the worker thread. The worker pushes onto this stack, and only
+ * the event loop takes calls off it, so it needs no lock. */
+static sos_syscall_t *completed_calls;
+/* Set by the event loop when it is about to wait for a call to be freed */
+static bool event_loop_waiting;
+/* Notification the worker signals to wake the event loop */
+static seL4_CPtr wakeup_ntfn;
+
+/*
+ * Syscalls whose handlers only touch state that is safe to share between
+ * threads, and so can run on a worker rather than in the event loop.
+ */
+static bool syscall_worker_safe(seL4_Word syscall_number)
+{
+    switch (syscall_number) {
+    case SOS_SYSCALL_NULL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* sos_getdirents(): see <aos/sos_abi.h> for the message layout */
+static void syscall_getdirents(sos_syscall_t *call)
+{
+    seL4_Word cookie = call->msg[1];
+    size_t max = MIN(call->msg[2], SOS_GETDIRENTS_MAX_BYTES);
+
+    /* The records are written over the path, so take a copy. Unused message
+     * words are zero, so it is terminated unless it filled the message. */
+    char path[SOS_GETDIRENTS_MAX_BYTES];
+    memcpy(path, &call->msg[SOS_GETDIRENTS_HEADER_WORDS], sizeof(path));
+    path[sizeof(path) - 1] = '\0';
+
+    char *records = (char *) &call->msg[SOS_GETDIRENTS_HEADER_WORDS];
+    size_t used = 0;
+    bool end = false;
+    while (true) {
+        char name[NAME_MAX + 1];
+        vfs_stat_t st;
+        ssize_t len = vfs_getdirent(path, cookie, name, sizeof(name), &st);
+        if (len <= 0) {
+            end = len == 0;
+            break;
+        }
+
+        size_t reclen = SOS_DIRENT_RECLEN(len);
+        if (used + reclen > max) {
+            break;
+        }
+        sos_dirent_t *dirent = (sos_dirent_t *) (records + used);
+        dirent->d_reclen = reclen;
+        dirent->d_type = st.type;
+        dirent->d_size = st.size;
+        memcpy(dirent->d_name, name, len + 1);
+        used += reclen;
+        cookie++;
+    }
+
+    /* An error after some entries is reported by the next call */
+    call->msg[0] = used > 0 || end ? (seL4_Word) used : (seL4_Word) -1;
+    call->msg[1] = cookie;
+    call->msg[2] = end;
+    call->len = SOS_GETDIRENTS_HEADER_WORDS + DIV_ROUND_UP(used, sizeof(seL4_Word));
+}
+
+/* Copy the path of a file call. Unused message words are zero, so it is
+ * terminated unless it filled the message. */
+static void io_path(sos_syscall_t *call, char path[SOS_IO_MAX_BYTES])
+{
+    memcpy(path, &call->msg[SOS_IO_HEADER_WORDS], SOS_IO_MAX_BYTES);
+    path[SOS_IO_MAX_BYTES - 1] = '\0';
+}
+
+/* Set a file call's reply to a result with no data, -1 for any error */
+static void io_reply(sos_syscall_t *call, long ret)
+{
+    call->msg[0] = ret < 0 ? (seL4_Word) -1 : (seL4_Word) ret;
+    call->len = 1;
+}
+
+/* Set an open call's reply to a file descriptor or a negative errno value */
+static void open_reply(sos_syscall_t *call, long ret)
+{
+    call->msg[0] = (seL4_Word) ret;
+    call->len = 1;
+}
+
+/* The file calls: see <aos/sos_abi.h> for the message layout */
+static void syscall_open(sos_syscall_t *call)
+{
+    fd_table_t *fds = process_fd_table(call->badge);
+    if (fds == NULL) {
+        open_reply(call, -EBADF);
+        return;
+    }
+
+    /* A file that does not exist is created if it is opened for writing */
+    int flags;
+    seL4_Word mode = call->msg[1];
+    switch (mode) {
+    case O_RDONLY:
+        flags = VFS_O_READ;
+        break;
+    case O_WRONLY:
+        flags = VFS_O_WRITE | VFS_O_CREATE;
+        break;
+    case O_RDWR:
+        flags = VFS_O_READ | VFS_O_WRITE | VFS_O_CREATE;
+        break;
+    default:
+        /* Any other access mode or flag is one SOS does not implement */
+        ZF_LOGD("Invalid open mode %#lx", (unsigned long) mode);
+        open_reply(call, -EINVAL);
+        return;
+    }
+
+    char path[SOS_IO_MAX_BYTES];
+    io_path(call, path);
+    vfs_file_t *file;
+    int err = vfs_open(path, flags, &file);
+    if (err != 0) {
+        ZF_LOGD("Failed to open %s: %d", path, err);
+        open_reply(call, err);
+        return;
+    }
+
+    int fd = fd_table_add(fds, file);
+    if (fd < 0) {
+        vfs_close(file);
+        fd = -EMFILE;
+    }
+    open_reply(call, fd);
+}
+
+static void syscall_close(sos_syscall_t *call)
+{
+    fd_table_t *fds = process_fd_table(call->badge);
+    vfs_file_t *file = fds != NULL ? fd_table_remove(fds, call->msg[1]) : NULL;
+    io_reply(call, file != NULL ? vfs_close(file) : -1);
+}
+
+static void syscall_read(sos_syscall_t *call)
+{
+    fd_table_t *fds = process_fd_table(call->badge);
+    vfs_file_t *file = fds != NULL ? fd_table_get(fds, call->msg[1]) : NULL;
+    size_t count = MIN(call->msg[2], SOS_IO_MAX_BYTES);
+
+    ssize_t got = file != NULL ? vfs_read(file, &call->msg[SOS_IO_HEADER_WORDS], count) : -1;
+    io_reply(call, got);
+    if (got > 0) {
+        call->msg[1] = 0;
+        call->msg[2] = 0;
+        call->len = SOS_IO_HEADER_WORDS + DIV_ROUND_UP(got, sizeof(seL4_Word));
+    }
+}
+
+static void syscall_write(sos_syscall_t *call)
+{
+    fd_table_t *fds = process_fd_table(call->badge);
+    vfs_file_t *file = fds != NULL ? fd_table_get(fds, call->msg[1]) : NULL;
+    size_t count = MIN(call->msg[2], SOS_IO_MAX_BYTES);
+
+    io_reply(call, file != NULL ? vfs_write(file, &call->msg[SOS_IO_HEADER_WORDS], count) : -1);
+}
+
+static void syscall_stat(sos_syscall_t *call)
+{
+    char path[SOS_IO_MAX_BYTES];
+    io_path(call, path);
+    vfs_stat_t st;
+    int err = vfs_stat(path, &st);
+    io_reply(call, err);
+    if (err == 0) {
+        call->msg[1] = st.type;
+        call->msg[2] = st.mode;
+        call->msg[3] = st.size;
+        call->msg[4] = st.ctime_ms;
+        call->msg[5] = st.atime_ms;
+        call->len = 6;
+    }
+}
+
+/**
+ * Deals with a syscall and sets the reply message in the call.
+ */
+static void handle_syscall(sos_syscall_t *call)
+{
+    /* get the first word of the message, which in the SOS protocol is the number
+     * of the SOS "syscall". */
+    seL4_Word syscall_number = call->msg[0];
+
+    /* Set the reply flag */
+    call->have_reply = true;
+
+    /* Process system call */
+    switch (syscall_number) {
+    case SOS_SYSCALL_NULL:
+        ZF_LOGV("syscall: thread example made syscall 0!\n");
+        /* construct a reply message of length 1 */
+        call->len = 1;
+        /* Set the first (and only) word in the message to 0 */
+        call->msg[0] = 0;
+
+        break;
+    case SOS_SYSCALL_SHARE_VM: {
+        seL4_CPtr vspace = process_vspace(call->badge);
+        int ret = -1;
+        if (vspace != seL4_CapNull) {
+            ret = share_vm(&cspace, vspace, call->msg[1], call->msg[2], call->msg[3] != 0);
+        }
+        call->len = 1;
+        call->msg[0] = ret;
+        break;
+    }
+    case SOS_SYSCALL_GETDIRENTS:
+        syscall_getdirents(call);
+        break;
+    case SOS_SYSCALL_OPEN:
+        syscall_open(call);
+        break;
+    case SOS_SYSCALL_CLOSE:
+        syscall_close(call);
+        break;
+    case SOS_SYSCALL_READ:
+        syscall_read(call);
+        break;
+    case SOS_SYSCALL_WRITE:
+        syscall_write(call);
+        break;
+    case SOS_SYSCALL_STAT:
+        syscall_stat(call);
+        break;
+    default:
+        call->len = 0;
+        ZF_LOGE("Unknown syscall %lu\n", syscall_number);
+        /* Don't reply to an unknown syscall */
+        call->have_reply = false;
+    }
+}
+
+static void syscall_coroutine(void *arg)
+{
+    sos_syscall_t *call = arg;
+
+    handle_syscall(call);
+
+    if (call->blocked) {
+        /* The event loop has moved on, so reply directly */
+        if (call->have_reply) {
+            sos_syscall_send_reply(call);
+        }
+        sos_syscall_free(call);
+    }
+}
+
+static void syscall_worker(void *arg)
+{
+    sos_syscall_t *call = arg;
+
+    handle_syscall(call);
+    if (call->have_reply) {
+        sos_syscall_send_reply(call);
+    }
+
+    /* Hand the call back to the event loop */
+    sos_syscall_t *head = __atomic_load_n(&completed_calls, __ATOMIC_RELAXED);
+    do {
+        call->next = head;
+    } while (!__atomic_compare_exchange_n(&completed_calls, &head, call, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&event_loop_waiting, __ATOMIC_SEQ_CST)) {
+        seL4_Signal(wakeup_ntfn);
+    }
+}
+
+/* Move every call finished by a worker back to the free list */
+static void reclaim_completed_calls(void)
+{
+    sos_syscall_t *call = __atomic_exchange_n(&completed_calls, NULL, __ATOMIC_SEQ_CST);
+    while (call != NULL) {
+        sos_syscall_t *next = call->next;
+        sos_syscall_free(call);
+        call = next;
+    }
+}
+
+void sos_syscall_init(seL4_CPtr ntfn)
+{
+    wakeup_ntfn = ntfn;
+    coroutines_init();
+#ifdef CONFIG_SOS_SYSCALL_WORKER
+    worker_init();
+#endif
+
+    for (int i = SYSCALL_POOL_SIZE - 1; i >= 0; i--) {
+        ut_t *reply_ut = alloc_retype(&calls[i].reply, seL4_ReplyObject, seL4_ReplyBits);
+        ZF_LOGF_IF(reply_ut == NULL, "Failed to alloc reply object ut");
+        calls[i].next = free_calls;
+        free_calls = &calls[i];
+    }
+}
+
+sos_syscall_t *sos_syscall_alloc(void)
+{
+    __atomic_store_n(&event_loop_waiting, false, __ATOMIC_SEQ_CST);
+    if (free_calls == NULL) {
+        reclaim_completed_calls();
+    }
+
+    sos_syscall_t *call = free_calls;
+    if (call == NULL && coroutine_available()) {
+        /* Only the worker can free a call now. Tell it to wake us, then check
+         * again in case it finished one before it could see the flag. */
+        __atomic_store_n(&event_loop_waiting, true, __ATOMIC_SEQ_CST);
+        reclaim_completed_calls();
+        call = free_calls;
+    }
+    if (call == NULL || !coroutine_available()) {
+        return NULL;
+    }
+    free_calls = call->next;
+    call->next = NULL;
+    return call;
+}
+
+void sos_syscall_free(sos_syscall_t *call)
+{
+    call->co = NULL;
+    call->next = free_calls;
+    free_calls = call;
+}
+
+bool sos_syscall_start(sos_syscall_t *call, seL4_Word badge, seL4_MessageInfo_t message,
+                       const seL4_Word mrs[SOS_FASTPATH_WORDS])
+{
+    call->badge = badge;
+    call->len = MIN(seL4_MessageInfo_get_length(message), seL4_MsgMaxLength);
+    for (seL4_Word i = 0; i < call->len; i++) {
+        /* Only long messages need to be read from the IPC buffer */
+        call->msg[i] = i < SOS_FASTPATH_WORDS ? mrs[i] : seL4_GetMR(i);
+    }
+    /* Unused words read as 0, so a short message cannot leak a previous call's arguments */
+    memset(&call->msg[call->len], 0, (seL4_MsgMaxLength - call->len) * sizeof(seL4_Word));
+    call->have_reply = false;
+    call->blocked = false;
+
+    if (syscall_worker_safe(call->msg[0]) && worker_submit(syscall_worker, call)) {
+        /* The worker replies, and returns the call to the event loop */
+        call->blocked = true;
+        return false;
+    }
+
+    call->co = coroutine_start(syscall_coroutine, call);
+    ZF_LOGF_IF(call->co == NULL, "No coroutine available for syscall");
+
+    if (coroutine_finished(call->co)) {
+        return true;
+    }
+
+    /* The handler is waiting on an event. It cannot run again until the event
+     * loop calls coroutines_run(), so this is set before it checks it. */
+    call->blocked = true;
+    return false;
+}
+
+seL4_MessageInfo_t sos_syscall_reply_info(sos_syscall_t *call, seL4_Word mrs[SOS_FASTPATH_WORDS])
+{
+    for (seL4_Word i = 0; i < SOS_FASTPATH_WORDS; i++) {
+        mrs[i] = i < call->len ? call->msg[i] : 0;
+    }
+    for (seL4_Word i = SOS_FASTPATH_WORDS; i < call->len; i++) {
+        seL4_SetMR(i, call->msg[i]);
+    }
+    return seL4_MessageInfo_new(0, 0, 0, call->len);
+}
+
+void sos_syscall_send_reply(sos_syscall_t *call)
+{
+    seL4_Word mrs[SOS_FASTPATH_WORDS];
+    seL4_MessageInfo_t info = sos_syscall_reply_info(call, mrs);
+    seL4_SendWithMRs(call->reply, info, &mrs[0], &mrs[1], &mrs[2], &mrs[3]);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * Handling of SOS syscalls from user processes.
+ *
+ * Each syscall gets its own sos_syscall_t, which holds a reply object and a
+ * copy of the message, and is handled on a pooled coroutine. This lets a
+ * handler block on an asynchronous event while the event loop receives on
+ * the endpoint again with another reply object.
+ *
+ * When SOS is configured with a worker thread, syscalls that are safe to run
+ * off the main thread are instead handed to the worker, which replies itself.
+ */
+
+#include <stdbool.h>
+#include <sel4/sel4.h>
+#include <aos/sos_abi.h>
+
+#include "coroutine.h"
+
+typedef struct sos_syscall sos_syscall_t;
+struct sos_syscall {
+    /* Badge of the endpoint capability the syscall was made on */
+    seL4_Word badge;
+    /* Reply object that the caller is blocked on */
+    seL4_CPtr reply;
+    /* The message. On entry this holds the request, with the syscall number
+     * in the first word. The handler overwrites it with the reply. */
+    seL4_Word msg[seL4_MsgMaxLength];
+    /* Number of valid words in msg */
+    seL4_Word len;
+    /* Whether a reply should be sent to the caller */
+    bool have_reply;
+    /* Set once the handler has blocked, after which the handler sends the
+     * reply itself rather than leaving it to the event loop */
+    bool blocked;
+    /* Coroutine running the handler, NULL if it runs on a worker thread */
+    coroutine_t *co;
+    /* Next call in the free or completed list */
+    sos_syscall_t *next;
+};
+
+/*
+ * Allocate the reply objects, coroutines and worker thread used for
+ * handling syscalls.
+ *
+ * @param ntfn  Notification that the worker thread signals when it returns a
+ *              call to an event loop that is waiting for one. It should
+ *              be badged so the event loop can recognise it.
+ */
+void sos_syscall_init(seL4_CPtr ntfn);
+
+/*
+ * Take a call from the pool. Its reply object can be passed to seL4_Recv().
+ *
+ * @return  A free call, or NULL if every call (or coroutine) is in use. If
+ *          calls are held by the worker thread, the notification passed to
+ *          sos_syscall_init() is signalled when one is returned.
+ */
+sos_syscall_t *sos_syscall_alloc(void);
+
+/*
+ * Return a call to the pool.
+ */
+void sos_syscall_free(sos_syscall_t *call);
+
+/*
+ * Copy a received message into the call and start handling it.
+ *
+ * The first SOS_FASTPATH_WORDS words of the message are taken from mrs, as
+ * received in registers by seL4_RecvWithMRs(). Only the rest are read from
+ * the IPC buffer, which the event loop will overwrite on its next receive.
+ *
+ * @return  true if the handler completed without blocking. The caller is
+ *          then responsible for the reply (if have_reply is set) and for
+ *          freeing the call. Otherwise the handler (or the worker thread
+ *          it was given to) replies and frees the call when it finishes.
+ */
+bool sos_syscall_start(sos_syscall_t *call, seL4_Word badge, seL4_MessageInfo_t message,
+                       const seL4_Word mrs[SOS_FASTPATH_WORDS]);
+
+/*
+ * Load the reply for a completed call for one of the *WithMRs system calls.
+ * The first SOS_FASTPATH_WORDS words go in mrs, and only longer replies are
+ * written to the IPC buffer.
+ *
+ * @return  The message info to reply with.
+ */
+seL4_MessageInfo_t sos_syscall_reply_info(sos_syscall_t *call, seL4_Word mrs[SOS_FASTPATH_WORDS]);
+
+/*
+ * Send the reply for a completed call on its reply object.
+ */
+void sos_syscall_send_reply(sos_syscall_t *call);
@@ -11,14 +11,47 @@
  */
 #define ZF_LOG_LEVEL ZF_LOG_INFO
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
 #include <cspace/cspace.h>
 #include <utils/util.h>
 #include <sel4/sel4.h>
+#include <clock/clock.h>
+#include <clock/timer_wheel.h>
+#include <aos/sos_abi.h>
+#include <sos/gen_config.h>
 #include "dma.h"
 #include "bootstrap.h"
+#include "coroutine.h"
 #include "frame_table.h"
+#include "nfs_io.h"
+#include "tmpfs.h"
+#include "vfs.h"
 
 #define TEST_FRAMES 10
+#define TEST_DMA_OBJECTS 64
+
+/* Where the tmpfs test mounts its own instance */
+#define TEST_TMPFS_PATH "/test_tmpfs"
+/* The first page of a file that needs a radix tree of height 3 */
+#define TEST_TMPFS_FAR_PAGE (PAGE_SIZE_4K / sizeof(frame_ref_t))
+
+/* The chunk size of the NFS I/O test's stub server, and the size of its
+ * file, which ends part way through a chunk */
+#define TEST_NFS_IO_CHUNK 100
+#define TEST_NFS_IO_SIZE  (10 * TEST_NFS_IO_CHUNK + TEST_NFS_IO_CHUNK / 2)
+
+/* Number of get_time() calls timed by the clock benchmark */
+#define CLOCK_BENCH_LOOPS 1000
+
+/* PMU cycle counter, which the kernel exports to user level */
+#define PMCR_CCNT_64     BIT(6)
+#define PMCR_ENABLE      BIT(0)
+#define PMCNTEN_CCNT     BIT(31)
+#define READ_CCNT(v)     asm volatile("mrs %0, PMCCNTR_EL0" : "=r"(v))
+#define PMU_READ(reg, v) asm volatile("mrs %0, " reg : "=r"(v))
+#define PMU_WRITE(reg, v) asm volatile("msr " reg ", %0" :: "r"((seL4_Word)(v)))
 
 static void test_bf_bit(unsigned long bit)
 {
@@ -112,6 +145,43 @@ static void test_dma(void)
     for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
         assert(blah[i] == 'a' + i % 25);
     }
+
+    /* Freed memory is reused by the next allocation of the same size */
+    sos_dma_free(dma);
+    dma_addr_t again = sos_dma_malloc(PAGE_SIZE_4K, PAGE_SIZE_4K);
+    assert(again.vaddr == dma.vaddr && again.paddr == dma.paddr);
+    sos_dma_free(again);
+
+    /* Small allocations are cache line aligned and do not overlap */
+    dma_addr_t small[TEST_DMA_OBJECTS];
+    for (int i = 0; i < TEST_DMA_OBJECTS; i++) {
+        small[i] = sos_dma_malloc(i + 1, 1);
+        assert(small[i].vaddr != 0 && small[i].vaddr % 64 == 0);
+        assert(sos_dma_virt_to_phys(small[i].vaddr) == small[i].paddr);
+        assert(sos_dma_phys_to_virt(small[i].paddr) == small[i].vaddr);
+        for (int j = 0; j < i; j++) {
+            assert(small[i].vaddr != small[j].vaddr);
+        }
+    }
+    for (int i = 0; i < TEST_DMA_OBJECTS; i++) {
+        sos_dma_free(small[i]);
+    }
+
+    /* Allocations bigger than a page are page aligned */
+    dma_addr_t large = sos_dma_malloc(3 * PAGE_SIZE_4K + 1, 1);
+    assert(large.vaddr != 0 && large.vaddr % PAGE_SIZE_4K == 0);
+
+    /* Touching and overlapping ranges are cleaned as one */
+    dma_cache_batch_t batch;
+    sos_dma_cache_batch_init(&batch, DMA_CACHE_CLEAN);
+    sos_dma_cache_batch_add(&batch, large.vaddr + PAGE_SIZE_4K, PAGE_SIZE_4K);
+    sos_dma_cache_batch_add(&batch, large.vaddr, 100);
+    assert(batch.n_ranges == 2);
+    sos_dma_cache_batch_add(&batch, large.vaddr + 64, PAGE_SIZE_4K);
+    assert(batch.n_ranges == 1);
+    assert(batch.ranges[0].start == large.vaddr && batch.ranges[0].end == large.vaddr + 2 * PAGE_SIZE_4K);
+    assert(sos_dma_cache_batch_flush(&batch) == seL4_NoError && batch.n_ranges == 0);
+    sos_dma_free(large);
 }
 
 static void test_frame_table(void)
@@ -161,6 +231,352 @@ static void test_frame_table(void)
     for (int f = 0; f < TEST_FRAMES; f++) {
         free_frame(new_frames[f]);
     }
+
+    /* A shared frame is only freed when its last reference is dropped */
+    frame_ref_t shared = alloc_frame();
+    assert(shared != NULL_FRAME);
+    assert(frame_refcount(shared) == 1);
+    for (size_t r = 1; r < FRAME_MAX_REFS; r++) {
+        assert(frame_retain(shared));
+    }
+    assert(!frame_retain(shared));
+    for (size_t r = FRAME_MAX_REFS; r > 1; r--) {
+        free_frame(shared);
+        assert(frame_refcount(shared) == r - 1);
+    }
+    free_frame(shared);
+    assert(frame_from_ref(shared)->list_id == FREE_LIST);
+}
+
+static void count_timer(UNUSED uint32_t id, void *data)
+{
+    (*(int *) data)++;
+}
+
+static void test_timer_wheel(void)
+{
+    timer_wheel_t wheel;
+    int fired = 0;
+    timer_wheel_init(&wheel, 1000);
+
+    /* A timer that is already due fires on the next advance */
+    assert(timer_wheel_add(&wheel, 999, 999, count_timer, &fired) != 0);
+    timer_wheel_advance(&wheel, 1000);
+    assert(fired == 1);
+    fired = 0;
+
+    /* Timers on each level, and one that is removed */
+    uint64_t deadlines[] = { 1001, 1063, 1064, 5000, 300000, 20000000, 1ull << 40 };
+    for (size_t i = 0; i < ARRAY_SIZE(deadlines); i++) {
+        assert(timer_wheel_add(&wheel, deadlines[i], deadlines[i], count_timer, &fired) != 0);
+    }
+    uint32_t removed = timer_wheel_add(&wheel, 2000, 2000, count_timer, &fired);
+    assert(timer_wheel_remove(&wheel, removed));
+    assert(!timer_wheel_remove(&wheel, removed));
+
+    for (size_t i = 0; i < ARRAY_SIZE(deadlines); i++) {
+        /* The next event is the deadline itself, not a cascade before it */
+        uint64_t event;
+        assert(timer_wheel_next_event(&wheel, &event) && event == deadlines[i]);
+
+        /* Nothing fires early */
+        timer_wheel_advance(&wheel, deadlines[i] - 1);
+        assert(fired == (int) i);
+        timer_wheel_advance(&wheel, deadlines[i]);
+        assert(fired == (int) i + 1);
+    }
+    assert(wheel.count == 0);
+    timer_wheel_destroy(&wheel);
+
+    /* Timers with slack: the next event is when the first window closes,
+     * and every window that is open by then fires in the same advance */
+    timer_wheel_init(&wheel, 0);
+    fired = 0;
+    assert(timer_wheel_add(&wheel, 1000, 1999, count_timer, &fired) != 0);
+    assert(timer_wheel_add(&wheel, 1990, 2100, count_timer, &fired) != 0);
+    assert(timer_wheel_add(&wheel, 2050, 300000, count_timer, &fired) != 0);
+    uint64_t event;
+    assert(timer_wheel_next_event(&wheel, &event) && event == 1999);
+    timer_wheel_advance(&wheel, event);
+    assert(fired == 2);
+    assert(timer_wheel_next_event(&wheel, &event) && event == 300000);
+    timer_wheel_advance(&wheel, event);
+    assert(fired == 3 && wheel.count == 0);
+    timer_wheel_destroy(&wheel);
+}
+
+/* Time CLOCK_BENCH_LOOPS calls of fn, returning the fastest and the mean in cycles */
+static void time_clock_source(timestamp_t (*fn)(void), uint64_t *min, uint64_t *mean)
+{
+    uint64_t total = 0;
+    *min = UINT64_MAX;
+    for (int i = 0; i < CLOCK_BENCH_LOOPS; i++) {
+        uint64_t start, end;
+        READ_CCNT(start);
+        fn();
+        READ_CCNT(end);
+        total += end - start;
+        *min = MIN(*min, end - start);
+    }
+    *mean = total / CLOCK_BENCH_LOOPS;
+}
+
+void benchmark_clock(void)
+{
+    /* Start the cycle counter */
+    seL4_Word pmcr;
+    PMU_READ("PMCR_EL0", pmcr);
+    PMU_WRITE("PMCR_EL0", pmcr | PMCR_CCNT_64 | PMCR_ENABLE);
+    PMU_WRITE("PMCNTENSET_EL0", PMCNTEN_CCNT);
+
+    uint64_t mmio_min, mmio_mean, time_min, time_mean;
+    time_clock_source(get_time_mmio, &mmio_min, &mmio_mean);
+    time_clock_source(get_time, &time_min, &time_mean);
+
+    /* Both sources should agree to within a few us */
+    timestamp_t mmio = get_time_mmio();
+    timestamp_t time = get_time();
+    ZF_LOGW_IF(time + 10 <= mmio || time >= mmio + 10, "Clock sources disagree: %llu us and %llu us",
+               (unsigned long long) mmio, (unsigned long long) time);
+
+    ZF_LOGI("Clock: timestamp registers %llu cycles (mean %llu), get_time() %llu cycles (mean %llu)",
+            (unsigned long long) mmio_min, (unsigned long long) mmio_mean,
+            (unsigned long long) time_min, (unsigned long long) time_mean);
+}
+
+/* The VFS may only be used from a coroutine */
+static void tmpfs_test_run(UNUSED void *arg)
+{
+    static char data[PAGE_SIZE_4K], buf[PAGE_SIZE_4K];
+    for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    tmpfs_t *fs = tmpfs_create();
+    assert(fs != NULL);
+    assert(vfs_mount(TEST_TMPFS_PATH, &tmpfs_ops, fs) == 0);
+    assert(vfs_mount(TEST_TMPFS_PATH, &tmpfs_ops, fs) == -EBUSY);
+
+    /* A missing file is only created when asked */
+    vfs_file_t *file;
+    assert(vfs_open(TEST_TMPFS_PATH "/missing", VFS_O_READ, &file) == -ENOENT);
+    assert(vfs_open(TEST_TMPFS_PATH "/file", VFS_O_READ | VFS_O_WRITE | VFS_O_CREATE, &file) == 0);
+
+    /* One page is a tree of height 1. Writing far out grows it to height 3:
+     * a new root, a node above the first page, a second node, and two
+     * pages, as the write straddles a page boundary. */
+    assert(vfs_write(file, data, 100) == 100);
+    assert(tmpfs_pages(fs) == 1);
+    uint64_t far = TEST_TMPFS_FAR_PAGE * PAGE_SIZE_4K + 10;
+    file->offset = far;
+    assert(vfs_write(file, data, PAGE_SIZE_4K) == PAGE_SIZE_4K);
+    assert(tmpfs_pages(fs) == 6);
+
+    /* Both ends read back after the height change, up to the end of the file */
+    file->offset = 0;
+    assert(vfs_read(file, buf, 100) == 100 && memcmp(buf, data, 100) == 0);
+    file->offset = far;
+    assert(vfs_read(file, buf, PAGE_SIZE_4K) == PAGE_SIZE_4K);
+    assert(memcmp(buf, data, PAGE_SIZE_4K) == 0);
+    assert(vfs_read(file, buf, 1) == 0);
+
+    /* The holes after the first write read as zeros, within its page and in
+     * pages never written, and reading them allocates nothing */
+    uint64_t holes[] = { 100, 3 * PAGE_SIZE_4K, far - PAGE_SIZE_4K };
+    for (size_t h = 0; h < ARRAY_SIZE(holes); h++) {
+        file->offset = holes[h];
+        assert(vfs_read(file, buf, PAGE_SIZE_4K) == PAGE_SIZE_4K);
+        for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
+            assert(buf[i] == 0);
+        }
+    }
+    assert(tmpfs_pages(fs) == 6);
+
+    /* The filesystem cannot go while a file on it is open */
+    assert(vfs_unmount(TEST_TMPFS_PATH) == -EBUSY);
+    assert(vfs_close(file) == 0);
+
+    vfs_stat_t st;
+    assert(vfs_stat(TEST_TMPFS_PATH "/file", &st) == 0);
+    assert(st.type == ST_FILE && st.size == far + PAGE_SIZE_4K);
+    assert(vfs_stat(TEST_TMPFS_PATH, &st) == 0 && st.type == ST_DIR);
+
+    /* The directory lists files in the order they were created */
+    assert(vfs_open(TEST_TMPFS_PATH "/other", VFS_O_WRITE | VFS_O_CREATE, &file) == 0);
+    assert(vfs_close(file) == 0);
+    char name[NAME_MAX + 1];
+    assert(vfs_getdirent(TEST_TMPFS_PATH, 0, name, sizeof(name), &st) == strlen("file"));
+    assert(strcmp(name, "file") == 0 && st.size == far + PAGE_SIZE_4K);
+    assert(vfs_getdirent(TEST_TMPFS_PATH, 1, name, sizeof(name), &st) == strlen("other"));
+    assert(strcmp(name, "other") == 0 && st.size == 0);
+    assert(vfs_getdirent(TEST_TMPFS_PATH, 2, name, sizeof(name), NULL) == 0);
+    assert(vfs_getdirent(TEST_TMPFS_PATH, 3, name, sizeof(name), NULL) == -EINVAL);
+
+    /* Destroying the instance frees every page, which it checks */
+    assert(vfs_unmount(TEST_TMPFS_PATH) == 0);
+    tmpfs_destroy(fs);
+}
+
+void test_tmpfs(void)
+{
+    coroutine_t *co = coroutine_start(tmpfs_test_run, NULL);
+    assert(co != NULL);
+    while (!coroutine_finished(co)) {
+        coroutines_run();
+    }
+    ZF_LOGI("tmpfs test passed!");
+}
+
+/* A stub NFS server with a single file, which holds on to each call until
+ * the test completes it */
+static struct {
+    char file[TEST_NFS_IO_SIZE];
+    /* Offset of a write the server only does half of */
+    uint64_t short_write;
+    /* Calls not yet completed, in the order they were made. A read has no
+     * buf. */
+    struct {
+        uint64_t offset;
+        uint64_t count;
+        char *buf;
+        nfs_cb cb;
+        void *private_data;
+    } pending[CONFIG_SOS_NFS_WINDOW];
+    size_t n_pending;
+} nfs_stub;
+
+static int nfs_stub_call(uint64_t offset, uint64_t count, char *buf, nfs_cb cb, void *private_data)
+{
+    assert(nfs_stub.n_pending < ARRAY_SIZE(nfs_stub.pending));
+    assert(count > 0 && count <= TEST_NFS_IO_CHUNK);
+    nfs_stub.pending[nfs_stub.n_pending++] = (typeof(nfs_stub.pending[0])) {
+        .offset = offset,
+        .count = count,
+        .buf = buf,
+        .cb = cb,
+        .private_data = private_data,
+    };
+    return 0;
+}
+
+static int nfs_stub_pread_async(UNUSED struct nfs_context *nfs, UNUSED struct nfsfh *fh,
+                                uint64_t offset, uint64_t count, nfs_cb cb, void *private_data)
+{
+    return nfs_stub_call(offset, count, NULL, cb, private_data);
+}
+
+static int nfs_stub_pwrite_async(UNUSED struct nfs_context *nfs, UNUSED struct nfsfh *fh,
+                                 uint64_t offset, uint64_t count, char *buf, nfs_cb cb,
+                                 void *private_data)
+{
+    assert(buf != NULL);
+    return nfs_stub_call(offset, count, buf, cb, private_data);
+}
+
+static uint64_t nfs_stub_max(UNUSED struct nfs_context *nfs)
+{
+    return TEST_NFS_IO_CHUNK;
+}
+
+static const nfs_io_ops_t nfs_stub_ops = {
+    .pread_async = nfs_stub_pread_async,
+    .pwrite_async = nfs_stub_pwrite_async,
+    .readmax = nfs_stub_max,
+    .writemax = nfs_stub_max,
+};
+
+/* Complete the most recent call. A read past the end of the file and the
+ * short write come back short. */
+static void nfs_stub_complete(void)
+{
+    assert(nfs_stub.n_pending > 0);
+    typeof(nfs_stub.pending[0]) call = nfs_stub.pending[--nfs_stub.n_pending];
+
+    if (call.buf == NULL) {
+        uint64_t len = 0;
+        if (call.offset < TEST_NFS_IO_SIZE) {
+            len = MIN(call.count, TEST_NFS_IO_SIZE - call.offset);
+        }
+        call.cb(len, NULL, nfs_stub.file + MIN(call.offset, TEST_NFS_IO_SIZE), call.private_data);
+    } else {
+        uint64_t len = call.offset == nfs_stub.short_write ? call.count / 2 : call.count;
+        assert(call.offset + len <= TEST_NFS_IO_SIZE);
+        memcpy(nfs_stub.file + call.offset, call.buf, len);
+        call.cb(len, NULL, NULL, call.private_data);
+    }
+}
+
+typedef struct {
+    bool write;
+    uint64_t offset;
+    char *buf;
+    size_t count;
+    ssize_t result;
+} nfs_io_test_t;
+
+static void nfs_io_test_run(void *arg)
+{
+    nfs_io_test_t *test = arg;
+    if (test->write) {
+        test->result = nfs_io_pwrite(NULL, NULL, test->offset, test->buf, test->count);
+    } else {
+        test->result = nfs_io_pread(NULL, NULL, test->offset, test->buf, test->count);
+    }
+}
+
+static ssize_t nfs_io_test_transfer(bool write, uint64_t offset, char *buf, size_t count)
+{
+    nfs_io_test_t test = {
+        .write = write,
+        .offset = offset,
+        .buf = buf,
+        .count = count,
+    };
+    coroutine_t *co = coroutine_start(nfs_io_test_run, &test);
+    assert(co != NULL);
+
+    /* Complete every call newest first, so chunks come back in the reverse
+     * of the order they were sent in, then let the transfer send more */
+    while (!coroutine_finished(co)) {
+        assert(nfs_stub.n_pending > 0);
+        while (nfs_stub.n_pending > 0) {
+            nfs_stub_complete();
+        }
+        coroutines_run();
+    }
+    assert(nfs_stub.n_pending == 0);
+    return test.result;
+}
+
+void test_nfs_io(void)
+{
+    static char data[TEST_NFS_IO_SIZE], buf[2 * TEST_NFS_IO_SIZE];
+    for (size_t i = 0; i < TEST_NFS_IO_SIZE; i++) {
+        nfs_stub.file[i] = 'a' + i % 26;
+        data[i] = 'A' + i % 26;
+    }
+    nfs_stub.short_write = UINT64_MAX;
+    nfs_io_set_ops(&nfs_stub_ops);
+
+    /* A read past the end of the file is as long as the file, though the
+     * chunks after the end come back empty before the one it ends in */
+    assert(nfs_io_test_transfer(false, 0, buf, sizeof(buf)) == TEST_NFS_IO_SIZE);
+    assert(memcmp(buf, nfs_stub.file, TEST_NFS_IO_SIZE) == 0);
+
+    /* Each chunk lands in its place, from an offset within a chunk */
+    memset(buf, 0, sizeof(buf));
+    assert(nfs_io_test_transfer(false, 30, buf, 5 * TEST_NFS_IO_CHUNK) == 5 * TEST_NFS_IO_CHUNK);
+    assert(memcmp(buf, nfs_stub.file + 30, 5 * TEST_NFS_IO_CHUNK) == 0);
+
+    /* A short write ends the result, though the chunks after it completed
+     * in full first */
+    nfs_stub.short_write = 4 * TEST_NFS_IO_CHUNK;
+    ssize_t written = nfs_io_test_transfer(true, 0, data, TEST_NFS_IO_SIZE);
+    assert(written == 4 * TEST_NFS_IO_CHUNK + TEST_NFS_IO_CHUNK / 2);
+    assert(memcmp(nfs_stub.file, data, written) == 0);
+
+    nfs_io_set_ops(NULL);
+    ZF_LOGI("NFS I/O test passed!");
 }
 
 void run_tests(cspace_t *cspace)
@@ -200,4 +616,8 @@ void run_tests(cspace_t *cspace)
     /* test frame table */
     test_frame_table();
     ZF_LOGI("Frame table test passed!");
+
+    /* test the timer wheel */
+    test_timer_wheel();
+    ZF_LOGI("Timer wheel test passed!");
 }
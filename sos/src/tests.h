@@ -12,3 +12,16 @@
 #pragma once
 
 void run_tests(cspace_t *cspace);
+
+/* Compare the cost of the clock sources (SosBenchmarkClock). Must run after
+ * start_timer(). */
+void benchmark_clock(void);
+
+/* Test tmpfs through the VFS, on an instance of its own. Must be called
+ * from the event loop, once the coroutines are set up. */
+void test_tmpfs(void);
+
+/* Test pipelined NFS transfers against a stub server that completes chunks
+ * out of order and short. Must be called from the event loop, once the
+ * coroutines are set up. */
+void test_nfs_io(void);
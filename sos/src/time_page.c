@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "time_page.h"
+
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <aos/time_page.h>
+#include <clock/clock.h>
+#include <clock/timestamp.h>
+
+#include "frame_table.h"
+#include "mapping.h"
+#include "vmem_layout.h"
+
+#define TIME_PAGE_NS_SHIFT 32
+
+compile_time_assert(time_page_vaddr, PROCESS_TIME_PAGE == SOS_TIME_PAGE_VADDR);
+compile_time_assert(time_page_size, sizeof(sos_time_page_t) <= PAGE_SIZE_4K);
+
+static frame_ref_t time_frame = NULL_FRAME;
+static sos_time_page_t *time_page;
+
+void time_page_init(void)
+{
+    time_frame = alloc_frame();
+    ZF_LOGF_IF(time_frame == NULL_FRAME, "Failed to allocate time page");
+    memset(frame_data(time_frame), 0, PAGE_SIZE_4K);
+    time_page = (sos_time_page_t *) frame_data(time_frame);
+
+    uint64_t freq = timestamp_get_freq();
+    ZF_LOGF_IF(freq == 0, "Generic counter frequency is not set");
+    time_page->cnt_freq = freq;
+    time_page->ns_shift = TIME_PAGE_NS_SHIFT;
+    time_page->ns_mult = ((unsigned __int128) NS_IN_S << TIME_PAGE_NS_SHIFT) / freq;
+
+    /* get_time() is either read from the generic counter or from a timer
+     * driven by the same crystal, so the two cannot drift apart and the page
+     * is only ever written here. Sample both as close together as possible. */
+    time_page->cnt_base = timestamp_ticks();
+    time_page->boot_offset_ns = get_time() * NS_IN_US;
+}
+
+seL4_Error time_page_map(cspace_t *cspace, seL4_CPtr vspace)
+{
+    seL4_CPtr cap = cspace_alloc_slot(cspace);
+    if (cap == seL4_CapNull) {
+        ZF_LOGE("Failed to alloc slot for time page");
+        return seL4_NotEnoughMemory;
+    }
+
+    seL4_Error err = cspace_copy(cspace, cap, frame_table_cspace(), frame_page(time_frame), seL4_CanRead);
+    if (err != seL4_NoError) {
+        cspace_free_slot(cspace, cap);
+        ZF_LOGE("Failed to copy time page cap");
+        return err;
+    }
+
+    err = map_frame(cspace, cap, vspace, PROCESS_TIME_PAGE, seL4_CanRead, seL4_ARM_Default_VMAttributes);
+    if (err != seL4_NoError) {
+        cspace_delete(cspace, cap);
+        cspace_free_slot(cspace, cap);
+        ZF_LOGE("Failed to map time page");
+    }
+    return err;
+}
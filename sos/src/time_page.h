@@ -0,0 +1,36 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The time page: a frame SOS shares read-only with every process, from
+ * which libsosapi reads the time without a syscall. See <aos/time_page.h>
+ * for its layout.
+ */
+
+#include <sel4/sel4.h>
+#include <cspace/cspace.h>
+
+/*
+ * Allocate the time page and calibrate it against the SOS timer. Must be
+ * called after start_timer().
+ */
+void time_page_init(void);
+
+/*
+ * Map the time page read-only into a process at PROCESS_TIME_PAGE.
+ *
+ * @param cspace  cspace to allocate the slot for the mapped cap in.
+ * @param vspace  vspace of the process.
+ * @return        seL4_NoError on success.
+ */
+seL4_Error time_page_map(cspace_t *cspace, seL4_CPtr vspace);
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "timer_thread.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <clock/clock.h>
+#include <aos/sel4_zf_logif.h>
+
+#include "channel.h"
+#include "threads.h"
+#include "utils.h"
+
+/* Badge of the timer thread's endpoint cap, clear of the worker's badge */
+#define TIMER_THREAD_BADGE  0x2000
+
+/* Each coroutine has at most one wakeup outstanding, so this never fills */
+#define TIMER_WAKEUP_QUEUE_SIZE (CONFIG_SOS_COROUTINE_POOL_SIZE + 1)
+
+typedef struct {
+    timer_callback_t callback;
+    uint32_t id;
+    void *data;
+} expired_timer_t;
+
+CHANNEL_DEFINE_HEADER(expired, expired_timer_t, TIMER_THREAD_QUEUE_SIZE)
+CHANNEL_DEFINE_SOURCE(expired, expired_timer_t, TIMER_THREAD_QUEUE_SIZE)
+
+CHANNEL_DEFINE_HEADER(wakeup, coroutine_t *, TIMER_WAKEUP_QUEUE_SIZE)
+CHANNEL_DEFINE_SOURCE(wakeup, coroutine_t *, TIMER_WAKEUP_QUEUE_SIZE)
+
+static struct {
+    sos_thread_t *thread;
+    /* Signalled when a callback is queued */
+    seL4_CPtr ntfn;
+    CHANNEL_TYPE(expired) *queue;
+    /* Coroutines to be woken by the event loop */
+    CHANNEL_TYPE(wakeup) *wakeups;
+    /* Held as a binary semaphore: signalled while libclock is unlocked */
+    seL4_CPtr lock_ntfn;
+} timer_thread;
+
+static void timer_thread_main(UNUSED void *arg)
+{
+    while (true) {
+        while (CHANNEL_IS_EMPTY(expired, timer_thread.queue)) {
+            seL4_Wait(timer_thread.ntfn, NULL);
+        }
+        expired_timer_t timer = CHANNEL_RECV(expired, timer_thread.queue);
+        timer.callback(timer.id, timer.data);
+    }
+}
+
+/* Called from timer_irq(), which does not hold the libclock lock while it
+ * is here. This only blocks if the timer thread has fallen a whole queue
+ * behind, which bounds how far behind it can get. */
+static void queue_callback(timer_callback_t callback, uint32_t id, void *data)
+{
+    expired_timer_t timer = { .callback = callback, .id = id, .data = data };
+    CHANNEL_SEND(expired, timer_thread.queue, timer);
+}
+
+static void clock_lock(void)
+{
+    seL4_Wait(timer_thread.lock_ntfn, NULL);
+}
+
+static void clock_unlock(void)
+{
+    seL4_Signal(timer_thread.lock_ntfn);
+}
+
+void timer_thread_init(seL4_CPtr ntfn)
+{
+    ut_t *ut = alloc_retype(&timer_thread.ntfn, seL4_NotificationObject, seL4_NotificationBits);
+    ZF_LOGF_IF(ut == NULL, "Failed to allocate timer thread notification");
+    ut = alloc_retype(&timer_thread.lock_ntfn, seL4_NotificationObject, seL4_NotificationBits);
+    ZF_LOGF_IF(ut == NULL, "Failed to allocate timer lock notification");
+    clock_unlock();
+
+    timer_thread.queue = CHANNEL_CREATE(expired, timer_thread.ntfn);
+    ZF_LOGF_IF(timer_thread.queue == NULL, "Failed to create timer thread queue");
+    timer_thread.wakeups = CHANNEL_CREATE(wakeup, ntfn);
+    ZF_LOGF_IF(timer_thread.wakeups == NULL, "Failed to create timer wakeup queue");
+
+    timer_set_lock(clock_lock, clock_unlock);
+
+    timer_thread.thread = spawn(timer_thread_main, NULL, TIMER_THREAD_BADGE, true);
+    ZF_LOGF_IF(timer_thread.thread == NULL, "Failed to spawn timer thread");
+
+    timer_set_dispatch(queue_callback);
+}
+
+void timer_thread_wakeup(coroutine_t *co)
+{
+    /* Blocking here could deadlock with timer_irq() waiting for the thread */
+    ZF_LOGF_IF(CHANNEL_IS_FULL(wakeup, timer_thread.wakeups), "Too many timer wakeups outstanding");
+    CHANNEL_SEND(wakeup, timer_thread.wakeups, co);
+}
+
+void timer_thread_run_wakeups(void)
+{
+    while (!CHANNEL_IS_EMPTY(wakeup, timer_thread.wakeups)) {
+        coroutine_wakeup(CHANNEL_RECV(wakeup, timer_thread.wakeups));
+    }
+}
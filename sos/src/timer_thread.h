@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * A SOS thread that runs timer callbacks.
+ *
+ * Once started, timer_irq() only advances the timer wheel and queues the
+ * callbacks of expired timers on a channel (see channel.h). The timer
+ * thread runs them, so the time spent in the IRQ handler no longer depends
+ * on what the callbacks do.
+ *
+ * libclock is then used from two threads, so it is given a lock (see
+ * timer_set_lock()). Callbacks may register and remove timers, but must
+ * not touch other event loop state. A callback that completes an event a
+ * coroutine waits on wakes it with timer_callback_wakeup(), which hands the
+ * wakeup back to the event loop.
+ */
+
+#include <sel4/sel4.h>
+#include <sos/gen_config.h>
+
+#include "coroutine.h"
+
+/* Number of expired callbacks that can be queued for the timer thread */
+#define TIMER_THREAD_QUEUE_SIZE 64
+
+/*
+ * Spawn the timer thread and route timer callbacks to it. Must be called
+ * after start_timer() and before any timer is registered.
+ *
+ * @param ntfn  Notification that the timer thread signals when it hands a
+ *              wakeup back to the event loop. It should be badged so the
+ *              event loop can recognise it.
+ */
+void timer_thread_init(seL4_CPtr ntfn);
+
+/*
+ * Wake a coroutine from the timer thread. The coroutine is woken by the
+ * event loop in timer_thread_run_wakeups().
+ *
+ * A coroutine may have only one such wakeup outstanding at a time.
+ */
+void timer_thread_wakeup(coroutine_t *co);
+
+/*
+ * Wake the coroutines handed back by the timer thread. Called by the event
+ * loop before coroutines_run().
+ */
+void timer_thread_run_wakeups(void);
+
+/*
+ * Wake a coroutine from a timer callback, wherever timer callbacks run.
+ */
+static inline void timer_callback_wakeup(coroutine_t *co)
+{
+#ifdef CONFIG_SOS_TIMER_THREAD
+    timer_thread_wakeup(co);
+#else
+    coroutine_wakeup(co);
+#endif /* CONFIG_SOS_TIMER_THREAD */
+}
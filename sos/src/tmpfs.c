@@ -0,0 +1,333 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "tmpfs.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <utils/time.h>
+#include <aos/sos_abi.h>
+#include <clock/clock.h>
+#include <sos/gen_config.h>
+
+#include "frame_table.h"
+
+#define TMPFS_PAGES         CONFIG_SOS_TMPFS_PAGES
+
+/* Each interior node of a radix tree is a frame of child frame refs */
+#define RADIX_SLOTS         (PAGE_SIZE_4K / sizeof(frame_ref_t))
+/* Enough for files far larger than TMPFS_PAGES */
+#define RADIX_MAX_HEIGHT    6
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    uint64_t size;
+    /* The root of the radix tree of the file's pages. A tree of height 0 is
+     * empty, one of height 1 is a single page, and each level above that
+     * holds RADIX_SLOTS subtrees. NULL_FRAME is a missing subtree or page. */
+    frame_ref_t root;
+    unsigned int height;
+    int64_t ctime_ms;
+    int64_t atime_ms;
+} tmpfs_file_t;
+
+struct tmpfs {
+    /* In order of creation, which is the order they are listed in */
+    tmpfs_file_t **files;
+    size_t n_files;
+    size_t max_files;
+    size_t n_pages;
+};
+
+static int64_t now_ms(void)
+{
+    return get_time() / US_IN_MS;
+}
+
+/* A zeroed frame, counted against the tmpfs limit */
+static frame_ref_t page_alloc(tmpfs_t *fs)
+{
+    if (fs->n_pages >= TMPFS_PAGES) {
+        return NULL_FRAME;
+    }
+
+    frame_ref_t frame = alloc_frame();
+    if (frame != NULL_FRAME) {
+        memset(frame_data(frame), 0, PAGE_SIZE_4K);
+        fs->n_pages++;
+    }
+    return frame;
+}
+
+/* Pages covered by a tree of the given height */
+static uint64_t radix_capacity(unsigned int height)
+{
+    uint64_t capacity = height > 0 ? 1 : 0;
+    for (unsigned int level = 1; level < height; level++) {
+        capacity *= RADIX_SLOTS;
+    }
+    return capacity;
+}
+
+/*
+ * Find page index of a file. If alloc is set, the page and any tree nodes
+ * above it are added if missing, growing the tree upwards as needed.
+ *
+ * @return  the page, or NULL_FRAME if it is missing or could not be added.
+ */
+static frame_ref_t radix_page(tmpfs_t *fs, tmpfs_file_t *file, uint64_t index, bool alloc)
+{
+    while (index >= radix_capacity(file->height)) {
+        if (!alloc || file->height == RADIX_MAX_HEIGHT) {
+            return NULL_FRAME;
+        }
+        /* Add a level above, with the old tree as its first subtree */
+        frame_ref_t node = page_alloc(fs);
+        if (node == NULL_FRAME) {
+            return NULL_FRAME;
+        }
+        if (file->height > 0) {
+            ((frame_ref_t *) frame_data(node))[0] = file->root;
+        }
+        file->root = node;
+        file->height++;
+    }
+
+    frame_ref_t node = file->root;
+    for (unsigned int level = file->height; level > 1; level--) {
+        uint64_t span = radix_capacity(level - 1);
+        frame_ref_t *slot = &((frame_ref_t *) frame_data(node))[(index / span) % RADIX_SLOTS];
+        if (*slot == NULL_FRAME) {
+            if (!alloc) {
+                return NULL_FRAME;
+            }
+            *slot = page_alloc(fs);
+            if (*slot == NULL_FRAME) {
+                return NULL_FRAME;
+            }
+        }
+        node = *slot;
+    }
+    return node;
+}
+
+/* Free a subtree of the given height, and the pages under it */
+static void radix_free(tmpfs_t *fs, frame_ref_t node, unsigned int height)
+{
+    if (node == NULL_FRAME) {
+        return;
+    }
+    if (height > 1) {
+        frame_ref_t *slots = (frame_ref_t *) frame_data(node);
+        for (size_t i = 0; i < RADIX_SLOTS; i++) {
+            radix_free(fs, slots[i], height - 1);
+        }
+    }
+    free_frame(node);
+    fs->n_pages--;
+}
+
+static void file_stat(tmpfs_file_t *file, vfs_stat_t *st)
+{
+    st->type = ST_FILE;
+    st->mode = 0666;
+    st->size = file->size;
+    st->ctime_ms = file->ctime_ms;
+    st->atime_ms = file->atime_ms;
+}
+
+static tmpfs_file_t *file_create(tmpfs_t *fs, const char *name)
+{
+    if (fs->n_files == fs->max_files) {
+        size_t max = fs->max_files == 0 ? 16 : fs->max_files * 2;
+        tmpfs_file_t **files = realloc(fs->files, max * sizeof(*files));
+        if (files == NULL) {
+            return NULL;
+        }
+        fs->files = files;
+        fs->max_files = max;
+    }
+
+    tmpfs_file_t *file = calloc(1, sizeof(*file));
+    if (file != NULL) {
+        strcpy(file->name, name);
+        file->ctime_ms = now_ms();
+        file->atime_ms = file->ctime_ms;
+        fs->files[fs->n_files++] = file;
+    }
+    return file;
+}
+
+/* The vnode data of a file is its tmpfs_file_t, and of the directory NULL */
+static int tmpfs_lookup(vfs_t *vfs, const char *path, int flags, vnode_t *vn)
+{
+    tmpfs_t *fs = vfs->data;
+
+    if (path[0] == '\0') {
+        vn->data = NULL;
+        return 0;
+    }
+    if (strchr(path, '/') != NULL) {
+        /* There are no subdirectories */
+        return -ENOENT;
+    }
+    if (strlen(path) > NAME_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    for (size_t i = 0; i < fs->n_files; i++) {
+        if (strcmp(fs->files[i]->name, path) == 0) {
+            vn->data = fs->files[i];
+            return 0;
+        }
+    }
+    if (!(flags & VFS_O_CREATE)) {
+        return -ENOENT;
+    }
+
+    vn->data = file_create(fs, path);
+    return vn->data != NULL ? 0 : -ENOMEM;
+}
+
+static int tmpfs_open(vnode_t *vn, int flags)
+{
+    return vn->data == NULL && (flags & VFS_O_WRITE) ? -EISDIR : 0;
+}
+
+static ssize_t tmpfs_read(vnode_t *vn, uint64_t offset, void *buf, size_t count)
+{
+    tmpfs_file_t *file = vn->data;
+    if (file == NULL) {
+        return -EISDIR;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+
+    count = MIN(count, file->size - offset);
+    size_t done = 0;
+    while (done < count) {
+        uint64_t pos = offset + done;
+        size_t page_offset = pos % PAGE_SIZE_4K;
+        size_t len = MIN(PAGE_SIZE_4K - page_offset, count - done);
+
+        frame_ref_t page = radix_page(vn->fs->data, file, pos / PAGE_SIZE_4K, false);
+        if (page == NULL_FRAME) {
+            memset((char *) buf + done, 0, len);
+        } else {
+            memcpy((char *) buf + done, frame_data(page) + page_offset, len);
+        }
+        done += len;
+    }
+
+    file->atime_ms = now_ms();
+    return done;
+}
+
+static ssize_t tmpfs_write(vnode_t *vn, uint64_t offset, const void *buf, size_t count)
+{
+    tmpfs_file_t *file = vn->data;
+    if (file == NULL) {
+        return -EISDIR;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t pos = offset + done;
+        size_t page_offset = pos % PAGE_SIZE_4K;
+        size_t len = MIN(PAGE_SIZE_4K - page_offset, count - done);
+
+        frame_ref_t page = radix_page(vn->fs->data, file, pos / PAGE_SIZE_4K, true);
+        if (page == NULL_FRAME) {
+            break;
+        }
+        memcpy(frame_data(page) + page_offset, (const char *) buf + done, len);
+        done += len;
+    }
+
+    if (done == 0 && count > 0) {
+        return -ENOSPC;
+    }
+    file->size = MAX(file->size, offset + done);
+    return done;
+}
+
+static int tmpfs_stat(vnode_t *vn, vfs_stat_t *st)
+{
+    tmpfs_file_t *file = vn->data;
+    if (file == NULL) {
+        *st = (vfs_stat_t) {
+            .type = ST_DIR,
+            .mode = 0777,
+        };
+        return 0;
+    }
+    file_stat(file, st);
+    return 0;
+}
+
+static ssize_t tmpfs_getdirent(vnode_t *vn, size_t pos, char *name, size_t nbyte,
+                               vfs_stat_t *st)
+{
+    tmpfs_t *fs = vn->fs->data;
+    if (vn->data != NULL) {
+        return -ENOTDIR;
+    }
+    if (pos > fs->n_files || nbyte == 0) {
+        return -EINVAL;
+    }
+    if (pos == fs->n_files) {
+        return 0;
+    }
+
+    tmpfs_file_t *file = fs->files[pos];
+    size_t len = MIN(strlen(file->name), nbyte - 1);
+    memcpy(name, file->name, len);
+    name[len] = '\0';
+    if (st != NULL) {
+        file_stat(file, st);
+    }
+    return len;
+}
+
+const vnode_ops_t tmpfs_ops = {
+    .lookup = tmpfs_lookup,
+    .open = tmpfs_open,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .stat = tmpfs_stat,
+    .getdirent = tmpfs_getdirent,
+};
+
+tmpfs_t *tmpfs_create(void)
+{
+    return calloc(1, sizeof(tmpfs_t));
+}
+
+void tmpfs_destroy(tmpfs_t *fs)
+{
+    for (size_t i = 0; i < fs->n_files; i++) {
+        radix_free(fs, fs->files[i]->root, fs->files[i]->height);
+        free(fs->files[i]);
+    }
+    assert(fs->n_pages == 0);
+    free(fs->files);
+    free(fs);
+}
+
+size_t tmpfs_pages(tmpfs_t *fs)
+{
+    return fs->n_pages;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * An in-memory filesystem, for mounting in the VFS (see vfs.h).
+ *
+ * It is a single flat directory of files. Each file's pages are frame
+ * table frames found through a radix tree, whose nodes are frames too, so
+ * unwritten parts of a file cost no memory and read as zeros. At most
+ * CONFIG_SOS_TMPFS_PAGES frames are used by each instance, counting the
+ * tree nodes.
+ *
+ * Each instance is a tmpfs_t, passed to vfs_mount() as the filesystem
+ * data. Files last until the instance is destroyed. Times are
+ * milliseconds since boot, as SOS has no real time clock. No operation
+ * blocks.
+ */
+
+#include <stddef.h>
+
+#include "vfs.h"
+
+typedef struct tmpfs tmpfs_t;
+
+extern const vnode_ops_t tmpfs_ops;
+
+/*
+ * Create an empty instance.
+ *
+ * @return  the instance, or NULL if out of memory.
+ */
+tmpfs_t *tmpfs_create(void);
+
+/*
+ * Free an instance and every file in it. It must be unmounted first (see
+ * vfs_unmount()).
+ */
+void tmpfs_destroy(tmpfs_t *fs);
+
+/*
+ * @return  the frames the instance's files use, counting tree nodes.
+ */
+size_t tmpfs_pages(tmpfs_t *fs);
@@ -0,0 +1,441 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "vfs.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <sos/gen_config.h>
+
+#define VFS_MOUNTS          8
+#define VFS_DENTRIES        CONFIG_SOS_VFS_DENTRIES
+#define VFS_DENTRY_BUCKETS  256
+
+typedef struct {
+    /* In the form made by path_canon(), or NULL for a free slot */
+    char *path;
+    size_t len;
+    vfs_t fs;
+    /* Vnodes of the filesystem, which must all be gone to unmount it */
+    size_t vnodes;
+} mount_t;
+
+typedef struct dentry dentry_t;
+struct dentry {
+    char *path;
+    vnode_t *vn;
+    dentry_t *hash_next;
+    dentry_t *lru_prev;
+    dentry_t *lru_next;
+};
+
+static struct {
+    /* Vnodes point into their mount's slot, so slots never move */
+    mount_t mounts[VFS_MOUNTS];
+    dentry_t *buckets[VFS_DENTRY_BUCKETS];
+    /* Most recently used first */
+    dentry_t *lru_head;
+    dentry_t *lru_tail;
+    size_t n_dentries;
+} vfs;
+
+/* Write path as its components joined by "/", without "." or empty ones */
+static int path_canon(const char *path, char out[PATH_MAX])
+{
+    size_t len = 0;
+    while (*path != '\0') {
+        const char *end = path;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+
+        size_t n = end - path;
+        if (n > 0 && !(n == 1 && path[0] == '.')) {
+            if (len + 1 + n >= PATH_MAX) {
+                return -ENAMETOOLONG;
+            }
+            if (len > 0) {
+                out[len++] = '/';
+            }
+            memcpy(out + len, path, n);
+            len += n;
+        }
+        path = *end == '/' ? end + 1 : end;
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+/* Whether path is prefix or lies under it */
+static bool path_under(const char *path, const char *prefix, size_t prefix_len)
+{
+    if (prefix_len == 0) {
+        return true;
+    }
+    return strncmp(path, prefix, prefix_len) == 0 &&
+           (path[prefix_len] == '\0' || path[prefix_len] == '/');
+}
+
+/* Find the mount holding path, and the rest of the path below it */
+static mount_t *mount_find(const char *path, const char **rest)
+{
+    mount_t *found = NULL;
+    for (size_t i = 0; i < VFS_MOUNTS; i++) {
+        mount_t *mount = &vfs.mounts[i];
+        if (mount->path != NULL && path_under(path, mount->path, mount->len) &&
+            (found == NULL || mount->len > found->len)) {
+            found = mount;
+        }
+    }
+
+    if (found != NULL) {
+        *rest = path + found->len;
+        if (**rest == '/') {
+            (*rest)++;
+        }
+    }
+    return found;
+}
+
+static mount_t *mount_of(vfs_t *fs)
+{
+    return (mount_t *) ((char *) fs - offsetof(mount_t, fs));
+}
+
+static dentry_t **dentry_bucket(const char *path)
+{
+    unsigned long hash = 5381;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char) *c;
+    }
+    return &vfs.buckets[hash % VFS_DENTRY_BUCKETS];
+}
+
+static void dentry_lru_remove(dentry_t *dentry)
+{
+    if (dentry->lru_prev != NULL) {
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    } else {
+        vfs.lru_head = dentry->lru_next;
+    }
+    if (dentry->lru_next != NULL) {
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    } else {
+        vfs.lru_tail = dentry->lru_prev;
+    }
+}
+
+static void dentry_lru_push(dentry_t *dentry)
+{
+    dentry->lru_prev = NULL;
+    dentry->lru_next = vfs.lru_head;
+    if (vfs.lru_head != NULL) {
+        vfs.lru_head->lru_prev = dentry;
+    } else {
+        vfs.lru_tail = dentry;
+    }
+    vfs.lru_head = dentry;
+}
+
+static dentry_t *dentry_find(const char *path)
+{
+    for (dentry_t *dentry = *dentry_bucket(path); dentry != NULL; dentry = dentry->hash_next) {
+        if (strcmp(dentry->path, path) == 0) {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+/* Drop a dentry and its reference to the vnode, which may block */
+static void dentry_remove(dentry_t *dentry)
+{
+    dentry_t **prev = dentry_bucket(dentry->path);
+    while (*prev != dentry) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = dentry->hash_next;
+    dentry_lru_remove(dentry);
+    vfs.n_dentries--;
+
+    vnode_t *vn = dentry->vn;
+    free(dentry->path);
+    free(dentry);
+    vfs_put(vn);
+}
+
+/*
+ * Evict the least recently used dentries to make room for one more. Dentries
+ * of vnodes in use elsewhere are kept, so that a path always resolves to the
+ * same vnode while it is open; the cache grows past its limit if all are.
+ */
+static void dentry_make_room(void)
+{
+    while (vfs.n_dentries >= VFS_DENTRIES) {
+        dentry_t *victim = vfs.lru_tail;
+        while (victim != NULL && victim->vn->refs > 1) {
+            victim = victim->lru_prev;
+        }
+        if (victim == NULL) {
+            return;
+        }
+        dentry_remove(victim);
+    }
+}
+
+static void dentry_insert(const char *path, vnode_t *vn)
+{
+    dentry_t *dentry = malloc(sizeof(*dentry));
+    char *copy = strdup(path);
+    if (dentry == NULL || copy == NULL) {
+        free(dentry);
+        free(copy);
+        return;
+    }
+
+    dentry->path = copy;
+    dentry->vn = vn;
+    vn->refs++;
+    dentry_t **bucket = dentry_bucket(path);
+    dentry->hash_next = *bucket;
+    *bucket = dentry;
+    dentry_lru_push(dentry);
+    vfs.n_dentries++;
+}
+
+int vfs_mount(const char *path, const vnode_ops_t *ops, void *data)
+{
+    char canon[PATH_MAX];
+    int err = path_canon(path, canon);
+    if (err != 0) {
+        return err;
+    }
+    mount_t *mount = NULL;
+    for (size_t i = 0; i < VFS_MOUNTS; i++) {
+        if (vfs.mounts[i].path == NULL) {
+            mount = mount != NULL ? mount : &vfs.mounts[i];
+        } else if (strcmp(vfs.mounts[i].path, canon) == 0) {
+            return -EBUSY;
+        }
+    }
+    if (mount == NULL) {
+        return -ENOMEM;
+    }
+    /* Paths under the mount point would be resolved by the wrong filesystem */
+    for (dentry_t *dentry = vfs.lru_head; dentry != NULL; dentry = dentry->lru_next) {
+        if (path_under(dentry->path, canon, strlen(canon))) {
+            return -EBUSY;
+        }
+    }
+
+    mount->path = strdup(canon);
+    if (mount->path == NULL) {
+        return -ENOMEM;
+    }
+    mount->len = strlen(canon);
+    mount->fs.ops = ops;
+    mount->fs.data = data;
+    mount->vnodes = 0;
+    return 0;
+}
+
+int vfs_unmount(const char *path)
+{
+    char canon[PATH_MAX];
+    int err = path_canon(path, canon);
+    if (err != 0) {
+        return err;
+    }
+    mount_t *mount = NULL;
+    for (size_t i = 0; i < VFS_MOUNTS; i++) {
+        if (vfs.mounts[i].path != NULL && strcmp(vfs.mounts[i].path, canon) == 0) {
+            mount = &vfs.mounts[i];
+        }
+    }
+    if (mount == NULL) {
+        return -EINVAL;
+    }
+
+    /* Drop the cached dentries of vnodes no one else holds. Dropping one
+     * may block, so start again from the head after each. */
+    dentry_t *dentry = vfs.lru_head;
+    while (dentry != NULL) {
+        dentry_t *next = dentry->lru_next;
+        if (dentry->vn->fs == &mount->fs && dentry->vn->refs == 1) {
+            dentry_remove(dentry);
+            next = vfs.lru_head;
+        }
+        dentry = next;
+    }
+    if (mount->vnodes > 0) {
+        return -EBUSY;
+    }
+
+    free(mount->path);
+    mount->path = NULL;
+    return 0;
+}
+
+int vfs_lookup(const char *path, int flags, vnode_t **vn)
+{
+    char canon[PATH_MAX];
+    int err = path_canon(path, canon);
+    if (err != 0) {
+        return err;
+    }
+
+    dentry_t *dentry = dentry_find(canon);
+    if (dentry != NULL) {
+        dentry_lru_remove(dentry);
+        dentry_lru_push(dentry);
+        dentry->vn->refs++;
+        *vn = dentry->vn;
+        return 0;
+    }
+
+    const char *rest;
+    mount_t *mount = mount_find(canon, &rest);
+    if (mount == NULL) {
+        return -ENOENT;
+    }
+
+    vnode_t *new = calloc(1, sizeof(*new));
+    if (new == NULL) {
+        return -ENOMEM;
+    }
+    new->fs = &mount->fs;
+    new->ops = mount->fs.ops;
+    new->refs = 1;
+    err = new->ops->lookup(&mount->fs, rest, flags, new);
+    if (err != 0) {
+        free(new);
+        return err;
+    }
+    mount->vnodes++;
+
+    dentry_make_room();
+
+    /* Another coroutine may have resolved the path while this one waited */
+    dentry = dentry_find(canon);
+    if (dentry != NULL) {
+        dentry->vn->refs++;
+        *vn = dentry->vn;
+        vfs_put(new);
+        return 0;
+    }
+
+    dentry_insert(canon, new);
+    *vn = new;
+    return 0;
+}
+
+void vfs_put(vnode_t *vn)
+{
+    assert(vn->refs > 0);
+    if (--vn->refs == 0) {
+        assert(vn->opens == 0);
+        if (vn->ops->reclaim != NULL) {
+            vn->ops->reclaim(vn);
+        }
+        mount_of(vn->fs)->vnodes--;
+        free(vn);
+    }
+}
+
+int vfs_open(const char *path, int flags, vfs_file_t **file)
+{
+    vnode_t *vn;
+    int err = vfs_lookup(path, flags, &vn);
+    if (err != 0) {
+        return err;
+    }
+
+    *file = malloc(sizeof(**file));
+    err = *file == NULL ? -ENOMEM : vn->ops->open(vn, flags);
+    if (err != 0) {
+        free(*file);
+        vfs_put(vn);
+        return err;
+    }
+
+    vn->opens++;
+    (*file)->vn = vn;
+    (*file)->flags = flags;
+    (*file)->offset = 0;
+    return 0;
+}
+
+ssize_t vfs_read(vfs_file_t *file, void *buf, size_t count)
+{
+    if (!(file->flags & VFS_O_READ)) {
+        return -EBADF;
+    }
+    ssize_t ret = file->vn->ops->read(file->vn, file->offset, buf, count);
+    if (ret > 0) {
+        file->offset += ret;
+    }
+    return ret;
+}
+
+ssize_t vfs_write(vfs_file_t *file, const void *buf, size_t count)
+{
+    if (!(file->flags & VFS_O_WRITE)) {
+        return -EBADF;
+    }
+    if (file->vn->ops->write == NULL) {
+        return -EROFS;
+    }
+    ssize_t ret = file->vn->ops->write(file->vn, file->offset, buf, count);
+    if (ret > 0) {
+        file->offset += ret;
+    }
+    return ret;
+}
+
+int vfs_close(vfs_file_t *file)
+{
+    vnode_t *vn = file->vn;
+    int err = vn->ops->close != NULL ? vn->ops->close(vn, file->flags) : 0;
+    vn->opens--;
+    free(file);
+    vfs_put(vn);
+    return err;
+}
+
+int vfs_stat(const char *path, vfs_stat_t *st)
+{
+    vnode_t *vn;
+    int err = vfs_lookup(path, 0, &vn);
+    if (err != 0) {
+        return err;
+    }
+    err = vn->ops->stat(vn, st);
+    vfs_put(vn);
+    return err;
+}
+
+ssize_t vfs_getdirent(const char *path, size_t pos, char *name, size_t nbyte, vfs_stat_t *st)
+{
+    vnode_t *vn;
+    ssize_t ret = vfs_lookup(path, 0, &vn);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = vn->ops->getdirent != NULL ? vn->ops->getdirent(vn, pos, name, nbyte, st) : -ENOTDIR;
+    vfs_put(vn);
+    return ret;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The virtual file system.
+ *
+ * Each filesystem provides a table of vnode operations and is mounted at a
+ * path. A path is resolved to a vnode by the filesystem of the longest
+ * mount point that is a prefix of it, and every operation on the vnode is
+ * then a single call through its table.
+ *
+ * Resolved paths are kept in a hashed dentry cache of up to
+ * CONFIG_SOS_VFS_DENTRIES entries, so a path that is opened again is found
+ * without asking the filesystem. Each cache entry holds a reference to its
+ * vnode, and a vnode is reclaimed by its filesystem once nothing refers to
+ * it. A filesystem may keep state on a vnode between opens, such as an open
+ * NFS file handle.
+ *
+ * Paths are relative to the root whether or not they start with "/"; "."
+ * and empty components are ignored. Directory listings do not include the
+ * mount points inside them.
+ *
+ * Filesystem operations may block, so everything here must be called from
+ * a coroutine (see coroutine.h), except vfs_mount().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Flags for vfs_open() and the lookup operation */
+#define VFS_O_READ      1
+#define VFS_O_WRITE     2
+/* Create the file if it does not exist */
+#define VFS_O_CREATE    4
+
+typedef struct {
+    /* ST_FILE, ST_SPECIAL or ST_DIR, from <aos/sos_abi.h> */
+    uint32_t type;
+    /* Unix permission bits */
+    uint32_t mode;
+    uint64_t size;
+    /* Unix times in milliseconds */
+    int64_t ctime_ms;
+    int64_t atime_ms;
+} vfs_stat_t;
+
+typedef struct vfs vfs_t;
+typedef struct vnode vnode_t;
+typedef struct vnode_ops vnode_ops_t;
+
+struct vnode {
+    vfs_t *fs;
+    const vnode_ops_t *ops;
+    /* Owned by the filesystem */
+    void *data;
+    unsigned int refs;
+    /* Open files on the vnode */
+    unsigned int opens;
+};
+
+/*
+ * The operations of a filesystem. Paths passed to lookup are relative to
+ * the mount point, with no leading "/" and "" for the mount point itself.
+ * Errors are negative errno values.
+ */
+struct vnode_ops {
+    /* Fill in vn->data for the file at path, creating it if flags hold
+     * VFS_O_CREATE. Called when the path is not in the dentry cache. */
+    int (*lookup)(vfs_t *fs, const char *path, int flags, vnode_t *vn);
+    /* Prepare the vnode for reading or writing, as flags ask */
+    int (*open)(vnode_t *vn, int flags);
+    ssize_t (*read)(vnode_t *vn, uint64_t offset, void *buf, size_t count);
+    ssize_t (*write)(vnode_t *vn, uint64_t offset, const void *buf, size_t count);
+    int (*stat)(vnode_t *vn, vfs_stat_t *st);
+    /* As nfs_cache_getdirent(), for a directory vnode */
+    ssize_t (*getdirent)(vnode_t *vn, size_t pos, char *name, size_t nbyte, vfs_stat_t *st);
+    /* Called as each open file is closed, with the flags it was opened with */
+    int (*close)(vnode_t *vn, int flags);
+    /* Free vn->data, once nothing refers to the vnode */
+    void (*reclaim)(vnode_t *vn);
+};
+
+struct vfs {
+    const vnode_ops_t *ops;
+    /* Owned by the filesystem */
+    void *data;
+};
+
+typedef struct {
+    vnode_t *vn;
+    int flags;
+    uint64_t offset;
+} vfs_file_t;
+
+/*
+ * Mount a filesystem at path. The path need not exist in the filesystem
+ * above it.
+ *
+ * @return  0 on success, or a negative error.
+ */
+int vfs_mount(const char *path, const vnode_ops_t *ops, void *data);
+
+/*
+ * Unmount the filesystem mounted at path, dropping its cached dentries.
+ * Its data is left to the caller to free.
+ *
+ * @return  0 on success, -EINVAL if nothing is mounted at path, or -EBUSY
+ *          if any of its vnodes are still in use.
+ */
+int vfs_unmount(const char *path);
+
+/*
+ * Resolve path to a vnode, taking a reference to it that must be dropped
+ * with vfs_put().
+ *
+ * @return  0 on success, or a negative error.
+ */
+int vfs_lookup(const char *path, int flags, vnode_t **vn);
+void vfs_put(vnode_t *vn);
+
+/*
+ * Open the file at path. Reads and writes start at offset 0 and advance
+ * the file's offset, which the caller may also set directly.
+ *
+ * @return  0 on success, or a negative error.
+ */
+int vfs_open(const char *path, int flags, vfs_file_t **file);
+ssize_t vfs_read(vfs_file_t *file, void *buf, size_t count);
+ssize_t vfs_write(vfs_file_t *file, const void *buf, size_t count);
+int vfs_close(vfs_file_t *file);
+
+int vfs_stat(const char *path, vfs_stat_t *st);
+ssize_t vfs_getdirent(const char *path, size_t pos, char *name, size_t nbyte, vfs_stat_t *st);
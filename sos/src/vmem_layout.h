@@ -30,5 +30,7 @@
 /* Constants for how SOS will layout the address space of any processes it loads up */
 #define PROCESS_STACK_TOP   		(0x90000000)
 #define PROCESS_IPC_BUFFER  		(0xA0000000)
+/* Read-only page holding the time, see <aos/time_page.h> */
+#define PROCESS_TIME_PAGE   		(0xA0001000)
 #define PROCESS_VMEM_START  		(0xC0000000)
 
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "worker.h"
+
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+
+#include "channel.h"
+#include "threads.h"
+#include "utils.h"
+
+/* Badge of the worker thread's endpoint cap, clear of the process badges */
+#define WORKER_BADGE        0x1000
+
+typedef struct {
+    worker_fn_t fn;
+    void *arg;
+} work_t;
+
+CHANNEL_DEFINE_HEADER(work, work_t, WORKER_QUEUE_SIZE)
+CHANNEL_DEFINE_SOURCE(work, work_t, WORKER_QUEUE_SIZE)
+
+static struct {
+    sos_thread_t *thread;
+    /* Signalled when work is sent on the queue */
+    seL4_CPtr ntfn;
+    CHANNEL_TYPE(work) *queue;
+} worker;
+
+static void worker_main(UNUSED void *arg)
+{
+    while (true) {
+        while (CHANNEL_IS_EMPTY(work, worker.queue)) {
+            seL4_Wait(worker.ntfn, NULL);
+        }
+        work_t work = CHANNEL_RECV(work, worker.queue);
+        work.fn(work.arg);
+    }
+}
+
+void worker_init(void)
+{
+    ut_t *ut = alloc_retype(&worker.ntfn, seL4_NotificationObject, seL4_NotificationBits);
+    ZF_LOGF_IF(ut == NULL, "Failed to allocate worker notification");
+
+    worker.queue = CHANNEL_CREATE(work, worker.ntfn);
+    ZF_LOGF_IF(worker.queue == NULL, "Failed to create worker queue");
+
+    worker.thread = spawn(worker_main, NULL, WORKER_BADGE, true);
+    ZF_LOGF_IF(worker.thread == NULL, "Failed to spawn worker");
+}
+
+bool worker_submit(worker_fn_t fn, void *arg)
+{
+    if (worker.thread == NULL || CHANNEL_IS_FULL(work, worker.queue)) {
+        return false;
+    }
+    CHANNEL_SEND(work, worker.queue, ((work_t) { .fn = fn, .arg = arg }));
+    return true;
+}
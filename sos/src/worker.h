@@ -0,0 +1,41 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+/*
+ * The SOS worker thread.
+ *
+ * The event loop hands work items to the worker over a channel (see
+ * channel.h). A work item runs on another kernel thread, possibly on
+ * another core, so it must only touch state that is safe to share with the
+ * main thread.
+ */
+
+#include <stdbool.h>
+
+/* Number of work items that can be queued on the worker */
+#define WORKER_QUEUE_SIZE   8
+
+typedef void (*worker_fn_t)(void *arg);
+
+/*
+ * Spawn the worker thread.
+ */
+void worker_init(void);
+
+/*
+ * Queue fn(arg) to be run on the worker thread. Never blocks.
+ *
+ * @return  true if the work was queued, false if there is no worker or its
+ *          queue is full.
+ */
+bool worker_submit(worker_fn_t fn, void *arg);